@@ -0,0 +1,15 @@
+{
+  "targets": [
+    {
+      "target_name": "canvas_ops",
+      "sources": ["canvas_addon.cpp"],
+      "include_dirs": [".."],
+      "cflags_cc": ["-std=c++17", "-O2"],
+      "libraries": [
+        "-L<(module_root_dir)/..",
+        "-lcanvasops",
+        "-Wl,-rpath,'$$ORIGIN/../../..'"
+      ]
+    }
+  ]
+}
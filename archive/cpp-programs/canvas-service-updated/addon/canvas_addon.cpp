@@ -0,0 +1,189 @@
+// canvas_addon.cpp
+// Node addon over libcanvasops' C API (canvas_ops_c.h), so server.js can
+// run canvas jobs in its own process instead of in canvas_worker.
+//
+//   run(tool, args, input) → Promise<{ code, output, log }>
+//
+// tool and args are what canvas_run takes (args use "-" for the input and
+// output paths), input is a Buffer of encoded image bytes. The job runs on
+// libuv's thread pool (UV_THREADPOOL_SIZE threads, default 4), never on the
+// JS thread. output is a Buffer over the library's encoded result, handed
+// over without a copy; log is the tool's stdout, or its stderr when code
+// is non-zero.
+//
+//   setThreads(n)  CPU threads each job may use, so concurrent jobs share
+//                  the cores instead of each taking them all
+//
+// Build (libcanvasops.so in the directory above):
+//   cd addon && npx node-gyp rebuild
+#include "canvas_ops_c.h"
+
+#include <node_api.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct Job
+{
+    napi_async_work work = nullptr;
+    napi_deferred deferred = nullptr;
+    napi_ref inputRef = nullptr; // keeps the input Buffer alive while the job reads it
+    std::string tool;
+    std::vector<std::string> args;
+    const unsigned char *input = nullptr;
+    size_t inputSize = 0;
+    canvas_buffer output = {};
+    canvas_buffer log = {};
+    int code = 1;
+};
+
+napi_value throwError(napi_env env, const char *msg)
+{
+    napi_throw_type_error(env, nullptr, msg);
+    return nullptr;
+}
+
+bool getString(napi_env env, napi_value value, std::string &out)
+{
+    size_t len = 0;
+    if (napi_get_value_string_utf8(env, value, nullptr, 0, &len) != napi_ok)
+        return false;
+    out.resize(len + 1);
+    napi_get_value_string_utf8(env, value, &out[0], out.size(), &len);
+    out.resize(len);
+    return true;
+}
+
+void execute(napi_env, void *data)
+{
+    Job *job = static_cast<Job *>(data);
+    std::vector<const char *> argv;
+    for (const std::string &arg : job->args)
+        argv.push_back(arg.c_str());
+    job->code = canvas_run(job->tool.c_str(), argv.data(), static_cast<int>(argv.size()), job->input,
+                           job->inputSize, &job->output, &job->log);
+}
+
+void freeOutput(napi_env, void *, void *hint)
+{
+    canvas_buffer *buffer = static_cast<canvas_buffer *>(hint);
+    canvas_buffer_free(buffer);
+    delete buffer;
+}
+
+void complete(napi_env env, napi_status status, void *data)
+{
+    Job *job = static_cast<Job *>(data);
+    if (status != napi_ok)
+    {
+        napi_value msg, error;
+        napi_create_string_utf8(env, "Canvas job was cancelled", NAPI_AUTO_LENGTH, &msg);
+        napi_create_error(env, nullptr, msg, &error);
+        napi_reject_deferred(env, job->deferred, error);
+    }
+    else
+    {
+        napi_value result, code, log, output;
+        napi_create_object(env, &result);
+        napi_create_int32(env, job->code, &code);
+        napi_create_string_utf8(env, job->log.data ? reinterpret_cast<const char *>(job->log.data) : "",
+                                job->log.size, &log);
+        if (job->output.size > 0)
+        {
+            canvas_buffer *owned = new canvas_buffer(job->output);
+            job->output = canvas_buffer();
+            napi_create_external_buffer(env, owned->size, owned->data, freeOutput, owned, &output);
+        }
+        else
+            napi_create_buffer(env, 0, nullptr, &output);
+        napi_set_named_property(env, result, "code", code);
+        napi_set_named_property(env, result, "output", output);
+        napi_set_named_property(env, result, "log", log);
+        napi_resolve_deferred(env, job->deferred, result);
+    }
+
+    canvas_buffer_free(&job->output);
+    canvas_buffer_free(&job->log);
+    if (job->inputRef)
+        napi_delete_reference(env, job->inputRef);
+    napi_delete_async_work(env, job->work);
+    delete job;
+}
+
+napi_value run(napi_env env, napi_callback_info info)
+{
+    size_t argc = 3;
+    napi_value argv[3];
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr);
+    if (argc < 2)
+        return throwError(env, "run(tool, args, input) needs a tool and an argument array");
+
+    Job *job = new Job();
+    bool isArray = false;
+    uint32_t nargs = 0;
+    if (!getString(env, argv[0], job->tool) || napi_is_array(env, argv[1], &isArray) != napi_ok || !isArray)
+    {
+        delete job;
+        return throwError(env, "run(tool, args, input): tool must be a string and args an array");
+    }
+    napi_get_array_length(env, argv[1], &nargs);
+    for (uint32_t i = 0; i < nargs; ++i)
+    {
+        napi_value element;
+        std::string arg;
+        napi_get_element(env, argv[1], i, &element);
+        if (!getString(env, element, arg))
+        {
+            delete job;
+            return throwError(env, "run(tool, args, input): args must be strings");
+        }
+        job->args.push_back(arg);
+    }
+
+    bool isBuffer = false;
+    if (argc > 2 && napi_is_buffer(env, argv[2], &isBuffer) == napi_ok && isBuffer)
+    {
+        void *data = nullptr;
+        napi_get_buffer_info(env, argv[2], &data, &job->inputSize);
+        job->input = static_cast<const unsigned char *>(data);
+        napi_create_reference(env, argv[2], 1, &job->inputRef);
+    }
+
+    napi_value promise, name;
+    napi_create_promise(env, &job->deferred, &promise);
+    napi_create_string_utf8(env, "canvasOps.run", NAPI_AUTO_LENGTH, &name);
+    napi_create_async_work(env, nullptr, name, execute, complete, job, &job->work);
+    napi_queue_async_work(env, job->work);
+    return promise;
+}
+
+// setThreads(n): canvas_set_threads, for the threads each concurrent job may use.
+napi_value setThreads(napi_env env, napi_callback_info info)
+{
+    size_t argc = 1;
+    napi_value argv[1];
+    int32_t threads = 0;
+    napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr);
+    if (argc < 1 || napi_get_value_int32(env, argv[0], &threads) != napi_ok)
+        return throwError(env, "setThreads(n) needs a number");
+    canvas_set_threads(threads);
+    return nullptr;
+}
+
+napi_value init(napi_env env, napi_value exports)
+{
+    napi_value fn, version;
+    napi_create_function(env, "run", NAPI_AUTO_LENGTH, run, nullptr, &fn);
+    napi_set_named_property(env, exports, "run", fn);
+    napi_create_function(env, "setThreads", NAPI_AUTO_LENGTH, setThreads, nullptr, &fn);
+    napi_set_named_property(env, exports, "setThreads", fn);
+    napi_create_int32(env, canvas_ops_abi_version(), &version);
+    napi_set_named_property(env, exports, "abiVersion", version);
+    return exports;
+}
+
+} // namespace
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, init)
@@ -0,0 +1,266 @@
+// canvas_bench.cpp
+// Stage timings, throughput and peak RSS for the canvas tools, plus golden
+// output checks so a speedup can be shown to keep results identical (or
+// within a tolerance).
+//
+// Each image runs the extend stages (centerSampleThreshold,
+// findForegroundBounds, makeStrip, the final-fit resize) and then the full
+// extend, crop and matte pipelines with the parameters server.js uses by
+// default, plus JPEG decode and encode. Without --corpus, synthetic car
+// shots at 12, 24 and 45 MP are generated (deterministic, so they can be
+// checked against goldens too).
+//
+// Build (from canvas-service-updated/):
+//   g++ -std=c++17 -O2 -Wall -pthread -I. -o canvas_bench bench/canvas_bench.cpp canvas_ops.cpp row_stream.cpp resample.cpp mat_pool.cpp `pkg-config --cflags --libs opencv4`
+// Usage:
+//   ./canvas_bench [--corpus <dir>] [--iterations N] [--golden <dir> [--update-golden]] [--tolerance <maxdiff>]
+//      --golden: compare every pipeline output with <dir>/<image>.<pipeline>.png
+//        (or write them, with --update-golden); fails when any pixel differs by
+//        more than --tolerance (default 0, i.e. pixel-identical)
+#include "canvas_ops.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace cv;
+using namespace canvasops;
+
+struct BenchImage
+{
+    std::string name;
+    std::vector<uchar> encoded; // JPEG bytes, for the decode stage
+    Mat decoded;
+};
+
+// Median wall time of fn in milliseconds, after one warm-up call.
+static double medianMs(int iterations, const std::function<void()> &fn)
+{
+    fn();
+    std::vector<double> times;
+    for (int i = 0; i < iterations; ++i)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        fn();
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+static double peakRssMb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0; // KB on Linux
+}
+
+// White studio backdrop with a dark car body and wheels across the middle
+// third and a floor shadow, plus sensor noise.
+static Mat syntheticCar(int w, int h, uint64 seed)
+{
+    Mat img(h, w, CV_8UC3, Scalar(245, 245, 245));
+    Point c(w / 2, h / 2);
+    rectangle(img, Rect(w / 6, h * 2 / 5, w * 2 / 3, h / 6), Scalar(40, 30, 120), FILLED);
+    ellipse(img, Point(c.x, h * 2 / 5), Size(w / 4, h / 10), 0, 180, 360, Scalar(60, 50, 140), FILLED);
+    circle(img, Point(w * 3 / 10, h * 17 / 30), h / 14, Scalar(20, 20, 20), FILLED);
+    circle(img, Point(w * 7 / 10, h * 17 / 30), h / 14, Scalar(20, 20, 20), FILLED);
+    ellipse(img, Point(c.x, h * 19 / 30), Size(w * 3 / 8, h / 40), 0, 0, 360, Scalar(200, 200, 200), FILLED);
+
+    Mat noise(h, w, CV_8UC3);
+    RNG rng(seed);
+    rng.fill(noise, RNG::UNIFORM, Scalar::all(0), Scalar::all(8));
+    img -= noise;
+    return img;
+}
+
+static std::vector<BenchImage> loadCorpus(const std::string &dir)
+{
+    std::vector<String> paths;
+    glob(dir + "/*", paths, false);
+    std::vector<BenchImage> images;
+    for (const String &path : paths)
+    {
+        std::ifstream in(path, std::ios::binary);
+        BenchImage image;
+        image.encoded.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        image.decoded = imdecode(image.encoded, IMREAD_COLOR);
+        if (image.decoded.empty())
+            continue;
+        image.name = path.substr(path.find_last_of('/') + 1);
+        images.push_back(image);
+    }
+    return images;
+}
+
+static std::vector<BenchImage> syntheticCorpus()
+{
+    const struct
+    {
+        const char *name;
+        int w, h;
+    } sizes[] = {{"synthetic-12mp", 4240, 2832}, {"synthetic-24mp", 6000, 4000}, {"synthetic-45mp", 8256, 5504}};
+    std::vector<BenchImage> images;
+    for (const auto &s : sizes)
+    {
+        BenchImage image;
+        image.name = s.name;
+        image.decoded = syntheticCar(s.w, s.h, static_cast<uint64>(s.w) * s.h);
+        imencode(".jpg", image.decoded, image.encoded);
+        images.push_back(image);
+    }
+    return images;
+}
+
+// Compare out with (or store it as) the golden for name.pipeline. True on
+// a match, or when the golden was written.
+static bool checkGolden(const std::string &dir, bool update, int tolerance, const std::string &name,
+                        const char *pipeline, const Mat &out)
+{
+    if (dir.empty())
+        return true;
+    std::string path = dir + "/" + name + "." + pipeline + ".png";
+    if (update)
+    {
+        if (!imwrite(path, out))
+        {
+            printf("  golden %-8s cannot write %s\n", pipeline, path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    Mat golden = imread(path);
+    if (golden.empty() || golden.size() != out.size() || golden.type() != out.type())
+    {
+        printf("  golden %-8s MISMATCH (%s)\n", pipeline, golden.empty() ? "missing" : "size differs");
+        return false;
+    }
+    double maxDiff = norm(out, golden, NORM_INF);
+    double psnr = maxDiff == 0 ? 0 : PSNR(out, golden);
+    bool ok = maxDiff <= tolerance;
+    printf("  golden %-8s %s max diff %.0f", pipeline, ok ? "ok" : "MISMATCH", maxDiff);
+    if (maxDiff > 0)
+        printf(", PSNR %.1f dB", psnr);
+    printf("\n");
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    std::string corpusDir, goldenDir;
+    int iterations = 5, tolerance = 0;
+    bool updateGolden = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--corpus" && hasValue)
+            corpusDir = argv[++i];
+        else if (arg == "--iterations" && hasValue)
+            iterations = std::max(1, atoi(argv[++i]));
+        else if (arg == "--golden" && hasValue)
+            goldenDir = argv[++i];
+        else if (arg == "--update-golden")
+            updateGolden = true;
+        else if (arg == "--tolerance" && hasValue)
+            tolerance = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "Usage: %s [--corpus <dir>] [--iterations N] [--golden <dir> [--update-golden]] [--tolerance <maxdiff>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<BenchImage> images = corpusDir.empty() ? syntheticCorpus() : loadCorpus(corpusDir);
+    if (images.empty())
+    {
+        fprintf(stderr, "Error: No readable images in %s\n", corpusDir.c_str());
+        return 1;
+    }
+    printf("%zu images, %d iterations, OpenCV threads %d\n", images.size(), iterations, getNumThreads());
+
+    int failures = 0;
+    for (const BenchImage &image : images)
+    {
+        const Mat &img = image.decoded;
+        const double mp = img.total() / 1e6;
+        printf("\n%s  %dx%d (%.1f MP)\n", image.name.c_str(), img.cols, img.rows, mp);
+        printf("  %-24s %9s %9s\n", "stage", "ms", "MP/s");
+        auto report = [&](const char *stage, const std::function<void()> &fn)
+        {
+            double ms = medianMs(iterations, fn);
+            printf("  %-24s %9.1f %9.1f\n", stage, ms, mp / (ms / 1000.0));
+        };
+
+        // Stages of extend_canvas, in pipeline order
+        int thr = 0, fgTop = 0, fgBot = 0;
+        report("decode (jpeg)", [&]()
+               { imdecode(image.encoded, IMREAD_COLOR); });
+        report("centerSampleThreshold", [&]()
+               { thr = centerSampleThreshold(img); });
+        report("threshold (all stripes)", [&]()
+               { centerSampleThreshold(img, 20, 40, SampleRegion::All); });
+        report("findForegroundBounds", [&]()
+               { findForegroundBounds(img, fgTop, fgBot, thr); });
+        Mat topSrc = img.rowRange(0, std::max(1, fgTop));
+        report("makeStrip", [&]()
+               { makeStrip(topSrc, img.rows / 4, img.cols); });
+        Mat fitted(1920, 1080, img.type());
+        Mat fitSrc = img.colRange(0, std::min(img.cols, img.rows * 1080 / 1920));
+        report("final-fit resize", [&]()
+               { resampleInto(fitSrc, fitted, ResizeQuality::Best); });
+
+        // Full pipelines (server.js defaults)
+        ExtendParams extend;
+        extend.desiredH = img.rows * 3 / 2;
+        extend.requestedW = 1080;
+        extend.requestedH = 1920;
+        ExtendResult extended;
+        std::ostringstream log;
+        std::string err;
+        report("pipeline extend", [&]()
+               { extendCanvas(img, extend, extended, log, err); });
+        ExtendParams modelled = extend;
+        modelled.mode = ExtendMode::Model;
+        report("pipeline extend (model)", [&]()
+               { extendCanvas(img, modelled, extended, log, err); });
+
+        CropParams crop;
+        crop.cropWidth = std::min(img.cols, img.rows * 1080 / 1920);
+        crop.cropX = (img.cols - crop.cropWidth) / 2;
+        Mat cropped;
+        report("pipeline crop", [&]()
+               { CropParams p = crop;
+                 cropAndFit(img, p, cropped, err); });
+
+        MatteParams matte;
+        matte.paddingPercent = 5;
+        matte.hexColor = "#ffffff";
+        Mat matted;
+        report("pipeline matte", [&]()
+               { createMatte(img, matte, matted, err); });
+
+        std::vector<uchar> jpeg;
+        report("encode extend (jpeg)", [&]()
+               { imencode(".jpg", extended.image, jpeg); });
+        printf("  peak RSS so far: %.0f MB\n", peakRssMb());
+
+        failures += !checkGolden(goldenDir, updateGolden, tolerance, image.name, "extend", extended.image);
+        failures += !checkGolden(goldenDir, updateGolden, tolerance, image.name, "crop", cropped);
+        failures += !checkGolden(goldenDir, updateGolden, tolerance, image.name, "matte", matted);
+    }
+
+    if (!goldenDir.empty())
+        printf("\n%s: %d mismatches\n", updateGolden ? "Goldens written" : "Golden check", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+// resample_bench.cpp
+// Times the output-fit resizes: OpenCV's INTER_LANCZOS4 / INTER_AREA
+// against resampleFilter (Lanczos3, Mitchell) and each --quality tier, and
+// reports PSNR against INTER_LANCZOS4 so a speedup is not bought with a
+// visibly different image.
+//
+// Build (from canvas-service-updated/):
+//   g++ -std=c++17 -O2 -Wall -pthread -I. -o resample_bench bench/resample_bench.cpp resample.cpp mat_pool.cpp `pkg-config --cflags --libs opencv4`
+// Usage:
+//   ./resample_bench [image] [iterations]   (default: synthetic 6000x4000, 10)
+#include "resample.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace cv;
+
+// Median wall time of fn in milliseconds, after one warm-up call.
+static double medianMs(int iterations, const std::function<void()> &fn)
+{
+    fn();
+    std::vector<double> times;
+    for (int i = 0; i < iterations; ++i)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        fn();
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+// Photo-like test card: smooth gradients plus fine detail and noise, so
+// both the ringing and the aliasing of a filter show up in the PSNR.
+static Mat syntheticImage(int w, int h)
+{
+    Mat img(h, w, CV_8UC3);
+    for (int y = 0; y < h; ++y)
+    {
+        Vec3b *row = img.ptr<Vec3b>(y);
+        for (int x = 0; x < w; ++x)
+        {
+            double fine = 40 * ((x / 3 + y / 3) % 2);
+            row[x] = Vec3b(saturate_cast<uchar>(255.0 * x / w), saturate_cast<uchar>(255.0 * y / h),
+                           saturate_cast<uchar>(100 + fine));
+        }
+    }
+    Mat noise(h, w, CV_8UC3);
+    randu(noise, Scalar::all(0), Scalar::all(24));
+    img += noise;
+    return img;
+}
+
+int main(int argc, char **argv)
+{
+    Mat src = argc > 1 ? imread(argv[1]) : syntheticImage(6000, 4000);
+    int iterations = argc > 2 ? std::max(1, atoi(argv[2])) : 10;
+    if (src.empty())
+    {
+        fprintf(stderr, "Error: Could not read %s\n", argv[1]);
+        return 1;
+    }
+    printf("source %dx%d, %d iterations, OpenCV threads %d\n", src.cols, src.rows, iterations, getNumThreads());
+
+    const Size targets[] = {Size(1080, 720), Size(1920, 1280), Size(src.cols * 3 / 4, src.rows * 3 / 4),
+                            Size(src.cols * 3 / 2, src.rows * 3 / 2)};
+    for (const Size &target : targets)
+    {
+        Mat reference;
+        resize(src, reference, target, 0, 0, INTER_LANCZOS4);
+        printf("\n%dx%d -> %dx%d\n", src.cols, src.rows, target.width, target.height);
+        printf("  %-22s %9s %9s\n", "method", "ms", "PSNR dB");
+
+        auto report = [&](const char *name, const std::function<void(Mat &)> &run)
+        {
+            Mat dst(target, src.type());
+            double ms = medianMs(iterations, [&]()
+                                 { run(dst); });
+            double psnr = PSNR(dst, reference);
+            printf("  %-22s %9.1f %9.1f\n", name, ms, psnr);
+        };
+
+        report("cv INTER_LANCZOS4", [&](Mat &dst)
+               { resize(src, dst, target, 0, 0, INTER_LANCZOS4); });
+        report("cv INTER_AREA", [&](Mat &dst)
+               { resize(src, dst, target, 0, 0, INTER_AREA); });
+        report("resample Lanczos3", [&](Mat &dst)
+               { resampleFilter(src, dst, ResampleFilter::Lanczos3); });
+        report("resample Mitchell", [&](Mat &dst)
+               { resampleFilter(src, dst, ResampleFilter::Mitchell); });
+        setResampleThreads(1);
+        report("resample Lanczos3 x1", [&](Mat &dst)
+               { resampleFilter(src, dst, ResampleFilter::Lanczos3); });
+        setResampleThreads(0);
+        for (ResizeQuality q : {ResizeQuality::Fast, ResizeQuality::Balanced, ResizeQuality::Best})
+        {
+            std::string name = std::string("--quality ") + resizeQualityName(q);
+            report(name.c_str(), [&](Mat &dst)
+                   { resampleInto(src, dst, q); });
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,236 @@
+// startup_bench.cpp
+// Cold-start cost of a canvas_worker build, to compare the full image with
+// the slim one (Dockerfile.slim): time from exec to the first answered ping
+// (loader, static initialisers, warm-up), to the first answered extend job
+// on a small JPEG, and to exit once stdin closes; plus, for a local binary,
+// its size and the shared objects it maps.
+//
+// The page cache is not dropped, so these are warm-disk starts, as on a
+// Cloud Run instance that already pulled the image. With --prefix each
+// worker runs under that command, e.g. a "docker run" of an image, which
+// then times the container start as well.
+//
+// Build (from canvas-service-updated/):
+//   g++ -std=c++17 -O2 -Wall -pthread -o startup_bench bench/startup_bench.cpp `pkg-config --cflags --libs opencv4`
+// Usage:
+//   ./startup_bench [--iterations N] [--prefix "<command>"] <worker> [[--prefix "<command>"] <worker> ...]
+//      e.g. ./startup_bench /app/canvas_worker /app/canvas_worker.x86-64-v3
+//           ./startup_bench --prefix "docker run --rm -i canvas-service" /app/canvas_worker --prefix "docker run --rm -i canvas-service:slim" /app/canvas_worker
+#include <opencv2/opencv.hpp>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace cv;
+
+struct Target
+{
+    std::vector<std::string> prefix;
+    std::string worker;
+};
+
+struct Sample
+{
+    double pingMs = 0, jobMs = 0, exitMs = 0;
+    size_t sharedObjects = 0;
+};
+
+static double msSince(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static std::vector<std::string> splitWords(const std::string &text)
+{
+    std::istringstream in(text);
+    std::vector<std::string> words;
+    std::string word;
+    while (in >> word)
+        words.push_back(word);
+    return words;
+}
+
+// Distinct shared objects in /proc/<pid>/maps.
+static size_t sharedObjectCount(pid_t pid)
+{
+    std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+    std::set<std::string> paths;
+    std::string line;
+    while (std::getline(maps, line))
+    {
+        size_t slash = line.find('/');
+        if (slash != std::string::npos && line.find(".so", slash) != std::string::npos)
+            paths.insert(line.substr(slash));
+    }
+    return paths.size();
+}
+
+// Reads one response frame; false on EOF or an err response.
+static bool readResponse(FILE *in, const std::string &id)
+{
+    char header[256];
+    if (!fgets(header, sizeof(header), in))
+        return false;
+    char gotId[64], status[16];
+    size_t msgBytes = 0, nbytes = 0;
+    if (sscanf(header, "%63s %15s %zu %zu", gotId, status, &msgBytes, &nbytes) != 4)
+        return false;
+    std::vector<char> body(msgBytes + nbytes);
+    if (!body.empty() && fread(body.data(), 1, body.size(), in) != body.size())
+        return false;
+    if (std::string(status) == "chunk")
+        return readResponse(in, id);
+    if (std::string(status) != "ok" || gotId != id)
+    {
+        fprintf(stderr, "Error: %s %s: %.*s\n", gotId, status, static_cast<int>(msgBytes), body.data());
+        return false;
+    }
+    return true;
+}
+
+static bool runOnce(const Target &target, const std::vector<uchar> &jpeg, Sample &sample)
+{
+    int toChild[2], fromChild[2];
+    if (pipe(toChild) != 0 || pipe(fromChild) != 0)
+    {
+        perror("pipe");
+        return false;
+    }
+
+    std::vector<std::string> words = target.prefix;
+    words.push_back(target.worker);
+    std::vector<char *> argv;
+    for (std::string &word : words)
+        argv.push_back(&word[0]);
+    argv.push_back(nullptr);
+
+    auto t0 = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(toChild[0], 0);
+        dup2(fromChild[1], 1);
+        close(toChild[1]);
+        close(fromChild[0]);
+        execvp(argv[0], argv.data());
+        perror(argv[0]);
+        _exit(127);
+    }
+    close(toChild[0]);
+    close(fromChild[1]);
+    FILE *out = fdopen(toChild[1], "w");
+    FILE *in = fdopen(fromChild[0], "r");
+
+    fputs("1 ping 0\n", out);
+    fflush(out);
+    bool ok = readResponse(in, "1");
+    sample.pingMs = msSince(t0);
+
+    if (ok)
+    {
+        fprintf(out, "2 extend %zu - - 480\n", jpeg.size());
+        fwrite(jpeg.data(), 1, jpeg.size(), out);
+        fflush(out);
+        ok = readResponse(in, "2");
+        sample.jobMs = msSince(t0);
+        sample.sharedObjects = target.prefix.empty() ? sharedObjectCount(pid) : 0;
+    }
+
+    fclose(out);
+    while (fgetc(in) != EOF)
+    {
+    }
+    fclose(in);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    sample.exitMs = msSince(t0);
+    return ok;
+}
+
+static double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+int main(int argc, char **argv)
+{
+    signal(SIGPIPE, SIG_IGN); // a worker that dies early is reported, not fatal
+    int iterations = 20;
+    std::vector<std::string> prefix;
+    std::vector<Target> targets;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--iterations" && i + 1 < argc)
+            iterations = std::max(1, atoi(argv[++i]));
+        else if (arg == "--prefix" && i + 1 < argc)
+            prefix = splitWords(argv[++i]);
+        else
+            targets.push_back({prefix, arg});
+    }
+    if (targets.empty())
+    {
+        fprintf(stderr, "Usage: %s [--iterations N] [--prefix \"<command>\"] <worker> ...\n", argv[0]);
+        return 1;
+    }
+
+    // A small car-on-white shot, so the job exercises decode, the extend
+    // stages and encode without its own run time hiding the start-up
+    Mat img(480, 640, CV_8UC3, Scalar(245, 245, 245));
+    rectangle(img, Rect(120, 200, 400, 100), Scalar(40, 30, 120), FILLED);
+    std::vector<uchar> jpeg;
+    imencode(".jpg", img, jpeg);
+
+    printf("%d iterations, median (min) ms from exec\n", iterations);
+    printf("  %-48s %15s %15s %15s %6s %9s\n", "worker", "first ping", "first job", "exit", ".so", "size MB");
+    for (const Target &target : targets)
+    {
+        std::vector<double> ping, job, exitMs;
+        size_t sharedObjects = 0;
+        for (int i = 0; i < iterations; ++i)
+        {
+            Sample sample;
+            if (!runOnce(target, jpeg, sample))
+            {
+                fprintf(stderr, "Error: %s did not answer\n", target.worker.c_str());
+                return 1;
+            }
+            ping.push_back(sample.pingMs);
+            job.push_back(sample.jobMs);
+            exitMs.push_back(sample.exitMs);
+            sharedObjects = sample.sharedObjects;
+        }
+
+        std::string name = target.worker;
+        if (!target.prefix.empty())
+            name = target.prefix.back() + ":" + name;
+        struct stat st;
+        bool local = target.prefix.empty() && stat(target.worker.c_str(), &st) == 0;
+        char count[16] = "-", size[16] = "-";
+        if (local)
+        {
+            snprintf(count, sizeof(count), "%zu", sharedObjects);
+            snprintf(size, sizeof(size), "%.1f", st.st_size / 1048576.0);
+        }
+        auto cell = [](const std::vector<double> &v)
+        {
+            char text[32];
+            snprintf(text, sizeof(text), "%.1f (%.1f)", median(v), *std::min_element(v.begin(), v.end()));
+            return std::string(text);
+        };
+        printf("  %-48s %15s %15s %15s %6s %9s\n", name.c_str(), cell(ping).c_str(), cell(job).c_str(),
+               cell(exitMs).c_str(), count, size);
+    }
+    return 0;
+}
@@ -0,0 +1,174 @@
+// In-process canvas jobs through the N-API addon (addon/canvas_addon.cpp
+// over libcanvasops), an alternative to the canvas_worker pool: no child
+// processes or pipes, the input Buffer is read where it is, and the result
+// arrives as a Buffer over the library's own memory.
+//
+// CanvasOpsEngine.run takes the same arguments as CanvasWorkerPool.run,
+// so SourceRegistry and server.js use either one unchanged; only onChunk
+// is never called, as the library returns the output whole.
+const os = require("os");
+const path = require("path");
+
+const loadAddon = () => {
+  try {
+    return require(
+      path.join(__dirname, "addon", "build", "Release", "canvas_ops.node")
+    );
+  } catch {
+    return null;
+  }
+};
+const addon = loadAddon();
+
+const TOOLS = ["extend", "crop", "matte", "pipeline", "probe"];
+const PRIORITIES = ["interactive", "batch"];
+
+class CanvasOpsEngine {
+  // Jobs run on libuv's thread pool (UV_THREADPOOL_SIZE, default 4, set in
+  // the environment before start); one thread is left for fs and DNS work.
+  // Past `jobs` running, up to maxQueued wait here, interactive first, and
+  // the rest fail with "busy". Sources passed with "--source <key>" keep
+  // their bytes for follow-up jobs, up to sourceBytes in total.
+  constructor({
+    jobs = Math.max(
+      1,
+      (parseInt(process.env.UV_THREADPOOL_SIZE, 10) || 4) - 1
+    ),
+    maxQueued = 256,
+    sourceBytes = 128 * 1024 * 1024,
+  } = {}) {
+    if (!addon) {
+      throw new Error("canvas_ops addon is not built (see addon/binding.gyp)");
+    }
+    this.jobs = Math.max(1, jobs);
+    this.maxQueued = maxQueued;
+    this.sourceBytes = sourceBytes;
+    this.sources = new Map(); // key -> Buffer, oldest first
+    this.keptBytes = 0;
+    this.running = 0;
+    this.queue = [];
+    // Concurrent jobs share the cores, as canvas_worker's --jobs do
+    addon.setThreads(Math.max(1, Math.floor(os.cpus().length / this.jobs)));
+  }
+
+  start() {}
+
+  keepSource(key, buffer) {
+    if (this.sources.has(key)) {
+      this.keptBytes -= this.sources.get(key).length;
+      this.sources.delete(key);
+    }
+    if (buffer.length > this.sourceBytes) return;
+    this.sources.set(key, buffer);
+    this.keptBytes += buffer.length;
+    for (const [oldKey, old] of this.sources) {
+      if (this.keptBytes <= this.sourceBytes) break;
+      this.sources.delete(oldKey);
+      this.keptBytes -= old.length;
+    }
+  }
+
+  // The pool's leading --source/--priority options name what the worker
+  // would have kept; here they pick the kept bytes instead.
+  resolveInput(args, input) {
+    let source;
+    let rest = args;
+    while (rest[0] === "--source" || rest[0] === "--priority") {
+      if (rest[0] === "--source") source = rest[1];
+      rest = rest.slice(2);
+    }
+    if (source !== undefined) {
+      if (input && input.length > 0) {
+        this.keepSource(source, input);
+      } else if (this.sources.has(source)) {
+        input = this.sources.get(source);
+        this.sources.delete(source); // most recently used last
+        this.sources.set(source, input);
+      } else {
+        return { error: new Error("source-miss") };
+      }
+    }
+    return { args: rest, input };
+  }
+
+  run(
+    op,
+    args,
+    { timeout = 30000, input = Buffer.alloc(0), priority = "interactive" } = {}
+  ) {
+    if (!TOOLS.includes(op)) {
+      return Promise.reject(new Error(`Unknown canvas op: ${op}`));
+    }
+    if (!PRIORITIES.includes(priority)) {
+      return Promise.reject(new Error(`Unknown job priority: ${priority}`));
+    }
+    const resolved = this.resolveInput(args, input);
+    if (resolved.error) return Promise.reject(resolved.error);
+
+    return new Promise((resolve, reject) => {
+      const job = { op, ...resolved, timeout, priority, resolve, reject };
+      if (this.running < this.jobs) {
+        this.dispatch(job);
+      } else if (this.queue.length >= this.maxQueued) {
+        reject(new Error("busy"));
+      } else {
+        this.queue.push(job);
+      }
+    });
+  }
+
+  // A timed-out job is abandoned, not stopped: native code cannot be
+  // interrupted, so its thread stays counted until it returns.
+  dispatch(job) {
+    this.running++;
+    let timedOut = false;
+    const timer = setTimeout(() => {
+      timedOut = true;
+      job.reject(new Error("Processing timeout"));
+    }, job.timeout);
+    addon
+      .run(job.op, job.args, job.input)
+      .then((result) => {
+        if (timedOut) return;
+        if (result.code === 0) {
+          job.resolve({
+            stdout: result.log,
+            stderr: "",
+            output: result.output,
+          });
+        } else {
+          job.reject(new Error(result.log.trim() || `${job.op} failed`));
+        }
+      }, job.reject)
+      .finally(() => {
+        clearTimeout(timer);
+        this.running--;
+        const index = this.queue.findIndex(
+          (queued) => queued.priority === "interactive"
+        );
+        if (this.queue.length > 0) {
+          this.dispatch(this.queue.splice(Math.max(index, 0), 1)[0]);
+        }
+      });
+  }
+
+  // canvasOps.extend(buffer, args) and friends: one job on encoded bytes,
+  // with the tool's arguments ("-" for the input and output paths).
+  extend(buffer, args, options) {
+    return this.run("extend", args, { ...options, input: buffer });
+  }
+
+  crop(buffer, args, options) {
+    return this.run("crop", args, { ...options, input: buffer });
+  }
+
+  matte(buffer, args, options) {
+    return this.run("matte", args, { ...options, input: buffer });
+  }
+
+  pipeline(buffer, args, options) {
+    return this.run("pipeline", args, { ...options, input: buffer });
+  }
+}
+
+module.exports = { CanvasOpsEngine, addonAvailable: addon !== null };
@@ -0,0 +1,594 @@
+// canvas_batch.cpp
+// Re-renders a manifest of archive images with one of the canvas tools.
+// Sources are fetched (HTTP(S), gs:// or local files) by a set of download
+// threads while a CPU pool renders the ones already fetched and a set of
+// upload threads writes the results, so network latency overlaps the work.
+// Every result written is appended to a checkpoint file, and a restarted
+// run skips the outputs it lists.
+//
+// Build:
+//   g++ -std=c++17 -O2 -Wall -pthread -o canvas_batch canvas_batch.cpp canvas_cli.cpp canvas_ops.cpp pipeline.cpp row_stream.cpp jpeg_io.cpp image_probe.cpp mat_pool.cpp resample.cpp `pkg-config --cflags --libs opencv4` -ljpeg -lcurl
+// Usage:
+//   ./canvas_batch --manifest <path> [--checkpoint <path>] [--jobs N] [--io N] <op> <tool args...>
+//      op is extend, crop, matte or pipeline; the tool args are that tool's
+//      own, with "-" for the input and output paths, e.g.
+//        extend - - 1800 0.05 -1 1920 1080
+//        matte --input - --output - --width 1920 --height 1080 --format webp
+//      manifest lines are "<source> <dest> [extra tool args]"; # starts a comment
+//        source: http(s):// URL, gs://bucket/object or a local path
+//        dest:   gs://bucket/object, http(s):// URL (PUT, e.g. a signed URL) or a local path
+//      --checkpoint  completed dests, one per line (default <manifest>.done);
+//                    use a fresh one when the tool args change
+//      --jobs        images rendered at once (default: one per core)
+//      --io          concurrent downloads, and as many uploads (default 16)
+//      gs:// requests use $CANVAS_GCS_TOKEN when set, else the metadata server's token
+#include "canvas_cli.hpp"
+#include "mat_pool.hpp"
+#include "resample.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <curl/curl.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+using namespace cv;
+
+namespace
+{
+
+// Whole-string integer, as canvas_cli parses tool options
+bool parseIntValue(const std::string &text, int &value)
+{
+    try
+    {
+        size_t used = 0;
+        value = std::stoi(text, &used);
+        return used == text.size();
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+// Hands items from one stage to the next. push blocks while the queue is
+// full, so a fast stage cannot run ahead and hold the whole archive in memory.
+template <class T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(std::max<size_t>(1, capacity)) {}
+
+    void push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this]()
+                      { return items_.size() < capacity_; });
+        items_.push_back(std::move(item));
+        notEmpty_.notify_one();
+    }
+
+    // false once the queue is closed and drained
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this]()
+                       { return !items_.empty() || closed_; });
+        if (items_.empty())
+            return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+    }
+
+private:
+    std::deque<T> items_;
+    size_t capacity_;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable notFull_, notEmpty_;
+};
+
+struct Item
+{
+    std::string source, dest;
+    std::vector<std::string> extraArgs;
+};
+
+struct Fetched
+{
+    size_t index = 0;
+    std::vector<uchar> bytes;
+};
+
+struct Rendered
+{
+    size_t index = 0;
+    std::vector<uchar> bytes;
+    std::string mime;
+};
+
+bool startsWith(const std::string &s, const char *prefix)
+{
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+bool isHttp(const std::string &path)
+{
+    return startsWith(path, "http://") || startsWith(path, "https://");
+}
+
+size_t appendBytes(char *data, size_t size, size_t count, void *userdata)
+{
+    auto *body = static_cast<std::vector<uchar> *>(userdata);
+    body->insert(body->end(), data, data + size * count);
+    return size * count;
+}
+
+// One request on the calling thread's handle (reused, so connections to the
+// same host stay open). Returns the HTTP status, or 0 when the transfer
+// itself failed.
+long httpRequest(CURL *curl, const std::string &url, const std::vector<uchar> *putBody,
+                 const std::vector<std::string> &headers, std::vector<uchar> &response, std::string &err)
+{
+    curl_easy_reset(curl);
+    response.clear();
+    curl_slist *list = nullptr;
+    for (const std::string &h : headers)
+        list = curl_slist_append(list, h.c_str());
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+    // a stalled transfer is retried rather than waited on forever
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 60L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, appendBytes);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+    if (putBody)
+    {
+        // no "Expect: 100-continue" round trip before every upload
+        list = curl_slist_append(list, "Expect:");
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, putBody->data());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(putBody->size()));
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+
+    CURLcode rc = curl_easy_perform(curl);
+    long status = 0;
+    if (rc == CURLE_OK)
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    else
+        err = curl_easy_strerror(rc);
+    curl_slist_free_all(list);
+    return status;
+}
+
+// Bearer token for gs:// requests: $CANVAS_GCS_TOKEN as given, or the
+// instance's service-account token, fetched once and renewed shortly
+// before it expires (a long batch outlives several).
+class GcsAuth
+{
+public:
+    GcsAuth()
+    {
+        if (const char *token = getenv("CANVAS_GCS_TOKEN"))
+        {
+            token_ = token;
+            fixed_ = true;
+        }
+    }
+
+    bool header(CURL *curl, std::string &out, std::string &err)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!fixed_ && (token_.empty() || std::chrono::steady_clock::now() >= expires_))
+        {
+            std::vector<uchar> body;
+            long status = httpRequest(curl, "http://metadata.google.internal/computeMetadata/v1/instance/service-accounts/default/token",
+                                      nullptr, {"Metadata-Flavor: Google"}, body, err);
+            std::string json(body.begin(), body.end());
+            std::string token = jsonField(json, "access_token");
+            if (status != 200 || token.empty())
+            {
+                if (err.empty())
+                    err = "no gs:// credentials (set CANVAS_GCS_TOKEN or run with a service account)";
+                return false;
+            }
+            long ttl = strtol(jsonField(json, "expires_in").c_str(), nullptr, 10);
+            token_ = token;
+            expires_ = std::chrono::steady_clock::now() + std::chrono::seconds(std::max(0L, ttl - 60));
+        }
+        out = "Authorization: Bearer " + token_;
+        return true;
+    }
+
+    // After a 401: fetch a new token next time (a fixed one cannot be renewed).
+    void invalidate()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!fixed_)
+            token_.clear();
+    }
+
+private:
+    // The metadata server's reply is flat JSON; a string or number field is all we need.
+    static std::string jsonField(const std::string &json, const std::string &name)
+    {
+        size_t at = json.find("\"" + name + "\"");
+        if (at == std::string::npos || (at = json.find(':', at)) == std::string::npos)
+            return "";
+        at = json.find_first_not_of(" \t\"", at + 1);
+        if (at == std::string::npos)
+            return "";
+        size_t end = json.find_first_of("\",} \t\n", at);
+        return json.substr(at, end == std::string::npos ? std::string::npos : end - at);
+    }
+
+    std::mutex mutex_;
+    std::string token_;
+    std::chrono::steady_clock::time_point expires_;
+    bool fixed_ = false;
+};
+
+// gs://bucket/a/b c.jpg → https://storage.googleapis.com/bucket/a/b%20c.jpg
+std::string gcsUrl(CURL *curl, const std::string &path)
+{
+    std::string rest = path.substr(5);
+    size_t slash = rest.find('/');
+    std::string url = "https://storage.googleapis.com/" + rest.substr(0, slash);
+    while (slash != std::string::npos)
+    {
+        size_t next = rest.find('/', slash + 1);
+        std::string segment = rest.substr(slash + 1, next == std::string::npos ? std::string::npos : next - slash - 1);
+        char *escaped = curl_easy_escape(curl, segment.c_str(), static_cast<int>(segment.size()));
+        url += "/";
+        url += escaped;
+        curl_free(escaped);
+        slash = next;
+    }
+    return url;
+}
+
+// GET or PUT with up to four attempts: transfer errors, 429 and 5xx are
+// retried with backoff, other statuses fail at once.
+bool transfer(CURL *curl, GcsAuth &auth, const std::string &path, const std::vector<uchar> *putBody,
+              const std::string &mime, std::vector<uchar> &response, std::string &err)
+{
+    bool gcs = startsWith(path, "gs://");
+    std::string url = gcs ? gcsUrl(curl, path) : path;
+    for (int attempt = 0;; ++attempt)
+    {
+        std::vector<std::string> headers;
+        if (putBody && !mime.empty())
+            headers.push_back("Content-Type: " + mime);
+        std::string authHeader;
+        if (gcs)
+        {
+            if (!auth.header(curl, authHeader, err))
+                return false;
+            headers.push_back(authHeader);
+        }
+
+        err.clear();
+        long status = httpRequest(curl, url, putBody, headers, response, err);
+        if (status >= 200 && status < 300)
+            return true;
+        if (status == 401 && gcs)
+            auth.invalidate();
+        bool retry = status == 0 || status == 429 || status >= 500 || (status == 401 && gcs && attempt == 0);
+        if (status != 0)
+            err = "HTTP " + std::to_string(status);
+        if (!retry || attempt == 3)
+            return false;
+        std::this_thread::sleep_for(std::chrono::seconds(1 << attempt));
+    }
+}
+
+bool fetchSource(CURL *curl, GcsAuth &auth, const std::string &source, std::vector<uchar> &bytes, std::string &err)
+{
+    if (isHttp(source) || startsWith(source, "gs://"))
+        return transfer(curl, auth, source, nullptr, "", bytes, err);
+    std::ifstream in(source, std::ios::binary);
+    if (!in)
+    {
+        err = "Cannot open input";
+        return false;
+    }
+    bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Local files are written next to dest and renamed into place, so an
+// interrupted run never leaves a truncated output behind.
+bool writeResult(CURL *curl, GcsAuth &auth, const std::string &dest, const Rendered &result, std::string &err)
+{
+    if (isHttp(dest) || startsWith(dest, "gs://"))
+    {
+        std::vector<uchar> response;
+        return transfer(curl, auth, dest, &result.bytes, result.mime, response, err);
+    }
+    std::error_code ec;
+    std::filesystem::path parent = std::filesystem::path(dest).parent_path();
+    if (!parent.empty())
+        std::filesystem::create_directories(parent, ec);
+    std::string part = dest + ".part";
+    {
+        std::ofstream out(part, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(result.bytes.data()), static_cast<std::streamsize>(result.bytes.size()));
+        if (!out)
+        {
+            err = "Could not write output";
+            return false;
+        }
+    }
+    std::filesystem::rename(part, dest, ec);
+    if (ec)
+    {
+        err = "Could not write output: " + ec.message();
+        return false;
+    }
+    return true;
+}
+
+std::string outputType(const std::string &log)
+{
+    size_t at = log.find("Output type: ");
+    if (at == std::string::npos)
+        return "";
+    at += 13;
+    return log.substr(at, log.find('\n', at) - at);
+}
+
+std::string firstLine(const std::string &text)
+{
+    std::string line = text.substr(0, text.find('\n'));
+    return line.empty() ? "failed" : line;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string manifestPath, checkpointPath;
+    unsigned jobs = 0, ioThreads = 16;
+    int first = 1;
+    for (; first < argc && argv[first][0] == '-' && argv[first][1] == '-'; ++first)
+    {
+        std::string arg = argv[first];
+        if (first + 1 >= argc)
+            break;
+        if (arg == "--manifest")
+            manifestPath = argv[++first];
+        else if (arg == "--checkpoint")
+            checkpointPath = argv[++first];
+        else if (arg == "--jobs")
+        {
+            int value = 0;
+            if (!parseIntValue(argv[++first], value) || value < 0)
+            {
+                std::cerr << "Error: --jobs must be a whole number, 0 or more (0 = one per core)." << std::endl;
+                return 1;
+            }
+            jobs = static_cast<unsigned>(value);
+        }
+        else if (arg == "--io")
+            ioThreads = static_cast<unsigned>(std::max(1L, strtol(argv[++first], nullptr, 10)));
+        else
+        {
+            std::cerr << "Error: Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    canvascli::ToolRunner run = nullptr;
+    std::string op = first < argc ? argv[first] : "";
+    if (op == "extend")
+        run = canvascli::runExtendCanvas;
+    else if (op == "crop")
+        run = canvascli::runImageCropper;
+    else if (op == "matte")
+        run = canvascli::runMatteGenerator;
+    else if (op == "pipeline")
+        run = canvascli::runCanvasPipeline;
+    std::vector<std::string> toolArgs = {"canvas_batch"};
+    if (run)
+        toolArgs.insert(toolArgs.end(), argv + first + 1, argv + argc);
+    if (manifestPath.empty() || !run || std::count(toolArgs.begin(), toolArgs.end(), "-") < 2)
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " --manifest <path> [--checkpoint <path>] [--jobs N] [--io N] <extend|crop|matte|pipeline> <tool args, \"-\" for input and output>"
+                  << std::endl;
+        return 1;
+    }
+    if (checkpointPath.empty())
+        checkpointPath = manifestPath + ".done";
+
+    std::ifstream manifest(manifestPath);
+    if (!manifest)
+    {
+        std::cerr << "Error: Could not read manifest " << manifestPath << std::endl;
+        return 1;
+    }
+    std::unordered_set<std::string> completed;
+    {
+        std::ifstream done(checkpointPath);
+        std::string dest;
+        while (std::getline(done, dest))
+            if (!dest.empty())
+                completed.insert(dest);
+    }
+
+    std::vector<Item> items;
+    size_t skipped = 0;
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        std::istringstream fields(line);
+        Item item;
+        if (!(fields >> item.source) || item.source[0] == '#')
+            continue;
+        if (!(fields >> item.dest))
+        {
+            std::cerr << "Error: Manifest line without output path: " << line << std::endl;
+            return 1;
+        }
+        std::string extra;
+        while (fields >> extra)
+            item.extraArgs.push_back(extra);
+        if (completed.count(item.dest))
+            ++skipped;
+        else
+            items.push_back(std::move(item));
+    }
+
+    std::ofstream checkpoint(checkpointPath, std::ios::app);
+    if (!checkpoint)
+    {
+        std::cerr << "Error: Could not open checkpoint " << checkpointPath << std::endl;
+        return 1;
+    }
+    if (skipped)
+        std::cout << "Resuming: " << skipped << " already done (" << checkpointPath << ")" << std::endl;
+
+    if (jobs == 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    // As in extend_canvas --batch: one image per thread fills the cores, and
+    // nested OpenCV threading would only oversubscribe them.
+    if (jobs > 1)
+    {
+        setNumThreads(1);
+        setResampleThreads(1);
+    }
+    (new PoolMatAllocator(static_cast<size_t>(256) << 20))->install();
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    // Enough fetched sources to keep every render thread busy while the
+    // next downloads are in flight, and enough results to keep every upload
+    // thread busy; memory stays bounded by the two queue depths.
+    BoundedQueue<Fetched> fetched(jobs * 2);
+    BoundedQueue<Rendered> rendered(ioThreads * 2);
+    GcsAuth auth;
+    std::mutex logMutex;
+    std::atomic<size_t> nextItem(0), done(0), failed(0);
+    auto report = [&](size_t index, bool ok, const std::string &msg)
+    {
+        std::lock_guard<std::mutex> lock(logMutex);
+        size_t n = ++done;
+        const Item &item = items[index];
+        if (ok)
+        {
+            checkpoint << item.dest << '\n';
+            checkpoint.flush();
+            std::cout << "[" << n << "/" << items.size() << "] " << item.source << " -> " << item.dest << std::endl;
+        }
+        else
+        {
+            ++failed;
+            std::cerr << "[" << n << "/" << items.size() << "] " << item.source << ": " << msg << std::endl;
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> downloaders, renderers, uploaders;
+    for (unsigned t = 0; t < ioThreads; ++t)
+        downloaders.emplace_back([&]()
+                                 {
+            CURL *curl = curl_easy_init();
+            for (size_t i; (i = nextItem++) < items.size();)
+            {
+                Fetched f;
+                f.index = i;
+                std::string msg;
+                if (fetchSource(curl, auth, items[i].source, f.bytes, msg))
+                    fetched.push(std::move(f));
+                else
+                    report(i, false, msg);
+            }
+            curl_easy_cleanup(curl); });
+    for (unsigned t = 0; t < jobs; ++t)
+        renderers.emplace_back([&]()
+                               {
+            Fetched f;
+            while (fetched.pop(f))
+            {
+                std::vector<std::string> args = toolArgs;
+                const Item &item = items[f.index];
+                args.insert(args.end(), item.extraArgs.begin(), item.extraArgs.end());
+                Rendered r;
+                r.index = f.index;
+                canvascli::JobIO io;
+                io.input = &f.bytes;
+                io.output = &r.bytes;
+                std::ostringstream out, err;
+                int rc;
+                try
+                {
+                    rc = run(args, out, err, &io);
+                }
+                catch (const std::exception &e)
+                {
+                    rc = 1;
+                    err << e.what();
+                }
+                std::vector<uchar>().swap(f.bytes); // the source is not needed past here
+                if (rc != 0 || r.bytes.empty())
+                {
+                    report(f.index, false, firstLine(err.str()));
+                    continue;
+                }
+                r.mime = outputType(out.str());
+                rendered.push(std::move(r));
+            } });
+    for (unsigned t = 0; t < ioThreads; ++t)
+        uploaders.emplace_back([&]()
+                               {
+            CURL *curl = curl_easy_init();
+            Rendered r;
+            while (rendered.pop(r))
+            {
+                std::string msg;
+                bool ok = writeResult(curl, auth, items[r.index].dest, r, msg);
+                report(r.index, ok, msg);
+            }
+            curl_easy_cleanup(curl); });
+
+    for (std::thread &t : downloaders)
+        t.join();
+    fetched.close();
+    for (std::thread &t : renderers)
+        t.join();
+    rendered.close();
+    for (std::thread &t : uploaders)
+        t.join();
+    curl_global_cleanup();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Batch complete: " << (done - failed) << " ok, " << failed << " failed, " << skipped
+              << " skipped in " << seconds << " s" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
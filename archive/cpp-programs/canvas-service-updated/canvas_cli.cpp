@@ -0,0 +1,1638 @@
+// canvas_cli.cpp
+// Argument parsing and file I/O for extend_canvas, image_cropper,
+// matte_generator and canvas_pipeline (see canvas_cli.hpp).
+#include "canvas_cli.hpp"
+#include "canvas_ops.hpp"
+#include "image_probe.hpp"
+#include "jpeg_io.hpp"
+#include "mat_pool.hpp"
+#include "metrics.hpp"
+#include "pipeline.hpp"
+#include "thread_pool.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+
+using namespace cv;
+using namespace canvasops;
+
+namespace canvascli
+{
+
+static const char *kInMemory = "-";
+
+static Mat loadImage(const std::string &path, const JobIO *io)
+{
+    if (path == kInMemory)
+    {
+        if (io && io->decoded && !io->decoded->empty())
+            return *io->decoded;
+        if (!io || !io->input || io->input->empty())
+            return Mat();
+        Mat img = imdecode(*io->input, IMREAD_COLOR);
+        if (io->keepDecoded)
+            *io->keepDecoded = img;
+        return img;
+    }
+    return imread(path);
+}
+
+// Output encoding, shared by the tools:
+//   --format jpeg|png|webp|avif  (default: by extension; "-" is JPEG)
+//   --output-quality 1-100       (JPEG default 95; WebP default lossless)
+//   --progressive --optimize     (JPEG: multi-scan, optimal Huffman tables)
+//   --fast-encode                (JPEG: fast integer DCT, no Huffman pass)
+//   --speed 0-9                  (AVIF encoder speed; higher is faster)
+// OpenCV 4.9 added AVIF; on older builds --format avif is refused.
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 9)
+#define CANVAS_HAVE_AVIF 1
+#endif
+
+struct EncodeOptions
+{
+    std::string format; // empty: by extension
+    int quality = -1;   // -1: the format's default
+    int speed = -1;
+    bool progressive = false, optimize = false, fastEncode = false;
+    std::string badValue; // the first option whose value is not a number
+};
+
+struct SavedImage
+{
+    const char *mime = ""; // empty when imwrite chose the format
+    size_t bytes = 0;
+};
+
+static std::string canonicalFormat(std::string name)
+{
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c)
+                   { return static_cast<char>(std::tolower(c)); });
+    if (name == "jpg" || name == "jpe")
+        return "jpeg";
+    return name;
+}
+
+// Whole-string integer; false instead of throwing, as the cache keys parse
+// these outside any job's try block.
+static bool parseIntValue(const std::string &text, int &value)
+{
+    try
+    {
+        size_t used = 0;
+        value = std::stoi(text, &used);
+        return used == text.size();
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+// Consumes args[i] (and its value) if it is an encode option. A value that
+// is not a number is kept in enc.badValue for encodeOptionsError.
+static bool parseEncodeArg(const std::vector<std::string> &args, size_t &i, EncodeOptions &enc)
+{
+    const std::string &arg = args[i];
+    bool hasValue = i + 1 < args.size();
+    if (arg == "--progressive")
+        enc.progressive = true;
+    else if (arg == "--optimize")
+        enc.optimize = true;
+    else if (arg == "--fast-encode")
+        enc.fastEncode = true;
+    else if (arg == "--format" && hasValue)
+        enc.format = canonicalFormat(args[++i]);
+    else if ((arg == "--output-quality" || arg == "--speed") && hasValue)
+    {
+        if (!parseIntValue(args[++i], arg == "--speed" ? enc.speed : enc.quality) && enc.badValue.empty())
+            enc.badValue = arg;
+    }
+    else
+        return false;
+    return true;
+}
+
+// Empty when the options are usable.
+static std::string encodeOptionsError(const EncodeOptions &enc)
+{
+    if (!enc.badValue.empty())
+        return "Error: " + enc.badValue + " needs a number.";
+    if (!enc.format.empty() && enc.format != "jpeg" && enc.format != "png" && enc.format != "webp" &&
+        enc.format != "avif")
+        return "Error: --format must be jpeg, png, webp or avif.";
+#ifndef CANVAS_HAVE_AVIF
+    if (enc.format == "avif")
+        return "Error: AVIF output needs OpenCV 4.9 or newer.";
+#endif
+    if (enc.quality != -1 && (enc.quality < 1 || enc.quality > 100))
+        return "Error: --output-quality must be between 1 and 100.";
+    if (enc.speed != -1 && (enc.speed < 0 || enc.speed > 9))
+        return "Error: --speed must be between 0 and 9.";
+    return "";
+}
+
+// The format written to path: --format, else the extension. Empty for
+// extensions we have no options for, which imwrite handles as before.
+static std::string outputFormat(const std::string &path, const EncodeOptions &enc)
+{
+    if (!enc.format.empty())
+        return enc.format;
+    if (path == kInMemory)
+        return "jpeg";
+    size_t dot = path.find_last_of('.');
+    std::string ext = dot == std::string::npos ? "" : canonicalFormat(path.substr(dot + 1));
+    return ext == "jpeg" || ext == "png" || ext == "webp" || ext == "avif" ? ext : "";
+}
+
+static const char *mimeType(const std::string &format)
+{
+    return format == "jpeg"   ? "image/jpeg"
+           : format == "png"  ? "image/png"
+           : format == "webp" ? "image/webp"
+                              : "image/avif";
+}
+
+// sink only reaches the JPEG encoder; the others hand back whole files.
+static bool encodeImage(const Mat &img, const std::string &format, const EncodeOptions &enc,
+                        std::vector<uchar> &buf, const ChunkSink &sink = nullptr)
+{
+    std::vector<int> params;
+    if (format == "jpeg")
+    {
+        JpegEncodeParams jpeg;
+        if (enc.quality > 0)
+            jpeg.quality = enc.quality;
+        jpeg.progressive = enc.progressive;
+        jpeg.optimize = enc.optimize && !enc.fastEncode;
+        jpeg.fastDct = enc.fastEncode;
+        std::string err;
+        if (img.type() == CV_8UC3)
+            return encodeJpeg(img, jpeg, buf, err, sink);
+        params = {IMWRITE_JPEG_QUALITY, jpeg.quality, IMWRITE_JPEG_PROGRESSIVE, jpeg.progressive,
+                  IMWRITE_JPEG_OPTIMIZE, jpeg.optimize};
+        return imencode(".jpg", img, buf, params);
+    }
+    if (format == "png")
+    {
+        // OpenCV's default is already its fastest level; --optimize trades
+        // time for the smallest file.
+        if (enc.optimize)
+            params = {IMWRITE_PNG_COMPRESSION, 9, IMWRITE_PNG_STRATEGY, IMWRITE_PNG_STRATEGY_DEFAULT};
+        return imencode(".png", img, buf, params);
+    }
+    if (format == "webp")
+    {
+        if (enc.quality > 0)
+            params = {IMWRITE_WEBP_QUALITY, enc.quality};
+        return imencode(".webp", img, buf, params);
+    }
+#ifdef CANVAS_HAVE_AVIF
+    if (enc.quality > 0)
+        params.insert(params.end(), {IMWRITE_AVIF_QUALITY, enc.quality});
+    if (enc.speed >= 0)
+        params.insert(params.end(), {IMWRITE_AVIF_SPEED, enc.speed});
+    return imencode(".avif", img, buf, params);
+#else
+    return false;
+#endif
+}
+
+static bool writeFile(const std::string &path, const std::vector<uchar> &buf)
+{
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(buf.data()), static_cast<std::streamsize>(buf.size()));
+    return static_cast<bool>(file);
+}
+
+// Encodes straight into JobIO::output for "-"; files are written from the
+// encoded buffer so --format applies whatever their extension.
+static bool saveImage(const std::string &path, const Mat &img, JobIO *io, const EncodeOptions &enc,
+                      SavedImage *saved = nullptr)
+{
+    std::string format = outputFormat(path, enc);
+    if (format.empty())
+        return imwrite(path, img);
+    if (path == kInMemory && (!io || !io->output))
+        return false;
+
+    std::vector<uchar> local;
+    std::vector<uchar> &buf = path == kInMemory ? *io->output : local;
+    // Pieces go to onOutputChunk as the encoder makes them; whatever it
+    // did not stream (all of it, for formats other than JPEG) follows
+    size_t streamed = 0;
+    ChunkSink sink;
+    if (path == kInMemory && io->onOutputChunk)
+    {
+        sink = [&](const uchar *data, size_t len)
+        {
+            io->onOutputChunk(mimeType(format), data, len);
+            streamed += len;
+        };
+    }
+    if (!encodeImage(img, format, enc, buf, sink))
+        return false;
+    if (sink && streamed < buf.size())
+        io->onOutputChunk(mimeType(format), buf.data() + streamed, buf.size() - streamed);
+    if (saved)
+    {
+        saved->mime = mimeType(format);
+        saved->bytes = buf.size();
+    }
+    return path == kInMemory || writeFile(path, buf);
+}
+
+// "Output type:" tells canvas_worker's callers what the "-" bytes are.
+static void reportOutput(std::ostream &out, const std::string &path, const SavedImage &saved, Metrics *metrics)
+{
+    if (!*saved.mime)
+        return;
+    if (path == kInMemory)
+        out << "Output type: " << saved.mime << std::endl;
+    if (metrics)
+    {
+        metrics->set("output_type", std::string("\"") + saved.mime + "\"");
+        metrics->set("output_bytes", static_cast<long>(saved.bytes));
+    }
+}
+
+// Canonical encode options for the cache keys.
+static std::string encodeKey(const EncodeOptions &enc)
+{
+    std::string format = outputFormat(kInMemory, enc);
+    int quality = enc.quality == -1 && format == "jpeg" ? JpegEncodeParams().quality : enc.quality;
+    std::ostringstream key;
+    key << " format=" << format << " q=" << quality << " speed=" << enc.speed
+        << (enc.progressive ? " progressive" : "") << (enc.optimize && !enc.fastEncode ? " optimize" : "")
+        << (enc.fastEncode ? " fast" : "");
+    return key.str();
+}
+
+// Decode at 1/factor of the source size (factor 1, 2, 4 or 8). JPEG does
+// this cheaply through DCT scaling; other formats decode in full and are
+// downscaled by OpenCV.
+static Mat loadImageReduced(const std::string &path, const JobIO *io, int factor)
+{
+    int flags = factor == 8   ? IMREAD_REDUCED_COLOR_8
+                : factor == 4 ? IMREAD_REDUCED_COLOR_4
+                : factor == 2 ? IMREAD_REDUCED_COLOR_2
+                              : IMREAD_COLOR;
+    if (path == kInMemory)
+    {
+        if (io && io->decoded && !io->decoded->empty())
+        {
+            // Already decoded in full: shrink rather than decode again
+            Mat reduced;
+            Size size((io->decoded->cols + factor - 1) / factor, (io->decoded->rows + factor - 1) / factor);
+            resize(*io->decoded, reduced, size, 0, 0, INTER_AREA);
+            return reduced;
+        }
+        if (!io || !io->input || io->input->empty())
+            return Mat();
+        return imdecode(*io->input, flags);
+    }
+    return imread(path, flags);
+}
+
+// --reduced-decode: when the requested output is at most 1/2, 1/4 or 1/8 of
+// the desired canvas, run the whole extend pipeline on a reduced decode
+// instead of decoding every source pixel only to throw most of them away in
+// the final fit. Returns the decoded image and rescales params to match.
+static Mat loadForExtend(const std::string &path, const JobIO *io, ExtendParams &params, int &factor)
+{
+    factor = 1;
+    if (params.requestedW <= 0 || params.requestedH <= 0)
+        return loadImage(path, io);
+
+    // The source width from the kept decode or the container headers, so
+    // the image is decoded once, at the factor chosen here
+    int sourceW = 0;
+    ImageInfo info;
+    if (path == kInMemory && io && io->decoded && !io->decoded->empty())
+        sourceW = io->decoded->cols;
+    else if (path == kInMemory ? io && io->input && probeImage(io->input->data(), io->input->size(), info)
+                               : probeImageFile(path, info))
+        sourceW = info.width;
+    if (sourceW <= 0)
+        return loadImage(path, io); // unknown header: a plain full decode
+
+    double scale = std::min(static_cast<double>(params.requestedW) / sourceW,
+                            static_cast<double>(params.requestedH) / params.desiredH);
+    for (int k : {8, 4, 2})
+    {
+        if (k * scale <= 1.0)
+        {
+            factor = k;
+            break;
+        }
+    }
+    if (factor == 1)
+        return loadImage(path, io);
+
+    params.desiredH = std::max(1, (params.desiredH + factor / 2) / factor);
+    params.sampleStripeH = std::max(2, params.sampleStripeH / factor);
+    params.sampleStripeW = std::max(2, params.sampleStripeW / factor);
+    return loadImageReduced(path, io, factor);
+}
+
+// Row stream over the input for --stream. JPEGs are decoded a band at a
+// time; other formats (and JPEGs libjpeg cannot give us as upright BGR, e.g.
+// CMYK or EXIF-rotated) are decoded in full once into `decoded`, which
+// later calls reuse.
+static std::unique_ptr<RowSource> openRowStream(const std::string &path, const JobIO *io, Mat &decoded,
+                                                std::string &err)
+{
+    if (decoded.empty() && path == kInMemory && io && io->decoded)
+        decoded = *io->decoded;
+    if (decoded.empty())
+    {
+        std::unique_ptr<RowSource> src;
+        // libjpeg hands out rows as stored, so JPEGs that need an EXIF
+        // rotation go through the full decode, which applies it.
+        ImageInfo info;
+        if (path == kInMemory)
+        {
+            if (io && io->input && probeImage(io->input->data(), io->input->size(), info) &&
+                std::string(info.format) == "jpeg" && info.orientation == 1)
+                src = JpegRowSource::openMemory(io->input->data(), io->input->size(), err);
+        }
+        else if (probeImageFile(path, info) && std::string(info.format) == "jpeg" && info.orientation == 1)
+            src = JpegRowSource::openFile(path, err);
+        if (src)
+            return src;
+
+        decoded = loadImage(path, io);
+        if (decoded.empty())
+        {
+            err = "Error: Could not read input image from " + path;
+            return nullptr;
+        }
+        err.clear();
+    }
+    return std::unique_ptr<RowSource>(new MatRowSource(decoded));
+}
+
+// --metrics json for one job. Mat bytes are only counted by our allocator,
+// so a standalone tool installs a non-caching one the first time it is
+// asked. The job's Mats are counted on the thread that runs it, apart from
+// any other job's, so startMetrics and writeMetrics must share a thread.
+struct JobMetrics : Metrics
+{
+    explicit JobMetrics(const char *tool) : Metrics(tool) {}
+    MatByteScope matBytes;
+};
+
+static std::unique_ptr<JobMetrics> startMetrics(bool enabled, const char *tool)
+{
+    if (!enabled)
+        return nullptr;
+    if (!dynamic_cast<PoolMatAllocator *>(Mat::getDefaultAllocator()))
+        (new PoolMatAllocator(0))->install();
+    return std::unique_ptr<JobMetrics>(new JobMetrics(tool));
+}
+
+static void writeMetrics(std::ostream &out, Metrics *metrics)
+{
+    if (!metrics)
+        return;
+    if (const MatByteCounter *job = MatByteCounter::current())
+        metrics->set("peak_mat_bytes", static_cast<long>(job->peakBytes()));
+    out << "METRICS " << metrics->json() << std::endl;
+}
+
+std::vector<std::string> argsFromMain(int argc, char **argv)
+{
+    return std::vector<std::string>(argv, argv + argc);
+}
+
+int runStandalone(ToolRunner run, int argc, char **argv)
+{
+    std::vector<std::string> args = argsFromMain(argc, argv);
+    if (std::find(args.begin() + 1, args.end(), kInMemory) == args.end())
+        return run(args, std::cout, std::cerr, nullptr);
+
+    std::vector<unsigned char> input((std::istreambuf_iterator<char>(std::cin)),
+                                     std::istreambuf_iterator<char>());
+    std::vector<unsigned char> output;
+    JobIO io;
+    io.input = &input;
+    io.output = &output;
+
+    int rc = run(args, std::cerr, std::cerr, &io);
+    if (rc == 0 && !output.empty())
+        fwrite(output.data(), 1, output.size(), stdout);
+    return rc;
+}
+
+//---------------------------------------------------------------------
+// Shared extend parameters start at pos[first]: <desired_h> [pad%] [white_thresh] [requested_w] [requested_h]
+static ExtendParams parseExtendParams(const std::vector<std::string> &pos, size_t first)
+{
+    const size_t n = pos.size();
+    ExtendParams params;
+    params.desiredH = std::stoi(pos[first]);
+    params.padPct = (n > first + 1 ? std::stod(pos[first + 1]) : 0.05);
+    params.whiteThr = (n > first + 2 ? std::stoi(pos[first + 2]) : -1);
+    params.requestedW = (n > first + 3 ? std::stoi(pos[first + 3]) : -1);
+    params.requestedH = (n > first + 4 ? std::stoi(pos[first + 4]) : -1);
+    return params;
+}
+
+// Process every "<in> <out>" line of the manifest with the same parameters.
+// Each pool thread runs decode → extend → encode for one image at a time, so
+// the stages of different images overlap across cores.
+static int runExtendBatch(const std::string &manifestPath, const ExtendParams &params, const EncodeOptions &enc,
+                          unsigned jobs, std::ostream &out, std::ostream &err)
+{
+    std::ifstream manifest(manifestPath);
+    if (!manifest)
+    {
+        err << "Error: Could not read manifest " << manifestPath << std::endl;
+        return 1;
+    }
+
+    std::vector<std::pair<std::string, std::string>> items;
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        std::istringstream fields(line);
+        std::string inP, outP;
+        if (!(fields >> inP) || inP[0] == '#')
+            continue;
+        if (!(fields >> outP))
+        {
+            err << "Error: Manifest line without output path: " << line << std::endl;
+            return 1;
+        }
+        items.emplace_back(inP, outP);
+    }
+
+    // Every job allocates the same strips and canvases; recycle them rather
+    // than malloc and fault them in again. Left installed for the process
+    // (unless a host such as canvas_worker already set a pool up).
+    if (Mat::getDefaultAllocator() == Mat::getStdAllocator())
+        (new PoolMatAllocator(static_cast<size_t>(256) << 20))->install();
+
+    ThreadPool pool(jobs);
+    // One image per thread already fills the cores; nested OpenCV threading
+    // would only oversubscribe them.
+    int prevThreads = getNumThreads();
+    unsigned prevResampleThreads = resampleThreadCount();
+    if (pool.size() > 1)
+    {
+        setNumThreads(1);
+        setResampleThreads(1);
+    }
+
+    std::mutex logMutex;
+    std::atomic<int> done(0), failed(0);
+    auto processItem = [&](const std::pair<std::string, std::string> &item)
+    {
+        std::ostringstream jobLog;
+        std::string msg;
+        bool ok = false;
+        try
+        {
+            Mat img = imread(item.first);
+            ExtendResult result;
+            if (img.empty())
+                msg = "Cannot open input";
+            else if (extendCanvas(img, params, result, jobLog, msg))
+            {
+                ok = saveImage(item.second, result.image, nullptr, enc);
+                if (!ok)
+                    msg = "Could not write output";
+            }
+        }
+        catch (const std::exception &e)
+        {
+            msg = e.what();
+        }
+
+        std::lock_guard<std::mutex> lock(logMutex);
+        int n = ++done;
+        if (ok)
+        {
+            out << "[" << n << "/" << items.size() << "] " << item.first << " -> " << item.second << std::endl;
+        }
+        else
+        {
+            ++failed;
+            err << "[" << n << "/" << items.size() << "] " << item.first << ": " << msg << std::endl;
+        }
+    };
+
+    std::vector<std::future<void>> pending;
+    for (const auto &item : items)
+        pending.push_back(pool.submit([&processItem, item]()
+                                      { processItem(item); }));
+    for (std::future<void> &f : pending)
+        f.wait();
+    setNumThreads(prevThreads);
+    setResampleThreads(prevResampleThreads);
+
+    out << "Batch complete: " << (done - failed) << " ok, " << failed << " failed" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
+
+// extend_canvas takes a few --options; everything else is positional.
+struct ExtendOptions
+{
+    std::string manifestPath;
+    unsigned jobs = 0;
+    bool badJobs = false; // --jobs not a whole number >= 0
+    bool reducedDecode = false;
+    bool stream = false;
+    ResizeQuality quality = ResizeQuality::Best;
+    bool badQuality = false; // --quality with an unknown name
+    SampleRegion sample = SampleRegion::Center;
+    bool badSample = false;
+    ExtendMode mode = ExtendMode::Stretch;
+    bool badMode = false;
+    bool metrics = false, badMetrics = false;
+    EncodeOptions enc;
+    std::vector<std::string> pos;
+};
+
+static ExtendOptions splitExtendArgs(const std::vector<std::string> &args)
+{
+    ExtendOptions opt;
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        bool hasValue = i + 1 < args.size();
+        if (i > 0 && parseEncodeArg(args, i, opt.enc))
+            continue;
+        if (i > 0 && args[i] == "--reduced-decode")
+            opt.reducedDecode = true;
+        else if (i > 0 && args[i] == "--stream")
+            opt.stream = true;
+        else if (i > 0 && args[i] == "--batch" && hasValue)
+            opt.manifestPath = args[++i];
+        else if (i > 0 && args[i] == "--jobs" && hasValue)
+        {
+            int jobs = 0;
+            opt.badJobs = !parseIntValue(args[++i], jobs) || jobs < 0;
+            opt.jobs = opt.badJobs ? 0 : static_cast<unsigned>(jobs);
+        }
+        else if (i > 0 && args[i] == "--quality" && hasValue)
+            opt.badQuality = !parseResizeQuality(args[++i], opt.quality);
+        else if (i > 0 && args[i] == "--sample" && hasValue)
+            opt.badSample = !parseSampleRegion(args[++i], opt.sample);
+        else if (i > 0 && args[i] == "--extend-mode" && hasValue)
+            opt.badMode = !parseExtendMode(args[++i], opt.mode);
+        else if (i > 0 && args[i] == "--metrics" && hasValue)
+            opt.badMetrics = !(opt.metrics = args[++i] == "json");
+        else
+            opt.pos.push_back(args[i]);
+    }
+    return opt;
+}
+
+int runExtendCanvas(const std::vector<std::string> &args, std::ostream &out, std::ostream &err,
+                    JobIO *io)
+{
+    ExtendOptions opt = splitExtendArgs(args);
+    const std::string &manifestPath = opt.manifestPath;
+    const std::vector<std::string> &pos = opt.pos;
+    const bool stream = opt.stream;
+
+    if (opt.badJobs)
+    {
+        err << "Error: --jobs must be a whole number, 0 or more (0 = one per core)." << std::endl;
+        return 1;
+    }
+    if (opt.badQuality)
+    {
+        err << "Error: --quality must be fast, balanced or best." << std::endl;
+        return 1;
+    }
+    if (opt.badSample)
+    {
+        err << "Error: --sample must be center, corners or all." << std::endl;
+        return 1;
+    }
+    if (opt.badMode)
+    {
+        err << "Error: --extend-mode must be stretch or model." << std::endl;
+        return 1;
+    }
+    if (opt.mode == ExtendMode::Model && stream)
+    {
+        err << "Error: --extend-mode model needs the background strips in memory; drop --stream." << std::endl;
+        return 1;
+    }
+    if (opt.badMetrics)
+    {
+        err << "Error: --metrics only supports json." << std::endl;
+        return 1;
+    }
+    std::string encodeError = encodeOptionsError(opt.enc);
+    if (!encodeError.empty())
+    {
+        err << encodeError << std::endl;
+        return 1;
+    }
+
+    if (!manifestPath.empty())
+    {
+        if (pos.size() < 2)
+        {
+            err << "Usage: " << pos[0] << " --batch <manifest> [--jobs N] [--quality fast|balanced|best] [--sample center|corners|all] [--extend-mode stretch|model] [encode options] <desired_h> [pad%] [white_thresh|-1] [requested_w] [requested_h]" << std::endl;
+            return 1;
+        }
+        ExtendParams params = parseExtendParams(pos, 1);
+        params.quality = opt.quality;
+        params.sample = opt.sample;
+        params.mode = opt.mode;
+        return runExtendBatch(manifestPath, params, opt.enc, opt.jobs, out, err);
+    }
+
+    if (pos.size() < 4)
+    {
+        err << "Usage: " << pos[0] << " [--reduced-decode | --stream] [--quality fast|balanced|best] [--sample center|corners|all] [--extend-mode stretch|model] [--metrics json] [encode options] <in> <out> <desired_h> [pad%] [white_thresh|-1] [requested_w] [requested_h]" << std::endl;
+        err << "       " << pos[0] << " --batch <manifest> [--jobs N] [--quality fast|balanced|best] [--sample center|corners|all] [--extend-mode stretch|model] [encode options] <desired_h> [pad%] [white_thresh|-1] [requested_w] [requested_h]" << std::endl;
+        err << "Encode options: --format jpeg|png|webp|avif, --output-quality 1-100, --progressive, --optimize, --fast-encode, --speed 0-9" << std::endl;
+        return 1;
+    }
+
+    std::string inP = pos[1];
+    std::string outP = pos[2];
+    ExtendParams params = parseExtendParams(pos, 3);
+    params.quality = opt.quality;
+    params.sample = opt.sample;
+    params.mode = opt.mode;
+    std::unique_ptr<JobMetrics> metrics = startMetrics(opt.metrics, "extend");
+
+    ExtendResult result;
+    std::string msg;
+    if (stream)
+    {
+        // --stream replaces --reduced-decode: the input is never held whole
+        Mat decoded;
+        RowSourceFactory open = [&](std::string &e)
+        {
+            std::unique_ptr<RowSource> src = openRowStream(inP, io, decoded, e);
+            if (src && metrics)
+                metrics->setSize("input", src->width(), src->height());
+            return src;
+        };
+
+        if (!extendCanvasStream(open, params, result, out, msg, metrics.get()))
+        {
+            err << msg << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        int factor = 1;
+        Mat img;
+        {
+            StageTimer timer(metrics.get(), "decode");
+            img = opt.reducedDecode ? loadForExtend(inP, io, params, factor) : loadImage(inP, io);
+        }
+        if (img.empty())
+        {
+            err << "Cannot open input" << std::endl;
+            return 1;
+        }
+        if (factor > 1)
+            out << "Reduced decode: 1/" << factor << " (" << img.cols << "x" << img.rows << ")" << std::endl;
+        if (metrics)
+        {
+            metrics->setSize("input", img.cols, img.rows);
+            metrics->set("decode_factor", factor);
+        }
+
+        if (!extendCanvas(img, params, result, out, msg, metrics.get()))
+        {
+            err << msg << std::endl;
+            return 1;
+        }
+    }
+
+    SavedImage saved;
+    {
+        StageTimer timer(metrics.get(), "encode");
+        if (!saveImage(outP, result.image, io, opt.enc, &saved))
+        {
+            err << "Error: Could not write output image to " << outP << std::endl;
+            return 1;
+        }
+    }
+    if (result.extended)
+        out << "Saved (thr=" << result.whiteThr << ") to " << outP << std::endl;
+    reportOutput(out, outP, saved, metrics.get());
+    if (metrics)
+    {
+        metrics->setSize("output", result.image.cols, result.image.rows);
+        metrics->set("threshold", result.whiteThr);
+        metrics->set("extended", result.extended ? "true" : "false");
+        metrics->set("extend_mode", std::string("\"") + extendModeName(params.mode) + "\"");
+        writeMetrics(out, metrics.get());
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+struct CropOptions
+{
+    std::string inputPath, outputPath;
+    CropParams params;
+    int draft = 0; // --draft: long side of a quick low-res render
+    bool stream = false;
+    bool badQuality = false;
+    bool metrics = false, badMetrics = false;
+    EncodeOptions enc;
+};
+
+static CropOptions parseCropArgs(const std::vector<std::string> &args)
+{
+    CropOptions opt;
+    CropParams &params = opt.params;
+
+    // Parse command line arguments
+    for (size_t i = 1; i < args.size(); ++i)
+    {
+        const std::string &arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (parseEncodeArg(args, i, opt.enc))
+            continue;
+        if (arg == "--stream")
+            opt.stream = true;
+        else if (arg == "--input" && hasValue)
+            opt.inputPath = args[++i];
+        else if (arg == "--output" && hasValue)
+            opt.outputPath = args[++i];
+        else if (arg == "--crop-x" && hasValue)
+            params.cropX = std::stoi(args[++i]);
+        else if (arg == "--crop-y" && hasValue)
+            params.cropY = std::stoi(args[++i]);
+        else if (arg == "--crop-width" && hasValue)
+            params.cropWidth = std::stoi(args[++i]);
+        else if (arg == "--crop-height" && hasValue)
+            params.cropHeight = std::stoi(args[++i]);
+        else if (arg == "--output-width" && hasValue)
+            params.outputWidth = std::stoi(args[++i]);
+        else if (arg == "--output-height" && hasValue)
+            params.outputHeight = std::stoi(args[++i]);
+        else if (arg == "--scale" && hasValue)
+            params.scale = std::stod(args[++i]);
+        else if (arg == "--preview-width" && hasValue)
+            params.previewWidth = std::stoi(args[++i]);
+        else if (arg == "--preview-height" && hasValue)
+            params.previewHeight = std::stoi(args[++i]);
+        else if (arg == "--quality" && hasValue)
+            opt.badQuality = !parseResizeQuality(args[++i], params.quality);
+        else if (arg == "--draft" && hasValue)
+            opt.draft = std::stoi(args[++i]);
+        else if (arg == "--metrics" && hasValue)
+            opt.badMetrics = !(opt.metrics = args[++i] == "json");
+    }
+    return opt;
+}
+
+// --draft N renders the same composition with its long side at most N,
+// for an interactive first look: output size and scale shrink together,
+// so the direct JPEG path decodes at 1/2-1/8 (fast IDCT), resampling is
+// fast and the encode is low quality unless --output-quality is given.
+static void applyDraft(CropOptions &opt)
+{
+    CropParams &params = opt.params;
+    double s = std::min(1.0, static_cast<double>(opt.draft) / std::max(params.outputWidth, params.outputHeight));
+    params.outputWidth = std::max(1, static_cast<int>(std::lround(params.outputWidth * s)));
+    params.outputHeight = std::max(1, static_cast<int>(std::lround(params.outputHeight * s)));
+    params.scale *= s;
+    params.quality = ResizeQuality::Fast;
+    if (opt.enc.quality == -1)
+        opt.enc.quality = 60;
+    opt.enc.fastEncode = true;
+}
+
+// Crops of upright JPEGs never decode the whole image. A pure crop (the
+// output is the crop at 1:1) with an MCU-aligned offset is cut losslessly
+// in the DCT domain and written as is. Otherwise only the crop's rows and
+// MCU columns are decoded (at 1/2-1/8 through DCT scaling when the crop is
+// shrunk at least that much) and composed into output. Anything else
+// returns None for the usual full decode.
+enum class DirectCrop
+{
+    None,
+    Lossless,
+    Region,
+    Failed
+};
+
+static DirectCrop cropJpegDirect(const CropOptions &opt, JobIO *io, CropParams &params, Size &inputSize,
+                                 Mat &output, SavedImage &saved, int &factor, std::string &err, Metrics *metrics)
+{
+    const std::string &inputPath = opt.inputPath;
+    const std::string &outputPath = opt.outputPath;
+    ImageInfo info;
+    std::vector<uchar> fileBytes;
+    const uchar *data = nullptr;
+    size_t len = 0;
+    if (inputPath == kInMemory)
+    {
+        if (!io || (io->decoded && !io->decoded->empty()) || !io->input || io->input->empty())
+            return DirectCrop::None;
+        data = io->input->data();
+        len = io->input->size();
+        if (!probeImage(data, len, info))
+            return DirectCrop::None;
+    }
+    else if (!probeImageFile(inputPath, info))
+        return DirectCrop::None;
+    if (std::string(info.format) != "jpeg" || info.orientation != 1)
+        return DirectCrop::None;
+
+    CropParams planned = params;
+    Rect crop, placed;
+    if (!cropLayout(info.width, info.height, planned, crop, placed, err))
+        return DirectCrop::Failed;
+    const bool pure = placed == Rect(0, 0, planned.outputWidth, planned.outputHeight) && placed.size() == crop.size();
+
+    if (!data)
+    {
+        std::ifstream file(inputPath, std::ios::binary);
+        fileBytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        data = fileBytes.data();
+        len = fileBytes.size();
+    }
+
+    // Re-quantising or a different format needs the pixels
+    const EncodeOptions &enc = opt.enc;
+    if (pure && outputFormat(outputPath, enc) == "jpeg" && enc.quality == -1 && !enc.fastEncode &&
+        (outputPath != kInMemory || (io && io->output)))
+    {
+        JpegEncodeParams jpeg;
+        jpeg.progressive = enc.progressive;
+        jpeg.optimize = enc.optimize;
+        std::vector<uchar> local;
+        std::vector<uchar> &buf = outputPath == kInMemory ? *io->output : local;
+        std::string msg;
+        bool cropped;
+        {
+            StageTimer timer(metrics, "crop");
+            cropped = cropJpegLossless(data, len, crop, jpeg, buf, msg);
+        }
+        if (cropped)
+        {
+            if (outputPath != kInMemory && !writeFile(outputPath, buf))
+                return DirectCrop::None;
+            if (outputPath == kInMemory && io->onOutputChunk)
+                io->onOutputChunk(mimeType("jpeg"), buf.data(), buf.size());
+            params = planned;
+            inputSize = Size(info.width, info.height);
+            saved.mime = mimeType("jpeg");
+            saved.bytes = buf.size();
+            return DirectCrop::Lossless;
+        }
+    }
+
+    // The reduced decode must still cover the placed size, so final
+    // resampling only ever shrinks it further.
+    factor = 1;
+    for (int k : {8, 4, 2})
+    {
+        if (placed.width * k <= crop.width && placed.height * k <= crop.height)
+        {
+            factor = k;
+            break;
+        }
+    }
+
+    // On failure the usual path decodes in full and reports any error itself
+    Mat region;
+    bool decoded;
+    {
+        StageTimer timer(metrics, "decode");
+        std::string msg;
+        decoded = decodeJpegRegion(data, len, crop, region, msg, factor, opt.draft > 0);
+    }
+    if (!decoded)
+        return DirectCrop::None;
+    params = planned;
+    inputSize = Size(info.width, info.height);
+    if (pure)
+        output = region;
+    else
+        composeCrop(region, params, placed, output, metrics);
+    return DirectCrop::Region;
+}
+
+int runImageCropper(const std::vector<std::string> &args, std::ostream &out, std::ostream &err,
+                    JobIO *io)
+{
+    CropOptions opt = parseCropArgs(args);
+    const std::string &inputPath = opt.inputPath;
+    const std::string &outputPath = opt.outputPath;
+    CropParams &params = opt.params;
+    const bool stream = opt.stream;
+
+    // Validate inputs
+    if (inputPath.empty() || outputPath.empty())
+    {
+        err << "Error: Input and output paths are required.\n";
+        err << "Usage: " << args[0] << " --input <path> --output <path> [options]\n";
+        err << "Options:\n";
+        err << "  --crop-x <x>           X coordinate of crop area (default: 0)\n";
+        err << "  --crop-y <y>           Y coordinate of crop area (default: 0)\n";
+        err << "  --crop-width <width>   Width of crop area (default: full width)\n";
+        err << "  --crop-height <height> Height of crop area (default: full height)\n";
+        err << "  --output-width <width> Output image width (default: 1080)\n";
+        err << "  --output-height <height> Output image height (default: 1920)\n";
+        err << "  --scale <factor>       Scale factor for the cropped image (default: 1.0)\n";
+        err << "  --preview-width <w>    Crop values are in a w x h preview of the image;\n";
+        err << "  --preview-height <h>   they are scaled to the full size before cropping\n";
+        err << "  --quality <q>          fast | balanced | best resampling (default: best)\n";
+        err << "  --draft <max_side>     Quick low-resolution render, long side at most max_side\n";
+        err << "  --stream               Decode, crop and scale in row bands (bounded memory)\n";
+        err << "  --metrics json         Print a METRICS line with stage timings and sizes\n";
+        err << "  --format <f>           jpeg | png | webp | avif (default: by output extension)\n";
+        err << "  --output-quality <q>   Encoder quality 1-100 (JPEG default 95)\n";
+        err << "  --progressive          Progressive JPEG\n";
+        err << "  --optimize             Optimal JPEG Huffman tables / smallest PNG\n";
+        err << "  --fast-encode          Fast JPEG DCT, no Huffman optimisation\n";
+        err << "  --speed <0-9>          AVIF encoder speed\n";
+        return 1;
+    }
+
+    if (params.outputWidth <= 0 || params.outputHeight <= 0)
+    {
+        err << "Error: Output dimensions must be positive.\n";
+        return 1;
+    }
+
+    if (params.scale <= 0)
+    {
+        err << "Error: Scale factor must be positive.\n";
+        return 1;
+    }
+
+    if (opt.badQuality)
+    {
+        err << "Error: --quality must be fast, balanced or best.\n";
+        return 1;
+    }
+
+    if (opt.draft < 0)
+    {
+        err << "Error: Draft size must be positive.\n";
+        return 1;
+    }
+
+    if (opt.badMetrics)
+    {
+        err << "Error: --metrics only supports json.\n";
+        return 1;
+    }
+
+    std::string encodeError = encodeOptionsError(opt.enc);
+    if (!encodeError.empty())
+    {
+        err << encodeError << "\n";
+        return 1;
+    }
+    if (opt.draft > 0)
+        applyDraft(opt);
+    std::unique_ptr<JobMetrics> metrics = startMetrics(opt.metrics, "crop");
+
+    Mat output;
+    Size inputSize;
+    SavedImage savedImage;
+    std::string msg;
+    int factor = 1;
+    DirectCrop direct = stream ? DirectCrop::None
+                               : cropJpegDirect(opt, io, params, inputSize, output, savedImage, factor, msg,
+                                                metrics.get());
+    if (direct == DirectCrop::Failed)
+    {
+        err << msg << "\n";
+        return 1;
+    }
+    if (direct != DirectCrop::None)
+    {
+        // output (for Region) is already composed
+    }
+    else if (stream)
+    {
+        Mat decoded;
+        std::unique_ptr<RowSource> src = openRowStream(inputPath, io, decoded, msg);
+        if (!src)
+        {
+            err << msg << "\n";
+            return 1;
+        }
+        inputSize = Size(src->width(), src->height());
+        if (!cropAndFitStream(*src, params, output, msg, metrics.get()))
+        {
+            err << msg << "\n";
+            return 1;
+        }
+    }
+    else
+    {
+        // Load input image
+        Mat input;
+        {
+            StageTimer timer(metrics.get(), "decode");
+            input = loadImage(inputPath, io);
+        }
+        if (input.empty())
+        {
+            err << "Error: Could not read input image from " << inputPath << "\n";
+            return 1;
+        }
+        inputSize = input.size();
+        if (!cropAndFit(input, params, output, msg, metrics.get()))
+        {
+            err << msg << "\n";
+            return 1;
+        }
+    }
+
+    // Save the result (a lossless crop is already written)
+    bool saved = true;
+    if (direct != DirectCrop::Lossless)
+    {
+        StageTimer timer(metrics.get(), "encode");
+        saved = saveImage(outputPath, output, io, opt.enc, &savedImage);
+    }
+    if (!saved)
+    {
+        err << "Error: Could not write output image to " << outputPath << "\n";
+        return 1;
+    }
+
+    out << "Image cropped successfully: " << outputPath << std::endl;
+    if (direct == DirectCrop::Lossless)
+        out << "Lossless JPEG crop (no re-encode)" << std::endl;
+    out << "Original size: " << inputSize.width << "x" << inputSize.height << std::endl;
+    out << "Crop area: " << params.cropX << "," << params.cropY << " " << params.cropWidth << "x" << params.cropHeight << std::endl;
+    out << "Scale factor: " << params.scale << std::endl;
+    out << "Output size: " << params.outputWidth << "x" << params.outputHeight << std::endl;
+    if (opt.draft > 0)
+        out << "Draft render (max " << opt.draft << "px)" << std::endl;
+    reportOutput(out, outputPath, savedImage, metrics.get());
+    if (metrics)
+    {
+        metrics->setSize("input", inputSize.width, inputSize.height);
+        metrics->setSize("output", params.outputWidth, params.outputHeight);
+        metrics->set("crop_mode", direct == DirectCrop::Lossless ? "\"lossless\""
+                                  : direct == DirectCrop::Region ? "\"region\""
+                                                                 : "\"full\"");
+        metrics->set("decode_factor", factor);
+        metrics->set("draft", opt.draft);
+        writeMetrics(out, metrics.get());
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+struct MatteTarget
+{
+    Size canvas;
+    std::string path;
+};
+
+struct MatteOptions
+{
+    std::string inputPath, outputPath;
+    MatteParams params;
+    std::vector<MatteTarget> targets; // --target WxH:path, in order given
+    bool stream = false;
+    bool metrics = false, badMetrics = false;
+    EncodeOptions enc; // applies to every target
+};
+
+static MatteOptions parseMatteArgs(const std::vector<std::string> &args)
+{
+    MatteOptions opt;
+    MatteParams &params = opt.params;
+
+    // Parse command line arguments
+    for (size_t i = 1; i < args.size(); ++i)
+    {
+        const std::string &arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (parseEncodeArg(args, i, opt.enc))
+            continue;
+        if (arg == "--stream")
+            opt.stream = true;
+        else if (arg == "--input" && hasValue)
+            opt.inputPath = args[++i];
+        else if (arg == "--output" && hasValue)
+            opt.outputPath = args[++i];
+        else if (arg == "--width" && hasValue)
+            params.canvasWidth = std::stoi(args[++i]);
+        else if (arg == "--height" && hasValue)
+            params.canvasHeight = std::stoi(args[++i]);
+        else if (arg == "--padding" && hasValue)
+            params.paddingPercent = std::stof(args[++i]);
+        else if (arg == "--color" && hasValue)
+            params.hexColor = args[++i];
+        else if (arg == "--metrics" && hasValue)
+            opt.badMetrics = !(opt.metrics = args[++i] == "json");
+        else if (arg == "--target" && hasValue)
+        {
+            // WxH:path; a bad spec becomes a 0x0 target and fails validation
+            const std::string &spec = args[++i];
+            MatteTarget target;
+            int w = 0, h = 0, consumed = 0;
+            if (sscanf(spec.c_str(), "%dx%d:%n", &w, &h, &consumed) == 2 && consumed > 0)
+            {
+                target.canvas = Size(w, h);
+                target.path = spec.substr(consumed);
+            }
+            opt.targets.push_back(target);
+        }
+    }
+    return opt;
+}
+
+// --target mode: --output (at --width/--height) and every --target come
+// from one decode, and are encoded on a thread each.
+static int writeMatteRenditions(const MatteOptions &opt, std::ostream &out, std::ostream &err, JobIO *io,
+                                Metrics *metrics)
+{
+    std::vector<MatteTarget> targets = opt.targets;
+    if (!opt.outputPath.empty())
+        targets.insert(targets.begin(), MatteTarget{Size(opt.params.canvasWidth, opt.params.canvasHeight), opt.outputPath});
+
+    std::vector<Size> canvases;
+    int inMemory = 0;
+    for (const MatteTarget &target : targets)
+    {
+        if (target.canvas.width <= 0 || target.canvas.height <= 0 || target.path.empty())
+        {
+            err << "Error: Targets must be given as WxH:path with positive dimensions.\n";
+            return 1;
+        }
+        inMemory += target.path == kInMemory;
+        canvases.push_back(target.canvas);
+    }
+    if (inMemory > 1)
+    {
+        err << "Error: Only one output can be \"-\".\n";
+        return 1;
+    }
+
+    std::vector<Mat> mattes;
+    std::string msg;
+    if (opt.stream)
+    {
+        Mat decoded;
+        std::unique_ptr<RowSource> src = openRowStream(opt.inputPath, io, decoded, msg);
+        StageTimer timer(metrics, "resize"); // includes the decode
+        if (!src || !createMatteRenditionsStream(*src, opt.params, canvases, mattes, msg))
+        {
+            err << msg << "\n";
+            return 1;
+        }
+    }
+    else
+    {
+        Mat input;
+        {
+            StageTimer timer(metrics, "decode");
+            input = loadImage(opt.inputPath, io);
+        }
+        if (input.empty())
+        {
+            err << "Error: Could not read input image from " << opt.inputPath << "\n";
+            return 1;
+        }
+        StageTimer timer(metrics, "resize");
+        if (!createMatteRenditions(input, opt.params, canvases, mattes, msg))
+        {
+            err << msg << "\n";
+            return 1;
+        }
+    }
+
+    std::vector<char> saved(targets.size());
+    std::vector<SavedImage> encoded(targets.size());
+    {
+        StageTimer timer(metrics, "encode"); // all targets, in parallel
+        ThreadPool pool(static_cast<unsigned>(std::min<size_t>(targets.size(), std::max(1u, std::thread::hardware_concurrency()))));
+        MatByteCounter *job = MatByteCounter::current();
+        std::vector<std::future<bool>> pending;
+        for (size_t i = 0; i < targets.size(); ++i)
+            pending.push_back(pool.submit([&, i, job]()
+                                          {
+                                              MatByteScope scope(job);
+                                              return saveImage(targets[i].path, mattes[i], io, opt.enc, &encoded[i]);
+                                          }));
+        for (size_t i = 0; i < targets.size(); ++i)
+            saved[i] = pending[i].get();
+    }
+
+    int failed = 0;
+    size_t totalBytes = 0;
+    for (size_t i = 0; i < targets.size(); ++i)
+    {
+        if (saved[i])
+        {
+            out << "Matte created successfully: " << targets[i].path << " (" << targets[i].canvas.width << "x"
+                << targets[i].canvas.height << ")" << std::endl;
+            if (targets[i].path == kInMemory)
+                out << "Output type: " << encoded[i].mime << std::endl;
+            totalBytes += encoded[i].bytes;
+        }
+        else
+        {
+            err << "Error: Could not write output image to " << targets[i].path << "\n";
+            ++failed;
+        }
+    }
+    if (metrics && !failed)
+    {
+        metrics->set("outputs", static_cast<long>(targets.size()));
+        metrics->set("output_bytes", static_cast<long>(totalBytes));
+        writeMetrics(out, metrics);
+    }
+    return failed ? 1 : 0;
+}
+
+int runMatteGenerator(const std::vector<std::string> &args, std::ostream &out, std::ostream &err,
+                      JobIO *io)
+{
+    MatteOptions opt = parseMatteArgs(args);
+    const std::string &inputPath = opt.inputPath;
+    const std::string &outputPath = opt.outputPath;
+    const MatteParams &params = opt.params;
+    const bool stream = opt.stream;
+
+    // Validate inputs
+    if (inputPath.empty() || (outputPath.empty() && opt.targets.empty()))
+    {
+        err << "Error: Input and output paths are required.\n";
+        return 1;
+    }
+
+    if (params.canvasWidth <= 0 || params.canvasHeight <= 0)
+    {
+        err << "Error: Canvas dimensions must be positive.\n";
+        return 1;
+    }
+
+    if (params.paddingPercent < 0 || params.paddingPercent >= 50)
+    {
+        err << "Error: Padding percent must be between 0 and 50.\n";
+        return 1;
+    }
+
+    if (!isHexColor(params.hexColor))
+    {
+        err << "Error: --color must be six hex digits (#rrggbb).\n";
+        return 1;
+    }
+
+    if (opt.badMetrics)
+    {
+        err << "Error: --metrics only supports json.\n";
+        return 1;
+    }
+
+    std::string encodeError = encodeOptionsError(opt.enc);
+    if (!encodeError.empty())
+    {
+        err << encodeError << "\n";
+        return 1;
+    }
+    std::unique_ptr<JobMetrics> metrics = startMetrics(opt.metrics, "matte");
+
+    if (!opt.targets.empty())
+        return writeMatteRenditions(opt, out, err, io, metrics.get());
+
+    // The matte is encoded before returning, so in worker mode each thread
+    // keeps its canvas buffer for the next job of the same size.
+    static thread_local Mat canvas;
+    std::string msg;
+    Size inputSize;
+    if (stream)
+    {
+        Mat decoded;
+        std::unique_ptr<RowSource> src = openRowStream(inputPath, io, decoded, msg);
+        if (!src || !createMatteStream(*src, params, canvas, msg, metrics.get()))
+        {
+            err << msg << "\n";
+            return 1;
+        }
+        inputSize = Size(src->width(), src->height());
+    }
+    else
+    {
+        // Load input image
+        Mat input;
+        {
+            StageTimer timer(metrics.get(), "decode");
+            input = loadImage(inputPath, io);
+        }
+        if (input.empty())
+        {
+            err << "Error: Could not read input image from " << inputPath << "\n";
+            return 1;
+        }
+        inputSize = input.size();
+        if (!createMatte(input, params, canvas, msg, metrics.get()))
+        {
+            err << msg << "\n";
+            return 1;
+        }
+    }
+
+    // Save the result
+    SavedImage savedImage;
+    bool saved;
+    {
+        StageTimer timer(metrics.get(), "encode");
+        saved = saveImage(outputPath, canvas, io, opt.enc, &savedImage);
+    }
+    if (!saved)
+    {
+        err << "Error: Could not write output image to " << outputPath << "\n";
+        return 1;
+    }
+
+    out << "Matte created successfully: " << outputPath << std::endl;
+    reportOutput(out, outputPath, savedImage, metrics.get());
+    if (metrics)
+    {
+        metrics->setSize("input", inputSize.width, inputSize.height);
+        metrics->setSize("output", canvas.cols, canvas.rows);
+        writeMetrics(out, metrics.get());
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+struct PipelineOptions
+{
+    std::string inputPath, outputPath;
+    std::vector<PipelineStep> steps;
+    std::string badStep; // the first --step that did not parse
+    bool metrics = false, badMetrics = false;
+    EncodeOptions enc;
+};
+
+static PipelineOptions parsePipelineArgs(const std::vector<std::string> &args)
+{
+    PipelineOptions opt;
+    for (size_t i = 1; i < args.size(); ++i)
+    {
+        const std::string &arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (parseEncodeArg(args, i, opt.enc))
+            continue;
+        if (arg == "--input" && hasValue)
+            opt.inputPath = args[++i];
+        else if (arg == "--output" && hasValue)
+            opt.outputPath = args[++i];
+        else if (arg == "--metrics" && hasValue)
+            opt.badMetrics = !(opt.metrics = args[++i] == "json");
+        else if (arg == "--step" && hasValue)
+        {
+            PipelineStep step;
+            std::string msg;
+            if (parsePipelineStep(args[++i], step, msg))
+                opt.steps.push_back(step);
+            else if (opt.badStep.empty())
+                opt.badStep = msg;
+        }
+    }
+    return opt;
+}
+
+int runCanvasPipeline(const std::vector<std::string> &args, std::ostream &out, std::ostream &err,
+                      JobIO *io)
+{
+    PipelineOptions opt = parsePipelineArgs(args);
+    if (opt.inputPath.empty() || opt.outputPath.empty() || (opt.steps.empty() && opt.badStep.empty()))
+    {
+        err << "Usage: " << args[0] << " --input <path> --output <path> --step \"<op> key=value ...\" [--step ...] [--metrics json] [encode options]\n";
+        err << "Steps: crop x= y= width= height= [preview-width= preview-height= output-width= output-height= scale= quality=]\n";
+        err << "       extend height= [pad= threshold= requested-width= requested-height= sample= mode= quality=]\n";
+        err << "       matte width= height= [padding= color=]\n";
+        err << "       resize [width=] [height=] [quality=]\n";
+        return 1;
+    }
+    if (!opt.badStep.empty())
+    {
+        err << opt.badStep << "\n";
+        return 1;
+    }
+    if (opt.badMetrics)
+    {
+        err << "Error: --metrics only supports json.\n";
+        return 1;
+    }
+    std::string encodeError = encodeOptionsError(opt.enc);
+    if (!encodeError.empty())
+    {
+        err << encodeError << "\n";
+        return 1;
+    }
+    std::unique_ptr<JobMetrics> metrics = startMetrics(opt.metrics, "pipeline");
+
+    Mat input;
+    {
+        StageTimer timer(metrics.get(), "decode");
+        input = loadImage(opt.inputPath, io);
+    }
+    if (input.empty())
+    {
+        err << "Error: Could not read input image from " << opt.inputPath << "\n";
+        return 1;
+    }
+
+    // Every step works on the decoded Mat; the result is encoded once
+    Mat result;
+    std::string msg;
+    if (!runPipeline(input, opt.steps, result, out, msg, metrics.get()))
+    {
+        err << msg << "\n";
+        return 1;
+    }
+
+    SavedImage savedImage;
+    bool saved;
+    {
+        StageTimer timer(metrics.get(), "encode");
+        saved = saveImage(opt.outputPath, result, io, opt.enc, &savedImage);
+    }
+    if (!saved)
+    {
+        err << "Error: Could not write output image to " << opt.outputPath << "\n";
+        return 1;
+    }
+
+    out << "Pipeline of " << opt.steps.size() << " steps saved (" << result.cols << "x" << result.rows
+        << ") to " << opt.outputPath << std::endl;
+    reportOutput(out, opt.outputPath, savedImage, metrics.get());
+    if (metrics)
+    {
+        metrics->setSize("input", input.cols, input.rows);
+        metrics->setSize("output", result.cols, result.rows);
+        writeMetrics(out, metrics.get());
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+int runImageProbe(const std::vector<std::string> &args, std::ostream &out, std::ostream &err,
+                  JobIO *io)
+{
+    std::string inputPath;
+    for (size_t i = 1; i + 1 < args.size(); ++i)
+    {
+        if (args[i] == "--input")
+            inputPath = args[++i];
+    }
+
+    ImageInfo info;
+    bool probed = false;
+    if (inputPath == kInMemory && io && io->decoded && !io->decoded->empty())
+    {
+        info.width = io->decoded->cols;
+        info.height = io->decoded->rows;
+        info.format = "decoded";
+        probed = true;
+    }
+    else if (inputPath == kInMemory)
+        probed = io && io->input && probeImage(io->input->data(), io->input->size(), info);
+    else
+        probed = probeImageFile(inputPath, info);
+
+    if (!probed)
+    {
+        Mat input = loadImage(inputPath, io);
+        if (input.empty())
+        {
+            err << "Error: Could not read input image from " << inputPath << "\n";
+            return 1;
+        }
+        info.width = input.cols;
+        info.height = input.rows;
+        info.format = "other";
+    }
+    out << info.width << " " << info.height << " " << info.format;
+    return 0;
+}
+
+//---------------------------------------------------------------------
+// Cache keys. Numbers go through the same parsing as the tools and are
+// printed back in one spelling, and defaults are filled in, so "0.05" and
+// ".050" or an omitted threshold and -1 give the same key.
+static bool inMemoryJob(const std::string &in, const std::string &out)
+{
+    return in == kInMemory && out == kInMemory;
+}
+
+std::string extendParamKey(const std::vector<std::string> &args)
+{
+    try
+    {
+        ExtendOptions opt = splitExtendArgs(args);
+        if (!opt.manifestPath.empty() || opt.pos.size() < 4 || !inMemoryJob(opt.pos[1], opt.pos[2]))
+            return "";
+        ExtendParams p = parseExtendParams(opt.pos, 3);
+        if (p.whiteThr < 0 || p.whiteThr > 255)
+            p.whiteThr = -1;
+        if (p.requestedW <= 0 || p.requestedH <= 0)
+            p.requestedW = p.requestedH = -1;
+
+        std::ostringstream key;
+        key.precision(10);
+        key << "extend h=" << p.desiredH << " pad=" << p.padPct << " thr=" << p.whiteThr
+            << " req=" << p.requestedW << "x" << p.requestedH
+            << " quality=" << resizeQualityName(opt.quality) << " sample=" << sampleRegionName(p.whiteThr == -1 ? opt.sample : SampleRegion::Center)
+            << " mode=" << extendModeName(opt.mode)
+            << (opt.stream ? " stream" : opt.reducedDecode ? " reduced" : "") << encodeKey(opt.enc);
+        return key.str();
+    }
+    catch (const std::exception &)
+    {
+        return "";
+    }
+}
+
+std::string cropParamKey(const std::vector<std::string> &args)
+{
+    try
+    {
+        CropOptions opt = parseCropArgs(args);
+        if (!inMemoryJob(opt.inputPath, opt.outputPath))
+            return "";
+        const CropParams &p = opt.params;
+
+        std::ostringstream key;
+        key.precision(10);
+        key << "crop preview=" << p.previewWidth << "x" << p.previewHeight << " rect=" << p.cropX << "," << p.cropY << "," << std::max(0, p.cropWidth) << ","
+            << std::max(0, p.cropHeight) << " out=" << p.outputWidth << "x" << p.outputHeight
+            << " scale=" << p.scale << " quality=" << resizeQualityName(p.quality)
+            << (opt.draft > 0 ? " draft=" + std::to_string(opt.draft) : "")
+            << (opt.stream ? " stream" : "") << encodeKey(opt.enc);
+        return key.str();
+    }
+    catch (const std::exception &)
+    {
+        return "";
+    }
+}
+
+std::string matteParamKey(const std::vector<std::string> &args)
+{
+    try
+    {
+        MatteOptions opt = parseMatteArgs(args);
+        if (!inMemoryJob(opt.inputPath, opt.outputPath) || !opt.targets.empty() ||
+            !isHexColor(opt.params.hexColor))
+            return "";
+        const MatteParams &p = opt.params;
+        Scalar bgr = hexToScalar(p.hexColor);
+        char color[8];
+        snprintf(color, sizeof(color), "%02x%02x%02x", static_cast<int>(bgr[2]),
+                 static_cast<int>(bgr[1]), static_cast<int>(bgr[0]));
+
+        std::ostringstream key;
+        key.precision(10);
+        key << "matte canvas=" << p.canvasWidth << "x" << p.canvasHeight << " pad=" << p.paddingPercent
+            << " color=" << color << (opt.stream ? " stream" : "") << encodeKey(opt.enc);
+        return key.str();
+    }
+    catch (const std::exception &)
+    {
+        return "";
+    }
+}
+
+std::string pipelineParamKey(const std::vector<std::string> &args)
+{
+    try
+    {
+        PipelineOptions opt = parsePipelineArgs(args);
+        if (!inMemoryJob(opt.inputPath, opt.outputPath) || opt.steps.empty() || !opt.badStep.empty() ||
+            !opt.enc.badValue.empty())
+            return "";
+        std::string key = "pipeline";
+        for (const PipelineStep &step : opt.steps)
+            key += " | " + pipelineStepKey(step);
+        return key + encodeKey(opt.enc);
+    }
+    catch (const std::exception &)
+    {
+        return "";
+    }
+}
+
+} // namespace canvascli
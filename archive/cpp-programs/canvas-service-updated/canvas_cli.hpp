@@ -0,0 +1,81 @@
+// canvas_cli.hpp
+// Command-line front ends for the canvas tools. Each run* function
+// takes the tool's argv (args[0] is the program name), does the image I/O
+// and returns the process exit code. The standalone binaries call these
+// from main(); canvas_worker calls them once per framed request.
+//
+// An input or output path of "-" means "in memory": the input is decoded
+// from JobIO::input and the result is encoded into JobIO::output, so no
+// temporary files are needed. The tools then print "Output type: <mime>"
+// so callers know what --format produced.
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace cv
+{
+class Mat;
+}
+
+namespace canvascli
+{
+
+struct JobIO
+{
+    const std::vector<unsigned char> *input = nullptr; // encoded input for "-"
+    std::vector<unsigned char> *output = nullptr;      // encoded output for "-"
+    const cv::Mat *decoded = nullptr;                  // already-decoded input for "-", used instead of input
+    cv::Mat *keepDecoded = nullptr;                    // receives the full decode of input, for caching
+    // When set, also receives the "-" output in pieces while it is encoded
+    // (JPEG; other formats in one piece at the end), so a caller can send
+    // the first bytes before the last are written. output still gets it all.
+    std::function<void(const char *mime, const unsigned char *data, size_t len)> onOutputChunk;
+};
+
+typedef int (*ToolRunner)(const std::vector<std::string> &args, std::ostream &out,
+                          std::ostream &err, JobIO *io);
+
+std::vector<std::string> argsFromMain(int argc, char **argv);
+
+int runExtendCanvas(const std::vector<std::string> &args, std::ostream &out, std::ostream &err,
+                    JobIO *io = nullptr);
+// Crops of upright JPEGs decode only the crop's rows and MCU columns, at
+// 1/2-1/8 size when the crop is shrunk that much; a pure crop (output = the
+// crop, unscaled, default JPEG quality) with an MCU-aligned offset is cut
+// losslessly in the DCT domain instead. --stream skips the rows above it.
+// --draft <max_side> renders the same crop small, fast and at low quality.
+int runImageCropper(const std::vector<std::string> &args, std::ostream &out, std::ostream &err,
+                    JobIO *io = nullptr);
+// matte_generator also takes repeatable --target WxH:path outputs, all
+// rendered from one decode and encoded in parallel.
+int runMatteGenerator(const std::vector<std::string> &args, std::ostream &out, std::ostream &err,
+                      JobIO *io = nullptr);
+
+// Runs repeatable --step "<op> key=value ..." arguments in order on one
+// decode and encodes the result once (see pipeline.hpp for the steps).
+int runCanvasPipeline(const std::vector<std::string> &args, std::ostream &out, std::ostream &err,
+                      JobIO *io = nullptr);
+
+// Prints "<width> <height> <format>" of --input from its header alone
+// (canvas_worker's probe op); falls back to a decode for other formats.
+int runImageProbe(const std::vector<std::string> &args, std::ostream &out, std::ostream &err,
+                  JobIO *io = nullptr);
+
+// Canonical form of an in-memory ("-" in, "-" out) job's parameters, used
+// to key cached results: spellings that produce the same output give the
+// same string. Empty when the job is not cacheable (files, batch, bad args).
+std::string extendParamKey(const std::vector<std::string> &args);
+std::string cropParamKey(const std::vector<std::string> &args);
+std::string matteParamKey(const std::vector<std::string> &args);
+std::string pipelineParamKey(const std::vector<std::string> &args);
+
+// main() for a standalone tool. When any argument is "-" the input is read
+// from stdin, the encoded result is written to stdout and log lines move to
+// stderr.
+int runStandalone(ToolRunner run, int argc, char **argv);
+
+} // namespace canvascli
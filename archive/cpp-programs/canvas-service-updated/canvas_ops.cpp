@@ -0,0 +1,930 @@
+// canvas_ops.cpp
+// Implementation of the shared canvas operations (see canvas_ops.hpp).
+#include "canvas_ops.hpp"
+#include "mat_pool.hpp"
+#include "metrics.hpp"
+#include "thread_pool.hpp"
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <future>
+#include <initializer_list>
+#include <sstream>
+
+using namespace cv;
+
+namespace canvasops
+{
+
+//---------------------------------------------------------------------
+bool parseSampleRegion(const std::string &name, SampleRegion &region)
+{
+    if (name == "center")
+        region = SampleRegion::Center;
+    else if (name == "corners")
+        region = SampleRegion::Corners;
+    else if (name == "all")
+        region = SampleRegion::All;
+    else
+        return false;
+    return true;
+}
+
+const char *sampleRegionName(SampleRegion region)
+{
+    return region == SampleRegion::Center ? "center" : region == SampleRegion::Corners ? "corners" : "all";
+}
+
+bool parseExtendMode(const std::string &name, ExtendMode &mode)
+{
+    if (name == "stretch")
+        mode = ExtendMode::Stretch;
+    else if (name == "model")
+        mode = ExtendMode::Model;
+    else
+        return false;
+    return true;
+}
+
+const char *extendModeName(ExtendMode mode)
+{
+    return mode == ExtendMode::Model ? "model" : "stretch";
+}
+
+// The stripes sampled for the automatic white threshold: centre top and
+// bottom, and/or the four corners, all of the same size. Returns the count.
+static const int kMaxStripes = 6;
+static int sampleStripes(int cols, int rows, int stripeH, int stripeW, SampleRegion region,
+                         Rect (&stripes)[kMaxStripes])
+{
+    int cx = cols / 2;
+    int w = std::min({stripeW, cx - 1, cols - cx - 1});
+    int h = std::min(stripeH, rows / 10);
+    int n = 0;
+
+    if (region != SampleRegion::Corners)
+    {
+        stripes[n++] = Rect(cx - w, 0, 2 * w + 1, h);
+        stripes[n++] = Rect(cx - w, rows - h, 2 * w + 1, h);
+    }
+    if (region != SampleRegion::Center)
+    {
+        for (int y : {0, rows - h})
+        {
+            stripes[n++] = Rect(0, y, 2 * w + 1, h);
+            stripes[n++] = Rect(cols - (2 * w + 1), y, 2 * w + 1, h);
+        }
+    }
+    return n;
+}
+
+static int thresholdFromMean(double darkestMean)
+{
+    int thr = static_cast<int>(darkestMean - 5.0); // 5‑point cushion below white
+    thr = std::clamp(thr, 180, 250);
+    return thr;
+}
+
+// Sum of BT.601 luma over pixels [x, x+w) of a BGR row, with the same
+// fixed-point weights and rounding cvtColor uses, so the means match a
+// cvtColor + mean of the stripe exactly.
+static double stripeLumaSum(const uchar *row, int x, int w)
+{
+    const uchar *p = row + x * 3;
+    int i = 0;
+    unsigned long sum = 0;
+#if CV_SIMD128
+    const v_uint16x8 wb = v_setall_u16(1868), wg = v_setall_u16(9617), wr = v_setall_u16(4899);
+    const v_uint32x4 half = v_setall_u32(1 << 13);
+    for (; i + 16 <= w; i += 16)
+    {
+        v_uint8x16 b, g, r;
+        v_load_deinterleave(p + i * 3, b, g, r);
+        v_uint16x8 b0, b1, g0, g1, r0, r1;
+        v_expand(b, b0, b1);
+        v_expand(g, g0, g1);
+        v_expand(r, r0, r1);
+
+        v_uint32x4 acc = v_setzero_u32();
+        v_uint32x4 lo, hi, t0, t1;
+        v_mul_expand(b0, wb, lo, hi);
+        v_mul_expand(g0, wg, t0, t1);
+        lo += t0;
+        hi += t1;
+        v_mul_expand(r0, wr, t0, t1);
+        acc += ((lo + t0 + half) >> 14) + ((hi + t1 + half) >> 14);
+
+        v_mul_expand(b1, wb, lo, hi);
+        v_mul_expand(g1, wg, t0, t1);
+        lo += t0;
+        hi += t1;
+        v_mul_expand(r1, wr, t0, t1);
+        acc += ((lo + t0 + half) >> 14) + ((hi + t1 + half) >> 14);
+        sum += v_reduce_sum(acc);
+    }
+#endif
+    for (const uchar *q = p + i * 3, *end = p + w * 3; q < end; q += 3)
+        sum += (q[0] * 1868 + q[1] * 9617 + q[2] * 4899 + (1 << 13)) >> 14;
+    return static_cast<double>(sum);
+}
+
+int centerSampleThreshold(const Mat &img, int stripeH, int stripeW, SampleRegion region)
+{
+    Rect stripes[kMaxStripes];
+    int n = sampleStripes(img.cols, img.rows, stripeH, stripeW, region, stripes);
+
+    double darkest = 255.0;
+    for (int k = 0; k < n; ++k)
+    {
+        const Rect &r = stripes[k];
+        double sum = 0;
+        for (int y = r.y; y < r.y + r.height; ++y)
+            sum += stripeLumaSum(img.ptr<uchar>(y), r.x, r.width);
+        darkest = std::min(darkest, sum / std::max(1, r.area()));
+    }
+    return thresholdFromMean(darkest);
+}
+
+// True when some byte of p[0..n) is below thr, i.e. some pixel of the row
+// falls outside inRange(thr..255) on at least one channel. Works through
+// 64-byte blocks with a vector min and returns at the first block that
+// hits, so background rows cost one pass and foreground rows usually less.
+static bool rowHasForeground(const uchar *p, int n, uchar thr)
+{
+    int x = 0;
+#if CV_SIMD128
+    const int block = 64;
+    for (; x + block <= n; x += block)
+    {
+        v_uint8x16 m = v_min(v_min(v_load(p + x), v_load(p + x + 16)),
+                             v_min(v_load(p + x + 32), v_load(p + x + 48)));
+        if (v_reduce_min(m) < thr)
+            return true;
+    }
+#endif
+    for (; x < n; ++x)
+    {
+        if (p[x] < thr)
+            return true;
+    }
+    return false;
+}
+
+bool findForegroundBounds(const Mat &img, int &top, int &bot, int whiteThr)
+{
+    top = -1;
+    bot = -1;
+
+    if (img.type() != CV_8UC3)
+    {
+        Mat mask;
+        inRange(img, Scalar(whiteThr, whiteThr, whiteThr), Scalar(255, 255, 255), mask);
+        bitwise_not(mask, mask);                  // foreground = 255
+        reduce(mask, mask, 1, REDUCE_MAX, CV_8U); // rows collapsed
+
+        for (int r = 0; r < mask.rows; ++r)
+        {
+            if (mask.at<uchar>(r, 0))
+            {
+                if (top == -1)
+                    top = r;
+                bot = r;
+            }
+        }
+        return top != -1;
+    }
+
+    // Same result as the inRange/reduce mask above, but without the mask:
+    // scan down from the top and up from the bottom and stop at the first
+    // foreground row, so the middle of the image is normally never read.
+    const int rowBytes = img.cols * img.channels();
+    const uchar thr = saturate_cast<uchar>(whiteThr);
+    for (int r = 0; r < img.rows; ++r)
+    {
+        if (rowHasForeground(img.ptr<uchar>(r), rowBytes, thr))
+        {
+            top = r;
+            break;
+        }
+    }
+    if (top == -1)
+        return false;
+
+    for (int r = img.rows - 1; r >= top; --r)
+    {
+        if (rowHasForeground(img.ptr<uchar>(r), rowBytes, thr))
+        {
+            bot = r;
+            break;
+        }
+    }
+    return true;
+}
+
+Mat makeStrip(const Mat &src, int newH, int W)
+{
+    if (newH <= 0)
+        return Mat();
+    if (!src.empty())
+    {
+        Mat dst;
+        resize(src, dst, Size(W, newH), 0, 0, INTER_AREA);
+        return dst;
+    }
+    return Mat(newH, W, CV_8UC3, Scalar(255, 255, 255));
+}
+
+// Resize src to exactly fill dst (a view into a larger image); an empty
+// src leaves the white background in place, as makeStrip would.
+static void resizeInto(const Mat &src, Mat dst, int interpolation)
+{
+    if (dst.empty() || src.empty())
+        return;
+    resize(src, dst, dst.size(), 0, 0, interpolation);
+}
+
+// Runs the independent stages of one image at once, within the job's share
+// of the cores (resampleThreadCount(), which --threads / --jobs set): the
+// first on the calling thread, up to that many less one on a small pool of
+// their own, and any left over on the calling thread after the first. Never
+// on the resampler's pool, whose bands the first stage may be waiting for.
+// Serial when the job is held to one thread (batch mode, or a worker
+// running a job per core).
+static void runStages(std::initializer_list<std::function<void()>> stages)
+{
+    const unsigned budget = resampleThreadCount();
+    if (budget < 2 || stages.size() == 1)
+    {
+        for (const std::function<void()> &stage : stages)
+            stage();
+        return;
+    }
+
+    // Shared by all jobs, so concurrent jobs never add more than its two
+    // threads between them; two is also the most any caller hands off
+    static ThreadPool pool(2);
+    const size_t helpers = std::min<size_t>(stages.size() - 1, budget - 1);
+    std::vector<std::future<void>> pending;
+    MatByteCounter *job = MatByteCounter::current();
+    for (auto it = stages.begin() + 1; it != stages.begin() + 1 + helpers; ++it)
+        pending.push_back(pool.submit([job, stage = *it]()
+                                      {
+                                          MatByteScope scope(job);
+                                          stage();
+                                      }));
+    // The pool tasks reference the caller's frame: wait for all of them
+    // before letting any failure out.
+    std::exception_ptr failure;
+    try
+    {
+        (*stages.begin())();
+        for (auto it = stages.begin() + 1 + helpers; it != stages.end(); ++it)
+            (*it)();
+    }
+    catch (...)
+    {
+        failure = std::current_exception();
+    }
+    for (std::future<void> &f : pending)
+    {
+        try
+        {
+            f.get();
+        }
+        catch (...)
+        {
+            if (!failure)
+                failure = std::current_exception();
+        }
+    }
+    if (failure)
+        std::rethrow_exception(failure);
+}
+
+// A strip's rows of the output: src resized into them, white without one.
+static void fillStrip(const Mat &src, Mat dst)
+{
+    if (src.empty())
+        dst.setTo(Scalar(255, 255, 255));
+    else
+        resizeInto(src, dst, INTER_AREA);
+}
+
+// ExtendMode::Model: src's background as a per-column ramp a + b*y, least
+// squares over up to 64 evenly spaced rows, stretched over dst's height and
+// resampled to its width. Each output row is one scaleAdd and convertTo,
+// so the cost is the output's size, not the stretch.
+static void fillModelledStrip(const Mat &src, Mat dst)
+{
+    if (dst.empty())
+        return;
+    if (src.empty())
+    {
+        dst.setTo(Scalar(255, 255, 255));
+        return;
+    }
+
+    const int n = src.rows;
+    const int samples = std::min(n, 64);
+    const int type = CV_MAKETYPE(CV_32F, src.channels());
+    Mat sumV = Mat::zeros(1, src.cols, type), sumYV = Mat::zeros(1, src.cols, type), rowF;
+    double sumY = 0, sumYY = 0;
+    for (int k = 0; k < samples; ++k)
+    {
+        int y = samples == 1 ? 0 : static_cast<int>(static_cast<int64>(k) * (n - 1) / (samples - 1));
+        src.row(y).convertTo(rowF, CV_32F);
+        sumV += rowF;
+        scaleAdd(rowF, y, sumYV, sumYV);
+        sumY += y;
+        sumYY += static_cast<double>(y) * y;
+    }
+    // b = (sum(y*v) - meanY*sum(v)) / var(y), a = mean(v) - b*meanY
+    const double meanY = sumY / samples;
+    const double varY = sumYY - sumY * meanY;
+    Mat a, b = Mat::zeros(1, src.cols, type);
+    if (varY > 0)
+    {
+        scaleAdd(sumV, -meanY, sumYV, b);
+        b.convertTo(b, CV_32F, 1.0 / varY);
+    }
+    sumV.convertTo(a, CV_32F, 1.0 / samples);
+    scaleAdd(b, -meanY, a, a);
+    if (dst.cols != src.cols)
+    {
+        resize(a, a, Size(dst.cols, 1), 0, 0, INTER_AREA);
+        resize(b, b, Size(dst.cols, 1), 0, 0, INTER_AREA);
+    }
+
+    const double yScale = static_cast<double>(n) / dst.rows;
+    Mat line;
+    for (int r = 0; r < dst.rows; ++r)
+    {
+        double y = std::min(std::max((r + 0.5) * yScale - 0.5, 0.0), static_cast<double>(n - 1));
+        scaleAdd(b, y, a, line);
+        line.convertTo(dst.row(r), dst.type()); // rounds and saturates
+    }
+}
+
+bool extendCanvas(const Mat &img, const ExtendParams &params, ExtendResult &result,
+                  std::ostream &log, std::string &err, Metrics *metrics)
+{
+    const int desiredH = params.desiredH;
+    const int requestedW = params.requestedW;
+    const int requestedH = params.requestedH;
+
+    int whiteThr = params.whiteThr;
+    if (whiteThr < 0 || whiteThr > 255)
+    {
+        StageTimer timer(metrics, "threshold");
+        whiteThr = centerSampleThreshold(img, params.sampleStripeH, params.sampleStripeW, params.sample);
+    }
+    result.whiteThr = whiteThr;
+
+    int fgTop, fgBot;
+    bool found;
+    {
+        StageTimer timer(metrics, "bounds");
+        found = findForegroundBounds(img, fgTop, fgBot, whiteThr);
+    }
+    if (!found)
+    {
+        err = "Foreground not found (try lowering threshold).";
+        return false;
+    }
+
+    int carH = fgBot - fgTop + 1;
+    int pad = static_cast<int>(carH * params.padPct + 0.5);
+    int cropTop = std::max(0, fgTop - pad);
+    int cropBot = std::min(img.rows - 1, fgBot + pad);
+
+    Mat carReg = img.rowRange(cropTop, cropBot + 1);
+
+    // If already tall enough, centre crop and exit
+    if (desiredH <= carReg.rows)
+    {
+        int yOff = (carReg.rows - desiredH) / 2;
+        Mat res = carReg.rowRange(yOff, yOff + desiredH);
+
+        // Apply final resize if requested dimensions are specified
+        if (requestedW > 0 && requestedH > 0)
+        {
+            StageTimer timer(metrics, "resize");
+            // Fit and centre on a white canvas, resampled straight into place
+            Size box(requestedW, requestedH);
+            Mat finalCanvas(box, res.type(), Scalar(255, 255, 255));
+            resampleInto(res, finalCanvas(centerIn(fitInside(res.size(), box), box)), params.quality);
+            res = finalCanvas;
+            log << "Resized to requested dimensions with aspect ratio preserved: " << requestedW << "x" << requestedH << std::endl;
+        }
+
+        result.image = res;
+        result.extended = false;
+        return true;
+    }
+
+    int extra = desiredH - carReg.rows;
+    int topH = extra / 2;
+    int W = img.cols;
+
+    Mat topSrc = cropTop > 0 ? img.rowRange(0, cropTop) : Mat();
+    Mat botSrc = (cropBot + 1 < img.rows) ? img.rowRange(cropBot + 1, img.rows) : Mat();
+    auto makeStripInto = [&](const Mat &src, Mat dst)
+    {
+        if (params.mode == ExtendMode::Model)
+            fillModelledStrip(src, dst);
+        else
+            fillStrip(src, dst);
+    };
+
+    // Apply final resize if requested dimensions are specified
+    if (requestedW > 0 && requestedH > 0)
+    {
+        // Resize the top strip, car region and bottom strip straight into
+        // their rows of the output instead of assembling the full
+        // desiredH x W canvas and resizing that (so no compose stage).
+        StageTimer timer(metrics, "resize");
+        Size box(requestedW, requestedH);
+        Mat finalCanvas(box, img.type(), Scalar(255, 255, 255)); // White background
+        Mat dst = finalCanvas(centerIn(fitInside(Size(W, desiredH), box), box));
+
+        double scale = static_cast<double>(dst.rows) / desiredH;
+        int yCar = std::clamp(cvRound(topH * scale), 0, dst.rows);
+        int yBot = std::clamp(cvRound((topH + carReg.rows) * scale), yCar, dst.rows);
+
+        // The car region (whose resample is itself banded) alongside
+        // the two strips
+        runStages({[&]()
+                   { resampleInto(carReg, dst.rowRange(yCar, yBot), params.quality); },
+                   [&]()
+                   { makeStripInto(topSrc, dst.rowRange(0, yCar)); },
+                   [&]()
+                   { makeStripInto(botSrc, dst.rowRange(yBot, dst.rows)); }});
+
+        log << "Extended canvas resized to requested dimensions with aspect ratio preserved: " << requestedW << "x" << requestedH << std::endl;
+        result.image = finalCanvas;
+        result.extended = true;
+        return true;
+    }
+
+    // Strips are resized straight into their rows (as makeStrip would
+    // make them) while the car region is copied into the middle
+    Mat canvas(desiredH, W, img.type());
+    {
+        StageTimer timer(metrics, "compose");
+        runStages({[&]()
+                   { carReg.copyTo(canvas.rowRange(topH, topH + carReg.rows)); },
+                   [&]()
+                   { makeStripInto(topSrc, canvas.rowRange(0, topH)); },
+                   [&]()
+                   { makeStripInto(botSrc, canvas.rowRange(topH + carReg.rows, desiredH)); }});
+    }
+
+    result.image = canvas;
+    result.extended = true;
+    return true;
+}
+
+// Stream src into dst (a view of the output), resampling if sizes differ.
+static bool streamInto(RowSource &src, Mat dst)
+{
+    if (src.width() == dst.cols && src.height() == dst.rows)
+        return drainInto(src, dst);
+    ResizeRowSource resized(src, dst.cols, dst.rows);
+    return drainInto(resized, dst);
+}
+
+bool extendCanvasStream(const RowSourceFactory &open, const ExtendParams &params,
+                        ExtendResult &result, std::ostream &log, std::string &err, Metrics *metrics)
+{
+    const int desiredH = params.desiredH;
+    const int requestedW = params.requestedW;
+    const int requestedH = params.requestedH;
+
+    std::unique_ptr<RowSource> src = open(err);
+    if (!src)
+        return false;
+    const int W = src->width();
+    const int H = src->height();
+
+    // Pass 1: the darkest byte of every row decides foreground for any
+    // threshold, so the bounds can be found after the threshold is known.
+    Rect stripes[kMaxStripes];
+    const int nStripes = sampleStripes(W, H, params.sampleStripeH, params.sampleStripeW, params.sample, stripes);
+    std::vector<uchar> rowMin(H);
+    double sums[kMaxStripes] = {0};
+    {
+        StageTimer timer(metrics, "scan"); // decode + threshold samples + row minima
+        for (int y = 0; y < H; ++y)
+        {
+            const uchar *row = src->next();
+            if (!row)
+            {
+                err = "Error: Input ended early while streaming.";
+                return false;
+            }
+            rowMin[y] = *std::min_element(row, row + W * 3);
+            for (int k = 0; k < nStripes; ++k)
+            {
+                if (y >= stripes[k].y && y < stripes[k].y + stripes[k].height)
+                    sums[k] += stripeLumaSum(row, stripes[k].x, stripes[k].width);
+            }
+        }
+    }
+    src.reset();
+
+    int whiteThr = params.whiteThr;
+    if (whiteThr < 0 || whiteThr > 255)
+    {
+        double darkest = 255.0;
+        for (int k = 0; k < nStripes; ++k)
+            darkest = std::min(darkest, sums[k] / std::max(1, stripes[k].area()));
+        whiteThr = thresholdFromMean(darkest);
+    }
+    result.whiteThr = whiteThr;
+
+    int fgTop = -1, fgBot = -1;
+    for (int y = 0; y < H; ++y)
+    {
+        if (rowMin[y] < whiteThr)
+        {
+            if (fgTop == -1)
+                fgTop = y;
+            fgBot = y;
+        }
+    }
+    if (fgTop == -1)
+    {
+        err = "Foreground not found (try lowering threshold).";
+        return false;
+    }
+
+    int carH = fgBot - fgTop + 1;
+    int pad = static_cast<int>(carH * params.padPct + 0.5);
+    int cropTop = std::max(0, fgTop - pad);
+    int cropBot = std::min(H - 1, fgBot + pad);
+    int carRows = cropBot - cropTop + 1;
+
+    // Pass 2: compose the desiredH x W canvas as a row stream
+    StageTimer composeTimer(metrics, "compose"); // decode + compose + resize
+    src = open(err);
+    if (!src)
+        return false;
+
+    std::vector<std::unique_ptr<RowSource>> nodes;
+    std::vector<RowSource *> parts;
+    result.extended = desiredH > carRows;
+    if (!result.extended)
+    {
+        int yOff = (carRows - desiredH) / 2;
+        nodes.emplace_back(new RangeRowSource(*src, Rect(0, cropTop + yOff, W, desiredH)));
+        parts.push_back(nodes.back().get());
+    }
+    else
+    {
+        int extra = desiredH - carRows;
+        int topH = extra / 2;
+        int botH = extra - topH;
+        const Scalar white(255, 255, 255);
+
+        if (cropTop > 0)
+        {
+            nodes.emplace_back(new RangeRowSource(*src, Rect(0, 0, W, cropTop)));
+            nodes.emplace_back(new ResizeRowSource(*nodes.back(), W, topH));
+        }
+        else
+            nodes.emplace_back(new FillRowSource(W, topH, white));
+        parts.push_back(nodes.back().get());
+
+        nodes.emplace_back(new RangeRowSource(*src, Rect(0, cropTop, W, carRows)));
+        parts.push_back(nodes.back().get());
+
+        if (cropBot + 1 < H)
+        {
+            nodes.emplace_back(new RangeRowSource(*src, Rect(0, cropBot + 1, W, H - cropBot - 1)));
+            nodes.emplace_back(new ResizeRowSource(*nodes.back(), W, botH));
+        }
+        else
+            nodes.emplace_back(new FillRowSource(W, botH, white));
+        parts.push_back(nodes.back().get());
+    }
+    ConcatRowSource canvasRows(parts);
+
+    bool ok;
+    if (requestedW > 0 && requestedH > 0)
+    {
+        // Same fit-and-centre as extendCanvas, resampled row by row
+        Size box(requestedW, requestedH);
+        result.image = Mat(box, CV_8UC3, Scalar(255, 255, 255));
+        ok = streamInto(canvasRows, result.image(centerIn(fitInside(Size(W, desiredH), box), box)));
+        log << (result.extended ? "Extended canvas resized" : "Resized")
+            << " to requested dimensions with aspect ratio preserved: " << requestedW << "x" << requestedH << std::endl;
+    }
+    else
+    {
+        result.image = Mat(desiredH, W, CV_8UC3);
+        ok = drainInto(canvasRows, result.image);
+    }
+
+    if (!ok)
+    {
+        err = "Error: Input ended early while streaming.";
+        return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------
+Size fitInside(Size in, Size box)
+{
+    // Ratios compared in integers, so the side that touches is exactly the box's
+    Size out = box;
+    if (static_cast<int64_t>(in.width) * box.height > static_cast<int64_t>(box.width) * in.height)
+        out.height = static_cast<int>(static_cast<double>(box.width) * in.height / in.width);
+    else
+        out.width = static_cast<int>(static_cast<double>(box.height) * in.width / in.height);
+    return Size(std::max(1, out.width), std::max(1, out.height));
+}
+
+Rect centerIn(Size inner, Size box)
+{
+    return Rect(std::max(0, (box.width - inner.width) / 2), std::max(0, (box.height - inner.height) / 2),
+                inner.width, inner.height);
+}
+
+//---------------------------------------------------------------------
+// Where the crop lands in the output: the optional scale, then a shrink to
+// fit when that is larger than the output, centred.
+bool cropLayout(int inW, int inH, CropParams &params, Rect &crop, Rect &placed, std::string &err)
+{
+    const int outputWidth = params.outputWidth;
+    const int outputHeight = params.outputHeight;
+    const double scale = params.scale;
+
+    // Map crop values picked on a preview to the full-size image
+    if (params.previewWidth > 0 && params.previewHeight > 0)
+    {
+        double fx = static_cast<double>(inW) / params.previewWidth;
+        double fy = static_cast<double>(inH) / params.previewHeight;
+        params.cropX = static_cast<int>(std::lround(params.cropX * fx));
+        params.cropY = static_cast<int>(std::lround(params.cropY * fy));
+        params.cropWidth = static_cast<int>(std::lround(params.cropWidth * fx));
+        params.cropHeight = static_cast<int>(std::lround(params.cropHeight * fy));
+        params.previewWidth = params.previewHeight = 0; // applied
+    }
+
+    // Set default crop dimensions if not specified
+    if (params.cropWidth <= 0)
+        params.cropWidth = inW;
+    if (params.cropHeight <= 0)
+        params.cropHeight = inH;
+
+    // Validate crop parameters
+    if (params.cropX < 0 || params.cropY < 0 ||
+        params.cropX + params.cropWidth > inW ||
+        params.cropY + params.cropHeight > inH)
+    {
+        std::ostringstream msg;
+        msg << "Error: Crop area exceeds image boundaries.\n";
+        msg << "Image size: " << inW << "x" << inH << "\n";
+        msg << "Crop area: " << params.cropX << "," << params.cropY << " " << params.cropWidth << "x" << params.cropHeight;
+        err = msg.str();
+        return false;
+    }
+    crop = Rect(params.cropX, params.cropY, params.cropWidth, params.cropHeight);
+
+    // Apply scaling if specified
+    int width = crop.width, height = crop.height;
+    if (scale != 1.0)
+    {
+        width = static_cast<int>(crop.width * scale);
+        height = static_cast<int>(crop.height * scale);
+    }
+
+    if (width <= 0 || height <= 0)
+    {
+        err = "Error: Scaled crop is empty.";
+        return false;
+    }
+
+    // If the scaled image is larger than output canvas, shrink it to fit;
+    // either way it is centred
+    Size box(outputWidth, outputHeight), size(width, height);
+    if (width > outputWidth || height > outputHeight)
+        size = fitInside(size, box);
+    placed = centerIn(size, box);
+    return true;
+}
+
+void composeCrop(const Mat &cropped, const CropParams &params, const Rect &placed, Mat &output, Metrics *metrics)
+{
+    // Black background; the crop is scaled (and fitted) in one resize
+    // straight into its place, without a clone or intermediate copies
+    StageTimer timer(metrics, "resize");
+    output = Mat(params.outputHeight, params.outputWidth, cropped.type(), Scalar(0, 0, 0));
+    resampleInto(cropped, output(placed), params.quality);
+}
+
+bool cropAndFit(const Mat &input, CropParams &params, Mat &output, std::string &err, Metrics *metrics)
+{
+    Rect crop, placed;
+    if (!cropLayout(input.cols, input.rows, params, crop, placed, err))
+        return false;
+    composeCrop(input(crop), params, placed, output, metrics);
+    return true;
+}
+
+bool cropAndFitStream(RowSource &input, CropParams &params, Mat &output, std::string &err, Metrics *metrics)
+{
+    Rect crop, placed;
+    if (!cropLayout(input.width(), input.height(), params, crop, placed, err))
+        return false;
+
+    StageTimer timer(metrics, "resize"); // includes the decode
+    output = Mat(params.outputHeight, params.outputWidth, CV_8UC3, Scalar(0, 0, 0));
+    RangeRowSource cropped(input, crop);
+    if (!streamInto(cropped, output(placed)))
+    {
+        err = "Error: Input ended early while streaming.";
+        return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------
+bool isHexColor(const std::string &hex)
+{
+    size_t start = !hex.empty() && hex[0] == '#' ? 1 : 0;
+    return hex.size() == start + 6 && std::all_of(hex.begin() + start, hex.end(), [](unsigned char c)
+                                                  { return std::isxdigit(c) != 0; });
+}
+
+Scalar hexToScalar(const std::string &hex)
+{
+    unsigned int r = 0, g = 0, b = 0;
+    if (!isHexColor(hex) || sscanf(hex.c_str() + (hex[0] == '#' ? 1 : 0), "%02x%02x%02x", &r, &g, &b) != 3)
+        return Scalar(0, 0, 0);
+    return Scalar(b, g, r); // OpenCV uses BGR
+}
+
+// Centred, aspect-preserving placement of the input inside the padded canvas.
+static bool matteLayout(int inW, int inH, const MatteParams &params, Rect &placed, std::string &err)
+{
+    const int canvasWidth = params.canvasWidth;
+    const int canvasHeight = params.canvasHeight;
+
+    // Calculate padding
+    int padX = static_cast<int>(canvasWidth * params.paddingPercent / 100.0);
+    int padY = static_cast<int>(canvasHeight * params.paddingPercent / 100.0);
+    int contentWidth = canvasWidth - 2 * padX;
+    int contentHeight = canvasHeight - 2 * padY;
+
+    // Ensure content area is valid
+    if (contentWidth <= 0 || contentHeight <= 0)
+    {
+        err = "Error: Padding too large for canvas size.";
+        return false;
+    }
+
+    // Fit the content area, centred on the whole canvas
+    Size target = fitInside(Size(inW, inH), Size(contentWidth, contentHeight));
+    placed = centerIn(target, Size(canvasWidth, canvasHeight));
+    return true;
+}
+
+// Size canvas for the matte, keeping its buffer when it already fits, and
+// paint only the bands around placed; the image is written into the rest.
+static void matteCanvas(Mat &canvas, Size size, int type, Rect placed, const Scalar &color)
+{
+    canvas.create(size, type);
+    canvas.rowRange(0, placed.y).setTo(color);
+    canvas.rowRange(placed.y + placed.height, size.height).setTo(color);
+    Mat middle = canvas.rowRange(placed.y, placed.y + placed.height);
+    middle.colRange(0, placed.x).setTo(color);
+    middle.colRange(placed.x + placed.width, size.width).setTo(color);
+}
+
+bool createMatte(const Mat &input, const MatteParams &params, Mat &canvas, std::string &err, Metrics *metrics)
+{
+    Rect placed;
+    if (!matteLayout(input.cols, input.rows, params, placed, err))
+        return false;
+
+    // Background bands, then the input resized straight into the centre
+    {
+        StageTimer timer(metrics, "compose");
+        matteCanvas(canvas, Size(params.canvasWidth, params.canvasHeight), input.type(), placed,
+                    hexToScalar(params.hexColor));
+    }
+    StageTimer timer(metrics, "resize");
+    resizeInto(input, canvas(placed), INTER_AREA);
+    return true;
+}
+
+bool createMatteStream(RowSource &input, const MatteParams &params, Mat &canvas, std::string &err,
+                       Metrics *metrics)
+{
+    Rect placed;
+    if (!matteLayout(input.width(), input.height(), params, placed, err))
+        return false;
+
+    {
+        StageTimer timer(metrics, "compose");
+        matteCanvas(canvas, Size(params.canvasWidth, params.canvasHeight), CV_8UC3, placed,
+                    hexToScalar(params.hexColor));
+    }
+    StageTimer timer(metrics, "resize"); // includes the decode
+    if (!streamInto(input, canvas(placed)))
+    {
+        err = "Error: Input ended early while streaming.";
+        return false;
+    }
+    return true;
+}
+
+// Placements of every canvas size for an inW x inH input, and the order
+// (largest content first) in which the pyramid visits them.
+static bool renditionLayouts(int inW, int inH, const MatteParams &params, const std::vector<Size> &canvases,
+                             std::vector<Rect> &placed, std::vector<size_t> &order, std::string &err)
+{
+    placed.resize(canvases.size());
+    order.resize(canvases.size());
+    for (size_t i = 0; i < canvases.size(); ++i)
+    {
+        MatteParams p = params;
+        p.canvasWidth = canvases[i].width;
+        p.canvasHeight = canvases[i].height;
+        if (!matteLayout(inW, inH, p, placed[i], err))
+            return false;
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                     { return placed[a].area() > placed[b].area(); });
+    return true;
+}
+
+// Halve size while the result still covers want in both dimensions.
+static Size pyramidLevel(Size size, Size want)
+{
+    while (size.width / 2 >= want.width && size.height / 2 >= want.height)
+        size = Size(size.width / 2, size.height / 2);
+    return size;
+}
+
+static void mattesFromPyramid(Mat level, const MatteParams &params, const std::vector<Size> &canvases,
+                              const std::vector<Rect> &placed, const std::vector<size_t> &order,
+                              std::vector<Mat> &out)
+{
+    Scalar color = hexToScalar(params.hexColor);
+    out.assign(canvases.size(), Mat());
+    for (size_t i : order)
+    {
+        // Levels only shrink, since the renditions come largest first
+        Size want = pyramidLevel(level.size(), placed[i].size());
+        while (level.size() != want)
+        {
+            Mat half;
+            resize(level, half, Size(level.cols / 2, level.rows / 2), 0, 0, INTER_AREA);
+            level = half;
+        }
+        matteCanvas(out[i], canvases[i], level.type(), placed[i], color);
+        resizeInto(level, out[i](placed[i]), INTER_AREA);
+    }
+}
+
+bool createMatteRenditions(const Mat &input, const MatteParams &params, const std::vector<Size> &canvases,
+                           std::vector<Mat> &out, std::string &err)
+{
+    std::vector<Rect> placed;
+    std::vector<size_t> order;
+    if (!renditionLayouts(input.cols, input.rows, params, canvases, placed, order, err))
+        return false;
+    mattesFromPyramid(input, params, canvases, placed, order, out);
+    return true;
+}
+
+bool createMatteRenditionsStream(RowSource &input, const MatteParams &params, const std::vector<Size> &canvases,
+                                 std::vector<Mat> &out, std::string &err)
+{
+    std::vector<Rect> placed;
+    std::vector<size_t> order;
+    if (!renditionLayouts(input.width(), input.height(), params, canvases, placed, order, err))
+        return false;
+
+    // Stream straight into the first pyramid level the largest rendition
+    // needs; the full-size image is never held.
+    Mat base(pyramidLevel(Size(input.width(), input.height()), order.empty() ? Size(1, 1) : placed[order[0]].size()),
+             CV_8UC3);
+    if (!streamInto(input, base))
+    {
+        err = "Error: Input ended early while streaming.";
+        return false;
+    }
+    mattesFromPyramid(base, params, canvases, placed, order, out);
+    return true;
+}
+
+} // namespace canvasops
@@ -0,0 +1,162 @@
+// canvas_ops.hpp
+// Image operations shared by extend_canvas, image_cropper, matte_generator
+// and the long-lived canvas_worker. Everything here works on decoded Mats
+// or, for the *Stream variants, on row streams; file and argument handling
+// live in canvas_cli. libcanvasops.so exports the same operations through
+// a C interface (canvas_ops_c.h).
+#pragma once
+
+#include "resample.hpp"
+#include "row_stream.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class Metrics;
+
+// Operations taking a Metrics pointer add their stage timings to it when it
+// is non-null (see metrics.hpp).
+namespace canvasops
+{
+
+//---------------------------------------------------------------------
+// Layout shared by all three tools
+
+// The largest size with in's aspect ratio inside box: one side equals the
+// box's, the other is rounded down, neither is below 1.
+cv::Size fitInside(cv::Size in, cv::Size box);
+// inner centred in box (offsets rounded down, never negative).
+cv::Rect centerIn(cv::Size inner, cv::Size box);
+
+//---------------------------------------------------------------------
+// extend_canvas
+
+// Where the automatic threshold samples the background: the centre of the
+// top and bottom edges (the original method), the four corners, or both.
+// The darkest stripe sets the threshold, so a background that darkens
+// towards the sides is still classified as background with corners/all.
+enum class SampleRegion
+{
+    Center,
+    Corners,
+    All
+};
+
+bool parseSampleRegion(const std::string &name, SampleRegion &region);
+const char *sampleRegionName(SampleRegion region);
+
+// How the rows added above and below the car are made: the background
+// strips stretched to fit (the original method), or each strip modelled
+// per column as a vertical ramp (mean and gradient) and written row by row,
+// which costs O(output) writes for any extension and smears no detail out
+// of thin strips. Model needs the strips in memory (not --stream).
+enum class ExtendMode
+{
+    Stretch,
+    Model
+};
+
+bool parseExtendMode(const std::string &name, ExtendMode &mode);
+const char *extendModeName(ExtendMode mode);
+
+struct ExtendParams
+{
+    int desiredH = 0;
+    double padPct = 0.05;
+    int whiteThr = -1; // -1 → AUTO (center-sample)
+    int requestedW = -1;
+    int requestedH = -1;
+    int sampleStripeH = 20; // centerSampleThreshold stripe size; scaled down
+    int sampleStripeW = 40; // with the input on reduced decodes
+    SampleRegion sample = SampleRegion::Center;
+    ExtendMode mode = ExtendMode::Stretch;
+    ResizeQuality quality = ResizeQuality::Best; // fit to requested_w x requested_h
+};
+
+struct ExtendResult
+{
+    cv::Mat image;
+    int whiteThr = -1;
+    bool extended = false; // false when the car region was centre-cropped
+};
+
+// Mean BT.601 luma of each sample stripe, read straight from the BGR rows
+// in one pass (no grey copies), less a small cushion, clamped to 180-250.
+int centerSampleThreshold(const cv::Mat &img, int stripeH = 20, int stripeW = 40,
+                          SampleRegion region = SampleRegion::Center);
+bool findForegroundBounds(const cv::Mat &img, int &top, int &bot, int whiteThr);
+cv::Mat makeStrip(const cv::Mat &src, int newH, int W);
+
+bool extendCanvas(const cv::Mat &img, const ExtendParams &params, ExtendResult &result,
+                  std::ostream &log, std::string &err, Metrics *metrics = nullptr);
+
+// Opens a fresh stream over the input, from the first row.
+typedef std::function<std::unique_ptr<RowSource>(std::string &err)> RowSourceFactory;
+
+// Streaming extendCanvas: one pass collects the threshold samples and
+// per-row minima, a second pass composes the output, so only the result
+// is ever held in full. Resampling is area/linear rather than Lanczos.
+bool extendCanvasStream(const RowSourceFactory &open, const ExtendParams &params,
+                        ExtendResult &result, std::ostream &log, std::string &err,
+                        Metrics *metrics = nullptr);
+
+//---------------------------------------------------------------------
+// image_cropper
+struct CropParams
+{
+    int cropX = 0, cropY = 0, cropWidth = 0, cropHeight = 0; // 0 → full size
+    int outputWidth = 1080, outputHeight = 1920;              // 9:16 vertical
+    double scale = 1.0;
+    int previewWidth = 0, previewHeight = 0; // >0: crop values are in preview pixels
+    ResizeQuality quality = ResizeQuality::Best;
+};
+
+// Resolves params against an inW x inH input (preview scaling, defaults,
+// bounds): crop is the source rectangle, placed where it lands in the
+// output. cropAndFit calls this itself; callers use it to plan I/O first.
+bool cropLayout(int inW, int inH, CropParams &params, cv::Rect &crop, cv::Rect &placed, std::string &err);
+
+// The composition step of cropAndFit: cropped (the crop's pixels, at any
+// resolution) is resampled into placed on a black output canvas.
+void composeCrop(const cv::Mat &cropped, const CropParams &params, const cv::Rect &placed, cv::Mat &output,
+                 Metrics *metrics = nullptr);
+bool cropAndFit(const cv::Mat &input, CropParams &params, cv::Mat &output, std::string &err,
+                Metrics *metrics = nullptr);
+bool cropAndFitStream(RowSource &input, CropParams &params, cv::Mat &output, std::string &err,
+                      Metrics *metrics = nullptr);
+
+//---------------------------------------------------------------------
+// matte_generator
+struct MatteParams
+{
+    int canvasWidth = 1920, canvasHeight = 1080;
+    float paddingPercent = 0;
+    std::string hexColor = "#000000";
+};
+
+// "#rrggbb" or "rrggbb": exactly six hex digits.
+bool isHexColor(const std::string &hex);
+// BGR of a colour isHexColor accepts; black for anything else.
+cv::Scalar hexToScalar(const std::string &hex);
+// canvas keeps its buffer when it already has the matte's size and type,
+// so a caller can pass the same Mat for every job.
+bool createMatte(const cv::Mat &input, const MatteParams &params, cv::Mat &canvas, std::string &err,
+                 Metrics *metrics = nullptr);
+bool createMatteStream(RowSource &input, const MatteParams &params, cv::Mat &canvas, std::string &err,
+                       Metrics *metrics = nullptr);
+
+// Mattes of one input at several canvas sizes (same padding and colour),
+// largest first. Each is resized from the smallest level of a 2x area
+// pyramid that still covers it, so the input is decoded and read once.
+bool createMatteRenditions(const cv::Mat &input, const MatteParams &params,
+                           const std::vector<cv::Size> &canvases, std::vector<cv::Mat> &out,
+                           std::string &err);
+bool createMatteRenditionsStream(RowSource &input, const MatteParams &params,
+                                 const std::vector<cv::Size> &canvases, std::vector<cv::Mat> &out,
+                                 std::string &err);
+
+} // namespace canvasops
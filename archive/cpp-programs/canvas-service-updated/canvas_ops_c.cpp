@@ -0,0 +1,355 @@
+// canvas_ops_c.cpp
+// The C interface of libcanvasops (see canvas_ops_c.h): argument
+// translation onto canvas_cli and canvas_ops, with no image logic of its own.
+#include "canvas_ops_c.h"
+#include "canvas_cli.hpp"
+#include "canvas_ops.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace cv;
+using namespace canvasops;
+
+namespace
+{
+
+void setError(char *err, size_t errSize, const std::string &msg)
+{
+    if (!err || errSize == 0)
+        return;
+    size_t n = std::min(msg.size(), errSize - 1);
+    memcpy(err, msg.data(), n);
+    err[n] = '\0';
+}
+
+// A header over the caller's pixels; nothing is copied.
+bool wrapImage(const canvas_image *image, Mat &mat)
+{
+    if (!image || !image->data || image->width <= 0 || image->height <= 0)
+        return false;
+    mat = Mat(image->height, image->width, CV_8UC3, image->data,
+              image->stride ? image->stride : static_cast<size_t>(image->width) * 3);
+    return true;
+}
+
+// Hands mat's buffer to the caller, kept alive by a Mat the image owns.
+void exportImage(const Mat &mat, canvas_image *out)
+{
+    Mat *owner = new Mat(mat);
+    out->data = owner->data;
+    out->width = owner->cols;
+    out->height = owner->rows;
+    out->stride = owner->step;
+    out->owner = owner;
+}
+
+void exportBuffer(std::vector<unsigned char> &&bytes, canvas_buffer *out)
+{
+    auto *owner = new std::vector<unsigned char>(std::move(bytes));
+    out->data = owner->data();
+    out->size = owner->size();
+    out->owner = owner;
+}
+
+ResizeQuality toQuality(int quality)
+{
+    switch (quality)
+    {
+    case CANVAS_QUALITY_FAST:
+        return ResizeQuality::Fast;
+    case CANVAS_QUALITY_BALANCED:
+        return ResizeQuality::Balanced;
+    default:
+        return ResizeQuality::Best;
+    }
+}
+
+SampleRegion toRegion(int region)
+{
+    switch (region)
+    {
+    case CANVAS_SAMPLE_CORNERS:
+        return SampleRegion::Corners;
+    case CANVAS_SAMPLE_ALL:
+        return SampleRegion::All;
+    default:
+        return SampleRegion::Center;
+    }
+}
+
+} // namespace
+
+extern "C"
+{
+
+int canvas_ops_abi_version(void)
+{
+    return CANVAS_OPS_ABI_VERSION;
+}
+
+void canvas_set_threads(int threads)
+{
+    setNumThreads(threads > 0 ? threads : -1);
+    setResampleThreads(static_cast<unsigned>(std::max(0, threads)));
+}
+
+void canvas_extend_params_init(canvas_extend_params *params)
+{
+    ExtendParams d;
+    params->desired_height = d.desiredH;
+    params->pad_pct = d.padPct;
+    params->white_threshold = d.whiteThr;
+    params->requested_width = d.requestedW;
+    params->requested_height = d.requestedH;
+    params->sample_region = CANVAS_SAMPLE_CENTER;
+    params->mode = CANVAS_EXTEND_STRETCH;
+    params->quality = CANVAS_QUALITY_BEST;
+}
+
+void canvas_crop_params_init(canvas_crop_params *params)
+{
+    CropParams d;
+    params->crop_x = d.cropX;
+    params->crop_y = d.cropY;
+    params->crop_width = d.cropWidth;
+    params->crop_height = d.cropHeight;
+    params->output_width = d.outputWidth;
+    params->output_height = d.outputHeight;
+    params->scale = d.scale;
+    params->preview_width = d.previewWidth;
+    params->preview_height = d.previewHeight;
+    params->quality = CANVAS_QUALITY_BEST;
+}
+
+void canvas_matte_params_init(canvas_matte_params *params)
+{
+    MatteParams d;
+    params->canvas_width = d.canvasWidth;
+    params->canvas_height = d.canvasHeight;
+    params->padding_percent = d.paddingPercent;
+    params->color = "#000000";
+}
+
+int canvas_run(const char *tool, const char *const *args, int nargs, const unsigned char *input,
+               size_t input_size, canvas_buffer *output, canvas_buffer *log)
+{
+    canvascli::ToolRunner run = nullptr;
+    std::string name = tool ? tool : "";
+    if (name == "extend")
+        run = canvascli::runExtendCanvas;
+    else if (name == "crop")
+        run = canvascli::runImageCropper;
+    else if (name == "matte")
+        run = canvascli::runMatteGenerator;
+    else if (name == "pipeline")
+        run = canvascli::runCanvasPipeline;
+    else if (name == "probe")
+        run = canvascli::runImageProbe;
+
+    std::ostringstream out, err;
+    std::vector<unsigned char> in(input, input + (input ? input_size : 0)), encoded;
+    int rc = 1;
+    if (!run)
+        err << "Error: Unknown tool '" << name << "'" << std::endl;
+    else
+    {
+        std::vector<std::string> argv = {"canvas_" + name};
+        for (int i = 0; i < nargs; ++i)
+            argv.push_back(args[i]);
+        canvascli::JobIO io;
+        io.input = &in;
+        io.output = &encoded;
+        try
+        {
+            rc = run(argv, out, err, &io);
+        }
+        catch (const std::exception &e)
+        {
+            err << "Error: " << e.what() << std::endl;
+            rc = 1;
+        }
+    }
+
+    if (output)
+        exportBuffer(std::move(encoded), output);
+    if (log)
+    {
+        std::string text = rc == 0 ? out.str() : err.str();
+        exportBuffer(std::vector<unsigned char>(text.begin(), text.end()), log);
+    }
+    return rc;
+}
+
+int canvas_center_sample_threshold(const canvas_image *image, int stripe_h, int stripe_w, int sample_region)
+{
+    Mat img;
+    if (!wrapImage(image, img))
+        return -1;
+    return centerSampleThreshold(img, stripe_h, stripe_w, toRegion(sample_region));
+}
+
+int canvas_find_foreground_bounds(const canvas_image *image, int white_threshold, int *top, int *bottom)
+{
+    Mat img;
+    int t, b;
+    if (!wrapImage(image, img) || !findForegroundBounds(img, t, b, white_threshold))
+        return 1;
+    *top = t;
+    *bottom = b;
+    return 0;
+}
+
+int canvas_extend(const canvas_image *image, const canvas_extend_params *params, canvas_image *out, char *err,
+                  size_t err_size)
+{
+    Mat img;
+    if (!wrapImage(image, img))
+    {
+        setError(err, err_size, "Error: Empty input image.");
+        return 1;
+    }
+    ExtendParams p;
+    p.desiredH = params->desired_height;
+    p.padPct = params->pad_pct;
+    p.whiteThr = params->white_threshold;
+    p.requestedW = params->requested_width;
+    p.requestedH = params->requested_height;
+    p.sample = toRegion(params->sample_region);
+    p.mode = params->mode == CANVAS_EXTEND_MODEL ? ExtendMode::Model : ExtendMode::Stretch;
+    p.quality = toQuality(params->quality);
+    if (p.desiredH <= 0)
+    {
+        setError(err, err_size, "Error: desired_height must be positive.");
+        return 1;
+    }
+
+    try
+    {
+        std::ostringstream log;
+        std::string msg;
+        ExtendResult result;
+        if (!extendCanvas(img, p, result, log, msg))
+        {
+            setError(err, err_size, msg);
+            return 1;
+        }
+        // A centre crop is a view of the caller's pixels; the result must
+        // not depend on them staying alive
+        exportImage(result.image.datastart == img.datastart ? result.image.clone() : result.image, out);
+        return 0;
+    }
+    catch (const std::exception &e)
+    {
+        setError(err, err_size, e.what());
+        return 1;
+    }
+}
+
+int canvas_crop_and_fit(const canvas_image *image, const canvas_crop_params *params, canvas_image *out, char *err,
+                        size_t err_size)
+{
+    Mat img;
+    if (!wrapImage(image, img))
+    {
+        setError(err, err_size, "Error: Empty input image.");
+        return 1;
+    }
+    CropParams p;
+    p.cropX = params->crop_x;
+    p.cropY = params->crop_y;
+    p.cropWidth = params->crop_width;
+    p.cropHeight = params->crop_height;
+    p.outputWidth = params->output_width;
+    p.outputHeight = params->output_height;
+    p.scale = params->scale;
+    p.previewWidth = params->preview_width;
+    p.previewHeight = params->preview_height;
+    p.quality = toQuality(params->quality);
+    if (p.outputWidth <= 0 || p.outputHeight <= 0 || p.scale <= 0)
+    {
+        setError(err, err_size, "Error: Output dimensions and scale must be positive.");
+        return 1;
+    }
+
+    try
+    {
+        std::string msg;
+        Mat output;
+        if (!cropAndFit(img, p, output, msg))
+        {
+            setError(err, err_size, msg);
+            return 1;
+        }
+        exportImage(output, out);
+        return 0;
+    }
+    catch (const std::exception &e)
+    {
+        setError(err, err_size, e.what());
+        return 1;
+    }
+}
+
+int canvas_create_matte(const canvas_image *image, const canvas_matte_params *params, canvas_image *out,
+                        char *err, size_t err_size)
+{
+    Mat img;
+    if (!wrapImage(image, img))
+    {
+        setError(err, err_size, "Error: Empty input image.");
+        return 1;
+    }
+    MatteParams p;
+    p.canvasWidth = params->canvas_width;
+    p.canvasHeight = params->canvas_height;
+    p.paddingPercent = params->padding_percent;
+    if (params->color)
+        p.hexColor = params->color;
+    if (!isHexColor(p.hexColor))
+    {
+        setError(err, err_size, "Error: color must be six hex digits (#rrggbb).");
+        return 1;
+    }
+
+    try
+    {
+        std::string msg;
+        Mat canvas;
+        if (!createMatte(img, p, canvas, msg))
+        {
+            setError(err, err_size, msg);
+            return 1;
+        }
+        exportImage(canvas, out);
+        return 0;
+    }
+    catch (const std::exception &e)
+    {
+        setError(err, err_size, e.what());
+        return 1;
+    }
+}
+
+void canvas_image_free(canvas_image *image)
+{
+    if (!image)
+        return;
+    delete static_cast<Mat *>(image->owner);
+    *image = canvas_image();
+}
+
+void canvas_buffer_free(canvas_buffer *buffer)
+{
+    if (!buffer)
+        return;
+    delete static_cast<std::vector<unsigned char> *>(buffer->owner);
+    *buffer = canvas_buffer();
+}
+
+} // extern "C"
@@ -0,0 +1,142 @@
+/* canvas_ops_c.h
+ * C interface to the canvas operations, exported by libcanvasops.so for
+ * hosts that cannot use the C++ API (the Node addon, ctypes, other
+ * languages). Only these functions are exported; structs are only ever
+ * extended at the end, and canvas_ops_abi_version() changes when any
+ * layout or meaning changes.
+ *
+ * Two levels:
+ *   - canvas_run() runs a whole tool job on encoded bytes, with exactly the
+ *     arguments the standalone tool (or canvas_worker) takes, "-" for the
+ *     input and output paths;
+ *   - the image functions work on 8-bit BGR pixels the caller owns.
+ *
+ * Functions returning int give 0 on success; on failure err (when not
+ * NULL) receives a NUL-terminated message, truncated to err_size.
+ * Results the library allocates are released with canvas_image_free() or
+ * canvas_buffer_free(). Every function may be called from any thread.
+ *
+ * Build:
+ *   g++ -std=c++17 -O2 -Wall -pthread -fPIC -shared -fvisibility=hidden -DCANVAS_OPS_BUILD -o libcanvasops.so canvas_ops_c.cpp canvas_cli.cpp canvas_ops.cpp pipeline.cpp row_stream.cpp jpeg_io.cpp image_probe.cpp mat_pool.cpp resample.cpp `pkg-config --cflags --libs opencv4` -ljpeg
+ */
+#ifndef CANVAS_OPS_C_H
+#define CANVAS_OPS_C_H
+
+#include <stddef.h>
+
+#if defined(CANVAS_OPS_BUILD)
+#define CANVAS_API __attribute__((visibility("default")))
+#else
+#define CANVAS_API
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define CANVAS_OPS_ABI_VERSION 1
+
+/* 8-bit, 3-channel BGR pixels; stride is the byte distance between rows. */
+typedef struct canvas_image
+{
+    unsigned char *data;
+    int width;
+    int height;
+    size_t stride;
+    void *owner; /* non-NULL when the library allocated data */
+} canvas_image;
+
+typedef struct canvas_buffer
+{
+    unsigned char *data;
+    size_t size;
+    void *owner;
+} canvas_buffer;
+
+enum canvas_sample_region
+{
+    CANVAS_SAMPLE_CENTER = 0,
+    CANVAS_SAMPLE_CORNERS = 1,
+    CANVAS_SAMPLE_ALL = 2
+};
+
+enum canvas_extend_mode
+{
+    CANVAS_EXTEND_STRETCH = 0,
+    CANVAS_EXTEND_MODEL = 1
+};
+
+enum canvas_resize_quality
+{
+    CANVAS_QUALITY_FAST = 0,
+    CANVAS_QUALITY_BALANCED = 1,
+    CANVAS_QUALITY_BEST = 2
+};
+
+typedef struct canvas_extend_params
+{
+    int desired_height;
+    double pad_pct;
+    int white_threshold; /* -1: sampled from the background */
+    int requested_width; /* both > 0: fitted onto a white canvas of this size */
+    int requested_height;
+    int sample_region; /* enum canvas_sample_region */
+    int mode;          /* enum canvas_extend_mode */
+    int quality;       /* enum canvas_resize_quality */
+} canvas_extend_params;
+
+typedef struct canvas_crop_params
+{
+    int crop_x, crop_y, crop_width, crop_height; /* width/height 0: to the edge */
+    int output_width, output_height;
+    double scale;
+    int preview_width, preview_height; /* > 0: crop values are in preview pixels */
+    int quality;                       /* enum canvas_resize_quality */
+} canvas_crop_params;
+
+typedef struct canvas_matte_params
+{
+    int canvas_width, canvas_height;
+    float padding_percent;
+    const char *color; /* "#rrggbb" */
+} canvas_matte_params;
+
+CANVAS_API int canvas_ops_abi_version(void);
+
+/* CPU threads each job may use (OpenCV's and the resampler's), for hosts
+ * running several jobs at once; 0 restores one per core. */
+CANVAS_API void canvas_set_threads(int threads);
+
+/* The tools' defaults. */
+CANVAS_API void canvas_extend_params_init(canvas_extend_params *params);
+CANVAS_API void canvas_crop_params_init(canvas_crop_params *params);
+CANVAS_API void canvas_matte_params_init(canvas_matte_params *params);
+
+/* tool is "extend", "crop", "matte", "pipeline" or "probe". output gets
+ * the encoded result, log the tool's stdout (on success) or stderr; either
+ * may be NULL. Returns the tool's exit code. */
+CANVAS_API int canvas_run(const char *tool, const char *const *args, int nargs, const unsigned char *input,
+                          size_t input_size, canvas_buffer *output, canvas_buffer *log);
+
+CANVAS_API int canvas_center_sample_threshold(const canvas_image *image, int stripe_h, int stripe_w,
+                                              int sample_region);
+/* 0 and the first and last foreground rows, or non-zero when none is found. */
+CANVAS_API int canvas_find_foreground_bounds(const canvas_image *image, int white_threshold, int *top,
+                                             int *bottom);
+
+CANVAS_API int canvas_extend(const canvas_image *image, const canvas_extend_params *params, canvas_image *out,
+                             char *err, size_t err_size);
+CANVAS_API int canvas_crop_and_fit(const canvas_image *image, const canvas_crop_params *params,
+                                   canvas_image *out, char *err, size_t err_size);
+CANVAS_API int canvas_create_matte(const canvas_image *image, const canvas_matte_params *params,
+                                   canvas_image *out, char *err, size_t err_size);
+
+CANVAS_API void canvas_image_free(canvas_image *image);
+CANVAS_API void canvas_buffer_free(canvas_buffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CANVAS_OPS_C_H */
@@ -0,0 +1,26 @@
+// canvas_pipeline.cpp
+// Runs a chain of crop, extend, matte and resize steps on one decode and
+// encodes the result once, instead of one tool run (and re-encode) per step.
+//
+// Build:
+//   g++ -std=c++17 -O2 -Wall -pthread -o canvas_pipeline canvas_pipeline.cpp canvas_cli.cpp canvas_ops.cpp pipeline.cpp row_stream.cpp jpeg_io.cpp image_probe.cpp mat_pool.cpp resample.cpp `pkg-config --cflags --libs opencv4` -ljpeg
+// Usage:
+//   ./canvas_pipeline --input <path> --output <path> --step "<op> key=value ..." [--step ...] [--metrics json] [encode options]
+//      steps run in the order given; keys are those of pipeline.hpp:
+//        crop   x= y= width= height= [preview-width= preview-height=]
+//               [output-width= output-height= scale= quality=]
+//        extend height= [pad= threshold= requested-width= requested-height= sample= mode= quality=]
+//        matte  width= height= [padding= color=]
+//        resize [width=] [height=] [quality=]
+//      commas may stand for the spaces ("crop,x=0,y=40,width=800,height=600")
+//      e.g. --step "crop x=0 y=200 width=3000 height=2000" --step "extend height=2400"
+//           --step "matte width=1920 height=1080 color=#ffffff"
+//      encode options as for extend_canvas
+#include "canvas_cli.hpp"
+
+#include <iostream>
+
+int main(int argc, char **argv)
+{
+    return canvascli::runStandalone(canvascli::runCanvasPipeline, argc, argv);
+}
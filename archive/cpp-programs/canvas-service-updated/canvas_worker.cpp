@@ -0,0 +1,608 @@
+// canvas_worker.cpp
+// Long-lived worker that runs extend_canvas, image_cropper, matte_generator
+// and canvas_pipeline jobs in-process so OpenCV and the codecs stay loaded
+// between requests.
+//
+// Build:
+//   g++ -std=c++17 -O2 -Wall -pthread -o canvas_worker canvas_worker.cpp canvas_cli.cpp canvas_ops.cpp pipeline.cpp row_stream.cpp jpeg_io.cpp result_cache.cpp sha256.cpp image_probe.cpp mat_pool.cpp resample.cpp `pkg-config --cflags --libs opencv4` -ljpeg
+// Usage:
+//   ./canvas_worker [options]                  serve framed requests on stdin/stdout
+//   ./canvas_worker --socket <path> [options]  serve framed requests on a Unix socket
+//   options:
+//     --cache-mb <n>      in-memory result cache budget (default 256, 0 disables)
+//     --cache-dir <path>  also keep results as files in <path>, shared between workers
+//     --decoded-mb <n>    budget for decoded source images (default 512, 0 disables)
+//     --source-mb <n>     budget for the encoded bytes of sources whose job did not
+//                         decode them in full, e.g. region-decoded JPEG crops, or
+//                         of every source with --decoded-mb 0 (default 128, 0 disables)
+//     --pool-mb <n>       idle Mat buffers kept for reuse between jobs (default 256, 0 disables)
+//     --threads <n>       CPU threads this worker may use (default: one per core)
+//     --jobs <n>          image jobs run at once (default --threads); each job's
+//                         OpenCV and resampler threads are --threads / --jobs
+//     --memory-mb <n>     budget for the estimated peak bytes of running jobs
+//                         (default 0 = unlimited); jobs wait until theirs fits
+//     --queue <n>         jobs waiting beyond that (default 64); more are refused
+//                         with the message "busy"
+//     --max-input-mb <n>  largest request payload (default 512); a larger one is
+//                         read past and refused
+//
+// Protocol (header line of whitespace-separated tokens, then raw bytes):
+//   request:  <id> <op> <nbytes> [args...]\n<nbytes of encoded input>
+//             op is extend | crop | matte | pipeline | probe | ping | stats; args are
+//             exactly the arguments the standalone tool takes (without argv[0]),
+//             optionally preceded by "--source <key>", "--priority
+//             interactive|batch" (default interactive; queued interactive
+//             jobs start before any batch job) and "--chunked" (below). Jobs on one connection may
+//             answer out of order; match responses by id. Pipeline --step
+//             values use their comma spelling ("matte,width=1920,height=1080").
+//             A path of "-" reads the input from the request payload or
+//             writes the encoded result to the response payload.
+//   response: <id> <ok|err> <msgbytes> <nbytes>\n<message><encoded output>
+//             ok carries the tool's stdout, err carries its stderr. The
+//             stdout of an in-memory job has an "Output type: <mime>" line
+//             for the encoded output (--format, default image/jpeg).
+//   chunk:    <id> chunk <msgbytes> <nbytes>\n<message><bytes>
+//             sent before the response of a request with a leading
+//             "--chunked": pieces of the encoded output as the encoder
+//             writes them (JPEG; other formats in one piece), the first
+//             with an "Output type: <mime>" message. The response then
+//             carries only the output they did not; the result is the
+//             chunks and that payload in order. An err response after
+//             chunks means the partial output is void.
+//
+// In-memory jobs are answered from the result cache when the same input
+// bytes were already processed with equivalent parameters.
+//
+// With --metrics json the tool's stdout ends in a "METRICS {...}" line of
+// stage timings, sizes and peak Mat bytes (see metrics.hpp); cache hits
+// answer with a METRICS line marked "cached": true.
+//
+// "--source <key>" names the input (the server uses a digest of URL + ETag).
+// With a payload, the full decode of the input is kept under that key (or
+// the encoded bytes, when the job never decoded it in full or --decoded-mb
+// is 0; --source-mb 0 keeps no bytes); with
+// nbytes = 0 the kept input is used instead, or the job fails with the
+// message "source-miss" and the client resends it with the payload.
+#include "canvas_cli.hpp"
+#include "image_probe.hpp"
+#include "job_scheduler.hpp"
+#include "mat_pool.hpp"
+#include "metrics.hpp"
+#include "resample.hpp"
+#include "result_cache.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static std::unique_ptr<ResultCache> resultCache;       // null when disabled
+static std::unique_ptr<LruCache<cv::Mat>> decodedCache; // null when disabled
+static std::unique_ptr<LruCache<std::vector<uchar>>> sourceBytes; // null when disabled
+static PoolMatAllocator *matPool = nullptr;                // never freed: Mats outlive main
+static JobScheduler *scheduler = nullptr;                  // never freed: detached connections use it
+static const char *kSourceMiss = "source-miss";
+static const char *kBusy = "busy";
+static size_t maxInputBytes = static_cast<size_t>(512) << 20;
+
+//---------------------------------------------------------------------
+static std::vector<std::string> splitTokens(const std::string &line)
+{
+    std::vector<std::string> tokens;
+    std::istringstream in(line);
+    std::string tok;
+    while (in >> tok)
+        tokens.push_back(tok);
+    return tokens;
+}
+
+static int dispatch(const std::string &op, std::vector<std::string> args,
+                    std::ostream &out, std::ostream &err, canvascli::JobIO *io)
+{
+    if (op == "ping")
+    {
+        out << "pong";
+        return 0;
+    }
+    if (op == "stats")
+    {
+        out << (resultCache ? resultCache->stats() : "cache=off") << " "
+            << (matPool ? matPool->stats() : "pool=off") << " " << scheduler->stats();
+        return 0;
+    }
+    if (op == "extend")
+    {
+        args.insert(args.begin(), "extend_canvas");
+        return canvascli::runExtendCanvas(args, out, err, io);
+    }
+    if (op == "crop")
+    {
+        args.insert(args.begin(), "image_cropper");
+        return canvascli::runImageCropper(args, out, err, io);
+    }
+    if (op == "matte")
+    {
+        args.insert(args.begin(), "matte_generator");
+        return canvascli::runMatteGenerator(args, out, err, io);
+    }
+    if (op == "pipeline")
+    {
+        args.insert(args.begin(), "canvas_pipeline");
+        return canvascli::runCanvasPipeline(args, out, err, io);
+    }
+    if (op == "probe")
+    {
+        args.insert(args.begin(), "probe");
+        return canvascli::runImageProbe(args, out, err, io);
+    }
+    err << "Unknown op: " << op;
+    return 1;
+}
+
+// Normalised cache key for the job, or "" when it must not be cached.
+static std::string cacheKey(const std::string &op, std::vector<std::string> args,
+                            const std::vector<uchar> &input, const std::string &source)
+{
+    if (!resultCache || (input.empty() && source.empty()))
+        return "";
+    std::string params;
+    args.insert(args.begin(), op);
+    if (op == "extend")
+        params = canvascli::extendParamKey(args);
+    else if (op == "crop")
+        params = canvascli::cropParamKey(args);
+    else if (op == "matte")
+        params = canvascli::matteParamKey(args);
+    else if (op == "pipeline")
+        params = canvascli::pipelineParamKey(args);
+    if (params.empty())
+        return "";
+    return source.empty() ? ResultCache::makeKey(input, params) : ResultCache::makeSourceKey(source, params);
+}
+
+// Results are cached without their METRICS trailer (--metrics json): a hit
+// that asks for metrics gets a fresh one marked "cached" instead of the
+// timings of the run that produced it.
+static const std::string kMetricsPrefix = "METRICS ";
+
+static std::string withoutMetrics(std::string message)
+{
+    for (size_t at = message.find(kMetricsPrefix); at != std::string::npos; at = message.find(kMetricsPrefix, at + 1))
+    {
+        if (at == 0 || message[at - 1] == '\n')
+        {
+            size_t end = message.find('\n', at);
+            message.erase(at, end == std::string::npos ? std::string::npos : end - at + 1);
+            break;
+        }
+    }
+    return message;
+}
+
+static bool wantsMetrics(const std::vector<std::string> &args)
+{
+    for (size_t i = 0; i + 1 < args.size(); ++i)
+    {
+        if (args[i] == "--metrics" && args[i + 1] == "json")
+            return true;
+    }
+    return false;
+}
+
+static void writeFrame(FILE *out, const std::string &id, const char *status, const std::string &message,
+                       const uchar *payload, size_t len)
+{
+    fprintf(out, "%s %s %zu %zu\n", id.c_str(), status, message.size(), len);
+    fwrite(message.data(), 1, message.size(), out);
+    fwrite(payload, 1, len, out);
+    fflush(out);
+}
+
+// One client. Jobs finish out of order, so frames are written under a
+// lock, and the connection is kept until its last job has answered.
+struct Connection
+{
+    FILE *out;
+    std::mutex writeMutex;
+    std::mutex mutex;
+    std::condition_variable idle;
+    unsigned active = 0;
+
+    // skip: leading payload bytes already sent as chunks
+    void reply(const std::string &id, bool ok, const std::string &message,
+               const std::vector<uchar> &payload = std::vector<uchar>(), size_t skip = 0)
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        skip = std::min(skip, payload.size());
+        writeFrame(out, id, ok ? "ok" : "err", message, payload.data() + skip, payload.size() - skip);
+    }
+
+    void chunk(const std::string &id, const std::string &message, const uchar *data, size_t len)
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        writeFrame(out, id, "chunk", message, data, len);
+    }
+};
+
+struct Request
+{
+    std::string id, op, source, key;
+    bool chunked = false;
+    std::vector<std::string> args;
+    std::vector<uchar> input;
+    LruCache<cv::Mat>::Ptr kept;                   // the source's kept decode, for nbytes = 0
+    LruCache<std::vector<uchar>>::Ptr keptBytes; // or its kept encoded bytes
+};
+
+// Peak bytes a job is expected to hold: the decoded input, from the image
+// header or the kept decode, times a per-op factor for its outputs and
+// intermediates. Rough, but it only has to weigh jobs against the budget.
+static size_t estimateCost(const Request &req)
+{
+    size_t pixels;
+    ImageInfo info;
+    const std::vector<uchar> &input = req.keptBytes ? *req.keptBytes : req.input;
+    if (req.kept)
+        pixels = req.kept->total();
+    else if (probeImage(input.data(), input.size(), info))
+        pixels = static_cast<size_t>(info.width) * info.height;
+    else
+        pixels = input.size() * 4; // unknown format: ~2 bits per pixel
+
+    bool stream = std::find(req.args.begin(), req.args.end(), "--stream") != req.args.end();
+    size_t factor = req.op == "extend" ? 3 : 2;
+    if (req.op == "pipeline")
+        factor = 1 + std::count(req.args.begin(), req.args.end(), "--step");
+    if (stream)
+        factor = 1; // only the output is held in full
+    else if (req.kept)
+        factor -= 1; // the input is already decoded and accounted for
+    return pixels * 3 * std::max<size_t>(1, factor);
+}
+
+// Runs one job and answers it.
+static void runRequest(Request &req, Connection &conn)
+{
+    std::vector<uchar> output;
+    canvascli::JobIO io;
+    io.input = req.keptBytes ? req.keptBytes.get() : &req.input;
+    io.output = &output;
+
+    // Reuse or keep the decoded source
+    cv::Mat fresh;
+    if (req.kept)
+        io.decoded = req.kept.get();
+    else if (!req.source.empty() && decodedCache)
+        io.keepDecoded = &fresh;
+
+    // --chunked: the output leaves while it is encoded, and the response
+    // carries only what the chunks did not
+    size_t sent = 0;
+    if (req.chunked)
+    {
+        io.onOutputChunk = [&](const char *mime, const unsigned char *data, size_t len)
+        {
+            conn.chunk(req.id, sent == 0 ? std::string("Output type: ") + mime + "\n" : std::string(), data, len);
+            sent += len;
+        };
+    }
+
+    std::ostringstream jobOut, jobErr;
+    int rc;
+    try
+    {
+        rc = dispatch(req.op, req.args, jobOut, jobErr, &io);
+    }
+    catch (const std::exception &e)
+    {
+        jobErr << "Error: " << e.what();
+        rc = 1;
+    }
+    // Only a job that brought its own payload keeps it: one served from the
+    // kept bytes has none, and must not replace them with an empty buffer
+    if (rc == 0 && !fresh.empty())
+        decodedCache->put(req.source, std::make_shared<const cv::Mat>(fresh));
+    else if (rc == 0 && sourceBytes && !req.source.empty() && !req.input.empty())
+        sourceBytes->put(req.source, std::make_shared<const std::vector<uchar>>(std::move(req.input)));
+
+    if (rc == 0 && !req.key.empty())
+    {
+        std::shared_ptr<CachedResult> result = std::make_shared<CachedResult>();
+        result->message = withoutMetrics(jobOut.str());
+        result->payload = std::move(output);
+        conn.reply(req.id, true, jobOut.str(), result->payload, sent);
+        resultCache->store(req.key, std::move(result));
+    }
+    else if (rc == 0)
+        conn.reply(req.id, true, jobOut.str(), output, sent);
+    else
+        conn.reply(req.id, false, jobErr.str());
+}
+
+// Read past a payload that is not kept; false if the stream ends first.
+static bool skipBytes(FILE *in, size_t nbytes)
+{
+    char buf[65536];
+    while (nbytes > 0)
+    {
+        size_t got = fread(buf, 1, std::min(nbytes, sizeof(buf)), in);
+        if (got == 0)
+            return false;
+        nbytes -= got;
+    }
+    return true;
+}
+
+// Serve requests until the peer closes its end. Cache hits and the cheap
+// ops are answered here; image jobs go through the scheduler.
+static void serve(FILE *in, FILE *out)
+{
+    Connection conn;
+    conn.out = out;
+    char *line = nullptr;
+    size_t cap = 0;
+    ssize_t n;
+    while ((n = getline(&line, &cap, in)) > 0)
+    {
+        std::vector<std::string> tokens = splitTokens(std::string(line, n));
+        if (tokens.empty())
+            continue;
+        char *end = nullptr;
+        size_t nbytes = tokens.size() >= 3 ? strtoull(tokens[2].c_str(), &end, 10) : 0;
+        if (tokens.size() < 3 || *end != '\0')
+        {
+            // Without a payload length the stream cannot be resynchronised.
+            conn.reply(tokens[0], false, "Malformed request: expected <id> <op> <nbytes>");
+            break;
+        }
+
+        std::shared_ptr<Request> req = std::make_shared<Request>();
+        req->id = tokens[0];
+        req->op = tokens[1];
+        req->args.assign(tokens.begin() + 3, tokens.end());
+        JobScheduler::Lane lane = JobScheduler::Lane::Interactive;
+        std::vector<std::string> &args = req->args;
+        for (;;)
+        {
+            if (!args.empty() && args[0] == "--chunked")
+            {
+                req->chunked = true;
+                args.erase(args.begin());
+                continue;
+            }
+            if (args.size() < 2 || (args[0] != "--source" && args[0] != "--priority"))
+                break;
+            if (args[0] == "--source")
+                req->source = args[1];
+            else if (args[1] == "batch")
+                lane = JobScheduler::Lane::Batch;
+            args.erase(args.begin(), args.begin() + 2);
+        }
+
+        // A length past the cap, or one memory cannot hold, fails this
+        // request only: its payload is read past to keep the stream in step.
+        bool allocated = nbytes <= maxInputBytes;
+        if (allocated)
+        {
+            try
+            {
+                req->input.resize(nbytes);
+            }
+            catch (const std::bad_alloc &)
+            {
+                allocated = false;
+            }
+        }
+        if (!allocated)
+        {
+            if (!skipBytes(in, nbytes))
+                break;
+            std::string size = "Error: Input of " + std::to_string(nbytes) + " bytes";
+            conn.reply(req->id, false,
+                       nbytes > maxInputBytes
+                           ? size + " exceeds the " + std::to_string(maxInputBytes >> 20) + " MB limit (--max-input-mb)"
+                           : size + " does not fit in memory");
+            continue;
+        }
+        if (nbytes > 0 && fread(req->input.data(), 1, nbytes, in) != nbytes)
+            break;
+
+        req->key = cacheKey(req->op, args, req->input, req->source);
+        if (!req->key.empty())
+        {
+            Metrics lookup(req->op);
+            if (std::shared_ptr<const CachedResult> hit = resultCache->find(req->key))
+            {
+                std::string message = hit->message;
+                if (wantsMetrics(args))
+                {
+                    lookup.set("cached", "true");
+                    message += kMetricsPrefix + lookup.json() + "\n";
+                }
+                conn.reply(req->id, true, message, hit->payload);
+                continue;
+            }
+        }
+
+        if (!req->source.empty() && req->input.empty())
+        {
+            req->kept = decodedCache ? decodedCache->get(req->source) : nullptr;
+            if (!req->kept && sourceBytes)
+                req->keptBytes = sourceBytes->get(req->source);
+            if (!req->kept && !req->keptBytes)
+            {
+                conn.reply(req->id, false, kSourceMiss);
+                continue;
+            }
+        }
+
+        if (req->op == "ping" || req->op == "stats" || req->op == "probe")
+        {
+            runRequest(*req, conn);
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(conn.mutex);
+            ++conn.active;
+        }
+        Connection *c = &conn;
+        bool queued = scheduler->submit(lane, estimateCost(*req), [req, c]()
+                                        {
+                                            runRequest(*req, *c);
+                                            std::lock_guard<std::mutex> lock(c->mutex);
+                                            if (--c->active == 0)
+                                                c->idle.notify_all();
+                                        });
+        if (!queued)
+        {
+            {
+                std::lock_guard<std::mutex> lock(conn.mutex);
+                --conn.active;
+            }
+            conn.reply(req->id, false, kBusy);
+        }
+    }
+    free(line);
+
+    std::unique_lock<std::mutex> lock(conn.mutex);
+    conn.idle.wait(lock, [&]()
+                   { return conn.active == 0; });
+}
+
+// Touch the codecs and resize paths once so the first real job does not
+// pay for lazy initialisation.
+static void warmUp()
+{
+    cv::Mat probe(16, 16, CV_8UC3, cv::Scalar(255, 255, 255));
+    std::vector<uchar> buf;
+    cv::imencode(".jpg", probe, buf);
+    cv::Mat decoded = cv::imdecode(buf, cv::IMREAD_COLOR);
+    cv::Mat resized;
+    cv::resize(decoded, resized, cv::Size(8, 8), 0, 0, cv::INTER_LANCZOS4);
+}
+
+static int serveSocket(const std::string &path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        std::cerr << "Error: Socket path too long: " << path << "\n";
+        return 1;
+    }
+    path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(fd, 16) < 0)
+    {
+        perror("bind/listen");
+        return 1;
+    }
+
+    std::cerr << "canvas_worker listening on " << path << std::endl;
+    for (;;)
+    {
+        int client = accept(fd, nullptr, nullptr);
+        if (client < 0)
+            continue;
+        std::thread([client]()
+                    {
+                        FILE *in = fdopen(client, "rb");
+                        FILE *out = fdopen(dup(client), "wb");
+                        serve(in, out);
+                        fclose(in);
+                        fclose(out);
+                    })
+            .detach();
+    }
+}
+
+//---------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    std::string socketPath, cacheDir;
+    long cacheMb = 256, decodedMb = 512, sourceMb = 128, poolMb = 256;
+    long threads = 0, jobs = 0, memoryMb = 0, queueDepth = 64;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc)
+            socketPath = argv[++i];
+        else if (arg == "--cache-mb" && i + 1 < argc)
+            cacheMb = strtol(argv[++i], nullptr, 10);
+        else if (arg == "--cache-dir" && i + 1 < argc)
+            cacheDir = argv[++i];
+        else if (arg == "--decoded-mb" && i + 1 < argc)
+            decodedMb = strtol(argv[++i], nullptr, 10);
+        else if (arg == "--source-mb" && i + 1 < argc)
+            sourceMb = strtol(argv[++i], nullptr, 10);
+        else if (arg == "--pool-mb" && i + 1 < argc)
+            poolMb = strtol(argv[++i], nullptr, 10);
+        else if (arg == "--threads" && i + 1 < argc)
+            threads = strtol(argv[++i], nullptr, 10);
+        else if (arg == "--jobs" && i + 1 < argc)
+            jobs = strtol(argv[++i], nullptr, 10);
+        else if (arg == "--memory-mb" && i + 1 < argc)
+            memoryMb = strtol(argv[++i], nullptr, 10);
+        else if (arg == "--queue" && i + 1 < argc)
+            queueDepth = strtol(argv[++i], nullptr, 10);
+        else if (arg == "--max-input-mb" && i + 1 < argc)
+            maxInputBytes = static_cast<size_t>(std::max(0L, strtol(argv[++i], nullptr, 10))) << 20;
+    }
+    if (poolMb > 0)
+    {
+        matPool = new PoolMatAllocator(static_cast<size_t>(poolMb) << 20);
+        matPool->install();
+    }
+    if (cacheMb > 0)
+        resultCache.reset(new ResultCache(static_cast<size_t>(cacheMb) << 20, cacheDir));
+    if (decodedMb > 0)
+        decodedCache.reset(new LruCache<cv::Mat>(static_cast<size_t>(decodedMb) << 20, [](const cv::Mat &m)
+                                                 { return m.total() * m.elemSize(); }));
+    if (sourceMb > 0)
+        sourceBytes.reset(new LruCache<std::vector<uchar>>(static_cast<size_t>(sourceMb) << 20, [](const std::vector<uchar> &b)
+                                                           { return b.size(); }));
+
+    // Concurrent jobs share the cores: each gets threads / jobs for OpenCV's
+    // parallel loops and our resampler, so they do not oversubscribe.
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    if (jobs <= 0)
+        jobs = threads;
+    int perJob = static_cast<int>(std::max(1L, threads / jobs));
+    cv::setNumThreads(perJob);
+    setResampleThreads(static_cast<unsigned>(perJob));
+    scheduler = new JobScheduler(static_cast<unsigned>(jobs), static_cast<size_t>(std::max(0L, memoryMb)) << 20,
+                                 static_cast<size_t>(std::max(0L, queueDepth)));
+
+    // A client hanging up mid-response must not take the worker down.
+    signal(SIGPIPE, SIG_IGN);
+    warmUp();
+
+    if (!socketPath.empty())
+        return serveSocket(socketPath);
+
+    serve(stdin, stdout);
+    return 0;
+}
@@ -0,0 +1,165 @@
+// image_probe.cpp
+// Header parsers for the size probe (see image_probe.hpp).
+#include "image_probe.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+static unsigned be16(const unsigned char *p) { return (p[0] << 8) | p[1]; }
+static unsigned be32(const unsigned char *p) { return (be16(p) << 16) | be16(p + 2); }
+static unsigned le16(const unsigned char *p) { return p[0] | (p[1] << 8); }
+static unsigned le24(const unsigned char *p) { return le16(p) | (p[2] << 16); }
+static unsigned le32(const unsigned char *p) { return le24(p) | (unsigned(p[3]) << 24); }
+
+// Orientation tag (0x0112) from IFD0 of an APP1 Exif payload, or 1.
+static int exifOrientation(const unsigned char *p, size_t len)
+{
+    if (len < 14 || memcmp(p, "Exif\0\0", 6) != 0)
+        return 1;
+    const unsigned char *tiff = p + 6;
+    size_t tiffLen = len - 6;
+    bool little = tiff[0] == 'I' && tiff[1] == 'I';
+    if (!little && !(tiff[0] == 'M' && tiff[1] == 'M'))
+        return 1;
+    auto u16 = [&](size_t off)
+    { return little ? le16(tiff + off) : be16(tiff + off); };
+    auto u32 = [&](size_t off)
+    { return little ? le32(tiff + off) : be32(tiff + off); };
+
+    size_t ifd = u32(4);
+    if (ifd + 2 > tiffLen)
+        return 1;
+    unsigned count = u16(ifd);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        size_t entry = ifd + 2 + i * 12;
+        if (entry + 12 > tiffLen)
+            break;
+        if (u16(entry) == 0x0112)
+        {
+            unsigned value = u16(entry + 8);
+            return value >= 1 && value <= 8 ? static_cast<int>(value) : 1;
+        }
+    }
+    return 1;
+}
+
+static bool probeJpeg(const unsigned char *p, size_t len, ImageInfo &info)
+{
+    size_t pos = 2;
+    while (pos + 4 <= len)
+    {
+        if (p[pos] != 0xFF)
+            return false;
+        unsigned char marker = p[pos + 1];
+        if (marker == 0xFF) // fill byte
+        {
+            ++pos;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) // no length
+        {
+            pos += 2;
+            continue;
+        }
+        if (marker == 0xD9 || marker == 0xDA) // EOI / SOS before any frame header
+            return false;
+
+        size_t segLen = be16(p + pos + 2);
+        if (segLen < 2)
+            return false;
+        const unsigned char *seg = p + pos + 4;
+        if (marker == 0xE1 && pos + 2 + segLen <= len)
+            info.orientation = exifOrientation(seg, segLen - 2);
+
+        // SOF0..SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+        bool sof = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (sof)
+        {
+            if (pos + 9 > len)
+                return false;
+            info.height = static_cast<int>(be16(seg + 1));
+            info.width = static_cast<int>(be16(seg + 3));
+            if (info.orientation >= 5) // transposed by the decoder
+                std::swap(info.width, info.height);
+            info.format = "jpeg";
+            return info.width > 0 && info.height > 0;
+        }
+        pos += 2 + segLen;
+    }
+    return false;
+}
+
+static bool probeWebp(const unsigned char *p, size_t len, ImageInfo &info)
+{
+    if (len < 30)
+        return false;
+    const unsigned char *chunk = p + 12;
+    const unsigned char *data = chunk + 8;
+    if (memcmp(chunk, "VP8 ", 4) == 0)
+    {
+        if (data[3] != 0x9d || data[4] != 0x01 || data[5] != 0x2a)
+            return false;
+        info.width = le16(data + 6) & 0x3fff;
+        info.height = le16(data + 8) & 0x3fff;
+    }
+    else if (memcmp(chunk, "VP8L", 4) == 0)
+    {
+        if (data[0] != 0x2f)
+            return false;
+        unsigned bits = le32(data + 1);
+        info.width = (bits & 0x3fff) + 1;
+        info.height = ((bits >> 14) & 0x3fff) + 1;
+    }
+    else if (memcmp(chunk, "VP8X", 4) == 0)
+    {
+        info.width = le24(data + 4) + 1;
+        info.height = le24(data + 7) + 1;
+    }
+    else
+        return false;
+    info.format = "webp";
+    return info.width > 0 && info.height > 0;
+}
+
+bool probeImage(const unsigned char *data, size_t len, ImageInfo &info)
+{
+    info = ImageInfo();
+    if (len >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF)
+        return probeJpeg(data, len, info);
+    if (len >= 24 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0 && memcmp(data + 12, "IHDR", 4) == 0)
+    {
+        info.width = static_cast<int>(be32(data + 16));
+        info.height = static_cast<int>(be32(data + 20));
+        info.format = "png";
+        return info.width > 0 && info.height > 0;
+    }
+    if (len >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0)
+        return probeWebp(data, len, info);
+    return false;
+}
+
+bool probeImageFile(const std::string &path, ImageInfo &info)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    // The frame header normally sits in the first few KB, but large EXIF or
+    // ICC segments can push a JPEG's further out; read on until it is found.
+    std::vector<unsigned char> buf;
+    bool ok = false;
+    for (size_t chunk = 64 * 1024; !ok; chunk *= 4)
+    {
+        size_t have = buf.size();
+        buf.resize(have + chunk);
+        size_t got = fread(buf.data() + have, 1, chunk, f);
+        buf.resize(have + got);
+        ok = probeImage(buf.data(), buf.size(), info);
+        if (got < chunk)
+            break;
+    }
+    fclose(f);
+    return ok;
+}
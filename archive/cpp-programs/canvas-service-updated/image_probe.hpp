@@ -0,0 +1,18 @@
+// image_probe.hpp
+// Image size from the container headers alone (JPEG SOF, PNG IHDR, WebP
+// VP8/VP8L/VP8X), without decoding any pixels.
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+struct ImageInfo
+{
+    int width = 0, height = 0; // as decoded, i.e. after EXIF orientation
+    const char *format = "";   // "jpeg", "png" or "webp"
+    int orientation = 1;       // EXIF orientation (JPEG only), 1 = upright
+};
+
+// False when the format is not recognised or the header is cut short.
+bool probeImage(const unsigned char *data, size_t len, ImageInfo &info);
+bool probeImageFile(const std::string &path, ImageInfo &info);
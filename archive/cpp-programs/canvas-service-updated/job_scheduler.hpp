@@ -0,0 +1,145 @@
+// job_scheduler.hpp
+// canvas_worker's admission control: a fixed number of job threads, a
+// bounded queue in two priority lanes, and a memory budget that jobs
+// reserve their estimated cost against before they start.
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class JobScheduler
+{
+public:
+    // Interactive jobs (previews, user-facing requests) always start before
+    // queued batch jobs.
+    enum class Lane
+    {
+        Interactive,
+        Batch
+    };
+
+    // jobs == 0 → one per hardware thread; memoryBudget == 0 → unlimited.
+    JobScheduler(unsigned jobs, size_t memoryBudget, size_t maxQueued)
+        : memoryBudget_(memoryBudget), maxQueued_(maxQueued)
+    {
+        if (jobs == 0)
+            jobs = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < jobs; ++i)
+            threads_.emplace_back([this]()
+                                  { workerLoop(); });
+    }
+
+    // Runs what is queued, then stops.
+    ~JobScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread &t : threads_)
+            t.join();
+    }
+
+    JobScheduler(const JobScheduler &) = delete;
+    JobScheduler &operator=(const JobScheduler &) = delete;
+
+    size_t jobs() const { return threads_.size(); }
+
+    // Queues fn with its estimated peak bytes; false (fn is dropped) when
+    // the queue is full, so the caller can refuse the job at once instead
+    // of letting latency grow without bound.
+    bool submit(Lane lane, size_t cost, std::function<void()> fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (interactive_.size() + batch_.size() >= maxQueued_)
+            {
+                ++rejected_;
+                return false;
+            }
+            (lane == Lane::Interactive ? interactive_ : batch_).push_back(Task{cost, std::move(fn)});
+        }
+        wake_.notify_all();
+        return true;
+    }
+
+    std::string stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        char buf[160];
+        snprintf(buf, sizeof(buf), "jobs=%u/%zu queued=%zu+%zu reserved=%zuMB/%zuMB rejected=%zu",
+                 running_, threads_.size(), interactive_.size(), batch_.size(), reserved_ >> 20,
+                 memoryBudget_ >> 20, rejected_);
+        return buf;
+    }
+
+private:
+    struct Task
+    {
+        size_t cost = 0;
+        std::function<void()> fn;
+    };
+
+    // A job fits when its cost is within what is left of the budget; one
+    // larger than the whole budget still runs, alone, rather than never.
+    bool fits(const Task &task) const
+    {
+        return memoryBudget_ == 0 || running_ == 0 || reserved_ + task.cost <= memoryBudget_;
+    }
+
+    // The lane whose head may start now. A waiting interactive job holds
+    // back batch jobs even when it is the one that does not fit yet, so a
+    // large preview is not starved by a stream of small regenerations.
+    std::deque<Task> *nextLane()
+    {
+        if (!interactive_.empty())
+            return fits(interactive_.front()) ? &interactive_ : nullptr;
+        if (!batch_.empty() && fits(batch_.front()))
+            return &batch_;
+        return nullptr;
+    }
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                std::deque<Task> *lane = nullptr;
+                wake_.wait(lock, [&]()
+                           { return (lane = nextLane()) != nullptr || (stop_ && interactive_.empty() && batch_.empty()); });
+                if (!lane)
+                    return;
+                task = std::move(lane->front());
+                lane->pop_front();
+                reserved_ += task.cost;
+                ++running_;
+            }
+            task.fn();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                reserved_ -= task.cost;
+                --running_;
+            }
+            wake_.notify_all(); // freed memory may let a waiting job start
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::deque<Task> interactive_, batch_;
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    size_t memoryBudget_, maxQueued_;
+    size_t reserved_ = 0, rejected_ = 0;
+    unsigned running_ = 0;
+    bool stop_ = false;
+};
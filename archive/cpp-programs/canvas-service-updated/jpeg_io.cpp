@@ -0,0 +1,547 @@
+// jpeg_io.cpp
+// libjpeg row decoder and encoder (see jpeg_io.hpp). libjpeg reports errors through a
+// callback that must not return, so every call into it goes through a small
+// helper that sets a jump point first; the helpers hold no C++ objects that
+// a longjmp could skip destructors for.
+#include "jpeg_io.hpp"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+extern "C"
+{
+#include <jpeglib.h>
+}
+
+namespace canvasops
+{
+
+static const int kBandRows = 16;
+
+struct JpegRowSource::Decoder
+{
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr jerr;
+    jmp_buf jump;
+    char message[JMSG_LENGTH_MAX] = {0};
+    FILE *file = nullptr;
+    bool created = false;
+    bool swapRB = false; // decoding to RGB because JCS_EXT_BGR is unavailable
+};
+
+static void onJpegError(j_common_ptr cinfo)
+{
+    JpegRowSource::Decoder *dec = static_cast<JpegRowSource::Decoder *>(cinfo->client_data);
+    (*cinfo->err->format_message)(cinfo, dec->message);
+    longjmp(dec->jump, 1);
+}
+
+static bool startDecoder(JpegRowSource::Decoder *dec, const uchar *data, size_t len, int denom = 1,
+                         bool fast = false)
+{
+    dec->cinfo.err = jpeg_std_error(&dec->jerr);
+    dec->jerr.error_exit = onJpegError;
+    dec->cinfo.client_data = dec;
+    if (setjmp(dec->jump))
+        return false;
+
+    jpeg_create_decompress(&dec->cinfo);
+    dec->created = true;
+    if (dec->file)
+        jpeg_stdio_src(&dec->cinfo, dec->file);
+    else
+        jpeg_mem_src(&dec->cinfo, const_cast<unsigned char *>(data), static_cast<unsigned long>(len));
+
+    jpeg_read_header(&dec->cinfo, TRUE);
+#ifdef JCS_EXTENSIONS
+    dec->cinfo.out_color_space = JCS_EXT_BGR;
+#else
+    dec->cinfo.out_color_space = JCS_RGB;
+    dec->swapRB = true;
+#endif
+    dec->cinfo.scale_num = 1;
+    dec->cinfo.scale_denom = static_cast<unsigned int>(denom);
+    if (fast)
+    {
+        dec->cinfo.dct_method = JDCT_IFAST;
+        dec->cinfo.do_fancy_upsampling = FALSE;
+    }
+    jpeg_start_decompress(&dec->cinfo);
+    return dec->cinfo.output_components == 3;
+}
+
+// Decode up to `rows` scanlines into out; returns the number decoded or -1.
+static int readScanlines(JpegRowSource::Decoder *dec, uchar *out, int rows, size_t stride)
+{
+    if (setjmp(dec->jump))
+        return -1;
+    int done = 0;
+    while (done < rows && dec->cinfo.output_scanline < dec->cinfo.output_height)
+    {
+        JSAMPROW row = out + done * stride;
+        JDIMENSION got = jpeg_read_scanlines(&dec->cinfo, &row, 1);
+        if (got == 0)
+            return -1; // suspended: truncated input
+        done += static_cast<int>(got);
+    }
+    return done;
+}
+
+static void destroyDecoder(JpegRowSource::Decoder *dec)
+{
+    if (setjmp(dec->jump) == 0 && dec->created)
+        jpeg_destroy_decompress(&dec->cinfo);
+    dec->created = false;
+    if (dec->file)
+        fclose(dec->file);
+    dec->file = nullptr;
+}
+
+//---------------------------------------------------------------------
+#ifdef LIBJPEG_TURBO_VERSION
+static bool skipScanlines(JpegRowSource::Decoder *dec, JDIMENSION n)
+{
+    if (setjmp(dec->jump))
+        return false;
+    return jpeg_skip_scanlines(&dec->cinfo, n) == n;
+}
+#endif
+
+// Moves the decoder to the first row of roi and narrows it to the iMCU
+// columns covering roi; x and w come back as the decoded column range.
+static bool cropScanlines(JpegRowSource::Decoder *dec, JDIMENSION &x, JDIMENSION &w, JDIMENSION skip)
+{
+    if (setjmp(dec->jump))
+        return false;
+#ifdef LIBJPEG_TURBO_VERSION
+    jpeg_crop_scanline(&dec->cinfo, &x, &w);
+    return jpeg_skip_scanlines(&dec->cinfo, skip) == skip;
+#else
+    (void)x;
+    (void)w;
+    (void)skip;
+    strcpy(dec->message, "partial decoding needs libjpeg-turbo");
+    return false;
+#endif
+}
+
+bool isJpeg(const uchar *data, size_t len)
+{
+    return len >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+}
+
+bool decodeJpegRegion(const uchar *data, size_t len, const cv::Rect &roi, cv::Mat &out, std::string &err,
+                      int factor, bool fast)
+{
+    JpegRowSource::Decoder dec;
+    bool ok = startDecoder(&dec, data, len, factor, fast) && roi.x >= 0 && roi.y >= 0 && roi.width > 0 && roi.height > 0 &&
+              roi.x + roi.width <= static_cast<int>(dec.cinfo.image_width) &&
+              roi.y + roi.height <= static_cast<int>(dec.cinfo.image_height);
+
+    // roi in decoded pixels: rounded outwards, clipped to the scaled image
+    cv::Rect scaled;
+    if (ok)
+    {
+        const int outW = static_cast<int>(dec.cinfo.output_width), outH = static_cast<int>(dec.cinfo.output_height);
+        int x0 = roi.x / factor, y0 = roi.y / factor;
+        int x1 = std::min(outW, (roi.x + roi.width + factor - 1) / factor);
+        int y1 = std::min(outH, (roi.y + roi.height + factor - 1) / factor);
+        scaled = cv::Rect(x0, y0, x1 - x0, y1 - y0);
+        ok = scaled.width > 0 && scaled.height > 0;
+    }
+    JDIMENSION x = static_cast<JDIMENSION>(scaled.x), w = static_cast<JDIMENSION>(scaled.width);
+    ok = ok && cropScanlines(&dec, x, w, static_cast<JDIMENSION>(scaled.y));
+
+    cv::Mat band;
+    if (ok)
+    {
+        band.create(scaled.height, static_cast<int>(dec.cinfo.output_width), CV_8UC3);
+        ok = readScanlines(&dec, band.data, scaled.height, band.step) == scaled.height;
+    }
+    destroyDecoder(&dec);
+    if (!ok)
+    {
+        err = std::string("Error: Could not decode JPEG region: ") + dec.message;
+        return false;
+    }
+    if (dec.swapRB)
+        cv::cvtColor(band, band, cv::COLOR_RGB2BGR);
+    out = band(cv::Rect(scaled.x - static_cast<int>(x), 0, scaled.width, scaled.height));
+    return true;
+}
+
+std::unique_ptr<JpegRowSource> JpegRowSource::openFile(const std::string &path, std::string &err)
+{
+    std::unique_ptr<JpegRowSource> src(new JpegRowSource());
+    src->dec_.reset(new Decoder());
+    src->dec_->file = fopen(path.c_str(), "rb");
+    if (!src->dec_->file)
+    {
+        err = "Error: Could not open input image: " + path;
+        return nullptr;
+    }
+    if (!startDecoder(src->dec_.get(), nullptr, 0) || !src->start())
+    {
+        if (err.empty())
+            err = std::string("Error: Could not stream JPEG: ") + src->dec_->message;
+        return nullptr;
+    }
+    return src;
+}
+
+std::unique_ptr<JpegRowSource> JpegRowSource::openMemory(const uchar *data, size_t len, std::string &err)
+{
+    std::unique_ptr<JpegRowSource> src(new JpegRowSource());
+    src->dec_.reset(new Decoder());
+    if (!startDecoder(src->dec_.get(), data, len) || !src->start())
+    {
+        if (err.empty())
+            err = std::string("Error: Could not stream JPEG: ") + src->dec_->message;
+        return nullptr;
+    }
+    return src;
+}
+
+bool JpegRowSource::start()
+{
+    width_ = static_cast<int>(dec_->cinfo.output_width);
+    height_ = static_cast<int>(dec_->cinfo.output_height);
+    band_.resize(static_cast<size_t>(width_) * 3 * kBandRows);
+    return width_ > 0 && height_ > 0;
+}
+
+JpegRowSource::~JpegRowSource()
+{
+    if (dec_)
+        destroyDecoder(dec_.get());
+}
+
+const uchar *JpegRowSource::readRow()
+{
+    const size_t stride = static_cast<size_t>(width_) * 3;
+    const int y = position();
+    if (y >= bandStart_ + bandRows_)
+    {
+        int got = readScanlines(dec_.get(), band_.data(), kBandRows, stride);
+        if (got <= 0)
+            return nullptr;
+        bandStart_ = y;
+        bandRows_ = got;
+        if (dec_->swapRB)
+        {
+            uchar *p = band_.data();
+            for (size_t i = 0; i < stride * got; i += 3)
+                std::swap(p[i], p[i + 2]);
+        }
+    }
+    return band_.data() + (y - bandStart_) * stride;
+}
+
+bool JpegRowSource::skipRows(int n)
+{
+    const int target = position() + n;
+    if (target <= bandStart_ + bandRows_)
+        return true; // still inside the decoded band
+#ifdef LIBJPEG_TURBO_VERSION
+    // The decoder stands at the end of the band; jump it to target
+    if (!skipScanlines(dec_.get(), static_cast<JDIMENSION>(target - (bandStart_ + bandRows_))))
+        return false;
+    bandStart_ = target;
+    bandRows_ = 0;
+    return true;
+#else
+    return RowSource::skipRows(n);
+#endif
+}
+
+//---------------------------------------------------------------------
+// Encoder. The destination manager writes into the caller's vector,
+// doubling it when full, so the result needs no copy out of libjpeg.
+struct JpegEncoder
+{
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr jerr;
+    jpeg_destination_mgr dest;
+    jmp_buf jump;
+    char message[JMSG_LENGTH_MAX] = {0};
+    std::vector<uchar> *out = nullptr;
+    size_t initialBytes = 0;
+    const ChunkSink *sink = nullptr;
+    size_t sent = 0; // bytes of out already passed to sink
+    bool created = false;
+};
+
+static void flushToSink(JpegEncoder *enc, size_t end)
+{
+    if (enc->sink && *enc->sink && end > enc->sent)
+    {
+        (*enc->sink)(enc->out->data() + enc->sent, end - enc->sent);
+        enc->sent = end;
+    }
+}
+
+static void onEncodeError(j_common_ptr cinfo)
+{
+    JpegEncoder *enc = static_cast<JpegEncoder *>(cinfo->client_data);
+    (*cinfo->err->format_message)(cinfo, enc->message);
+    longjmp(enc->jump, 1);
+}
+
+// Grows the output to `bytes`; false when the allocation fails, which the
+// callers turn into a libjpeg error rather than an exception through C.
+static bool growOutput(JpegEncoder *enc, size_t bytes)
+{
+    try
+    {
+        enc->out->resize(bytes);
+        return true;
+    }
+    catch (const std::bad_alloc &)
+    {
+        return false;
+    }
+}
+
+static void failOutOfMemory(JpegEncoder *enc)
+{
+    strcpy(enc->message, "out of memory for the encoded image");
+    longjmp(enc->jump, 1);
+}
+
+static void initDestination(j_compress_ptr cinfo)
+{
+    JpegEncoder *enc = static_cast<JpegEncoder *>(cinfo->client_data);
+    if (!growOutput(enc, std::max(enc->initialBytes, enc->out->capacity())))
+        failOutOfMemory(enc);
+    enc->dest.next_output_byte = enc->out->data();
+    enc->dest.free_in_buffer = enc->out->size();
+}
+
+static boolean emptyOutputBuffer(j_compress_ptr cinfo)
+{
+    JpegEncoder *enc = static_cast<JpegEncoder *>(cinfo->client_data);
+    size_t used = enc->out->size(); // libjpeg only calls this when all of it is used
+    flushToSink(enc, used);
+    if (!growOutput(enc, used * 2))
+        failOutOfMemory(enc);
+    enc->dest.next_output_byte = enc->out->data() + used;
+    enc->dest.free_in_buffer = enc->out->size() - used;
+    return TRUE;
+}
+
+static void termDestination(j_compress_ptr cinfo)
+{
+    JpegEncoder *enc = static_cast<JpegEncoder *>(cinfo->client_data);
+    enc->out->resize(enc->out->size() - enc->dest.free_in_buffer);
+    flushToSink(enc, enc->out->size());
+}
+
+// swapped: one row of scratch when libjpeg cannot read BGR itself.
+static bool compressImage(JpegEncoder *enc, const cv::Mat &bgr, const JpegEncodeParams &params, uchar *swapped)
+{
+    enc->cinfo.err = jpeg_std_error(&enc->jerr);
+    enc->jerr.error_exit = onEncodeError;
+    enc->cinfo.client_data = enc;
+    if (setjmp(enc->jump))
+        return false;
+
+    jpeg_create_compress(&enc->cinfo);
+    enc->created = true;
+    enc->dest.init_destination = initDestination;
+    enc->dest.empty_output_buffer = emptyOutputBuffer;
+    enc->dest.term_destination = termDestination;
+    enc->cinfo.dest = &enc->dest;
+
+    enc->cinfo.image_width = static_cast<JDIMENSION>(bgr.cols);
+    enc->cinfo.image_height = static_cast<JDIMENSION>(bgr.rows);
+    enc->cinfo.input_components = 3;
+#ifdef JCS_EXTENSIONS
+    enc->cinfo.in_color_space = JCS_EXT_BGR;
+#else
+    enc->cinfo.in_color_space = JCS_RGB;
+#endif
+    jpeg_set_defaults(&enc->cinfo);
+    jpeg_set_quality(&enc->cinfo, params.quality, TRUE);
+    enc->cinfo.optimize_coding = params.optimize ? TRUE : FALSE;
+    enc->cinfo.dct_method = params.fastDct ? JDCT_IFAST : JDCT_ISLOW;
+    if (params.progressive)
+        jpeg_simple_progression(&enc->cinfo);
+
+    jpeg_start_compress(&enc->cinfo, TRUE);
+    while (enc->cinfo.next_scanline < enc->cinfo.image_height)
+    {
+        JSAMPROW row = const_cast<uchar *>(bgr.ptr<uchar>(static_cast<int>(enc->cinfo.next_scanline)));
+        if (swapped)
+        {
+            for (int x = 0; x < bgr.cols * 3; x += 3)
+            {
+                swapped[x] = row[x + 2];
+                swapped[x + 1] = row[x + 1];
+                swapped[x + 2] = row[x];
+            }
+            row = swapped;
+        }
+        jpeg_write_scanlines(&enc->cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&enc->cinfo);
+    return true;
+}
+
+static void destroyEncoder(JpegEncoder *enc)
+{
+    if (setjmp(enc->jump) == 0 && enc->created)
+        jpeg_destroy_compress(&enc->cinfo);
+    enc->created = false;
+}
+
+bool encodeJpeg(const cv::Mat &bgr, const JpegEncodeParams &params, std::vector<uchar> &out,
+                std::string &err, const ChunkSink &sink)
+{
+    if (bgr.empty() || bgr.type() != CV_8UC3)
+    {
+        err = "Error: JPEG encoding needs an 8-bit BGR image";
+        return false;
+    }
+    JpegEncoder enc;
+    enc.out = &out;
+    // Photos land around 1-2 bits per pixel at the usual qualities; a sink
+    // gets the first piece after 64KB instead (then 64KB, 128KB, 256KB, ...)
+    enc.initialBytes = sink ? static_cast<size_t>(64 << 10) : std::max<size_t>(64 << 10, bgr.total() / 4);
+    enc.sink = &sink;
+    out.clear();
+
+    std::vector<uchar> swapped;
+#ifndef JCS_EXTENSIONS
+    swapped.resize(static_cast<size_t>(bgr.cols) * 3);
+#endif
+    bool ok = compressImage(&enc, bgr, params, swapped.empty() ? nullptr : swapped.data());
+    destroyEncoder(&enc);
+    if (!ok)
+        err = std::string("Error: Could not encode JPEG: ") + enc.message;
+    return ok;
+}
+
+//---------------------------------------------------------------------
+// Lossless crop: the source is read as coefficient arrays, the blocks under
+// the crop are copied into arrays of the crop's size and those are written
+// out with the source's quantisation tables.
+struct JpegCropper
+{
+    JpegEncoder enc; // output side; its jump point and message serve both
+    jpeg_decompress_struct src;
+    jpeg_error_mgr srcErr;
+    bool srcCreated = false;
+};
+
+static JDIMENSION ceilDiv(JDIMENSION a, JDIMENSION b)
+{
+    return (a + b - 1) / b;
+}
+
+static bool cropCoefficients(JpegCropper *c, const uchar *data, size_t len, const cv::Rect &crop,
+                             const JpegEncodeParams &params, bool &aligned)
+{
+    JpegEncoder *enc = &c->enc;
+    c->src.err = jpeg_std_error(&c->srcErr);
+    c->srcErr.error_exit = onEncodeError;
+    c->src.client_data = enc;
+    enc->cinfo.err = jpeg_std_error(&enc->jerr);
+    enc->jerr.error_exit = onEncodeError;
+    enc->cinfo.client_data = enc;
+    if (setjmp(enc->jump))
+        return false;
+
+    jpeg_create_decompress(&c->src);
+    c->srcCreated = true;
+    jpeg_create_compress(&enc->cinfo);
+    enc->created = true;
+    jpeg_mem_src(&c->src, const_cast<unsigned char *>(data), static_cast<unsigned long>(len));
+    jpeg_read_header(&c->src, TRUE);
+    if (crop.x < 0 || crop.y < 0 || crop.width <= 0 || crop.height <= 0 ||
+        static_cast<JDIMENSION>(crop.x + crop.width) > c->src.image_width ||
+        static_cast<JDIMENSION>(crop.y + crop.height) > c->src.image_height)
+    {
+        strcpy(enc->message, "crop area outside the image");
+        return false;
+    }
+
+    const JDIMENSION mcuW = c->src.max_h_samp_factor * DCTSIZE;
+    const JDIMENSION mcuH = c->src.max_v_samp_factor * DCTSIZE;
+    aligned = crop.x % mcuW == 0 && crop.y % mcuH == 0;
+    if (!aligned)
+        return false;
+
+    // The output arrays are requested before the coefficients are read, so
+    // the memory manager realises them together with the source's.
+    jvirt_barray_ptr cropped[MAX_COMPONENTS];
+    JDIMENSION blocksW[MAX_COMPONENTS], blocksH[MAX_COMPONENTS];
+    for (int ci = 0; ci < c->src.num_components; ++ci)
+    {
+        const jpeg_component_info *comp = &c->src.comp_info[ci];
+        const JDIMENSION h = comp->h_samp_factor, v = comp->v_samp_factor;
+        blocksW[ci] = ceilDiv(crop.width * h, mcuW);
+        blocksH[ci] = ceilDiv(crop.height * v, mcuH);
+        cropped[ci] = (*c->src.mem->request_virt_barray)(reinterpret_cast<j_common_ptr>(&c->src), JPOOL_IMAGE, FALSE,
+                                                         ceilDiv(blocksW[ci], h) * h, ceilDiv(blocksH[ci], v) * v, v);
+    }
+    jvirt_barray_ptr *source = jpeg_read_coefficients(&c->src);
+
+    for (int ci = 0; ci < c->src.num_components; ++ci)
+    {
+        const jpeg_component_info *comp = &c->src.comp_info[ci];
+        const JDIMENSION v = comp->v_samp_factor;
+        const JDIMENSION x0 = crop.x / mcuW * comp->h_samp_factor, y0 = crop.y / mcuH * v;
+        for (JDIMENSION y = 0; y < blocksH[ci]; y += v)
+        {
+            JBLOCKARRAY to = (*c->src.mem->access_virt_barray)(reinterpret_cast<j_common_ptr>(&c->src), cropped[ci], y, v, TRUE);
+            JBLOCKARRAY from = (*c->src.mem->access_virt_barray)(reinterpret_cast<j_common_ptr>(&c->src), source[ci], y0 + y, v, FALSE);
+            for (JDIMENSION r = 0; r < v; ++r)
+                memcpy(to[r], from[r] + x0, blocksW[ci] * sizeof(JBLOCK));
+        }
+    }
+
+    enc->dest.init_destination = initDestination;
+    enc->dest.empty_output_buffer = emptyOutputBuffer;
+    enc->dest.term_destination = termDestination;
+    enc->cinfo.dest = &enc->dest;
+    jpeg_copy_critical_parameters(&c->src, &enc->cinfo);
+    enc->cinfo.image_width = static_cast<JDIMENSION>(crop.width);
+    enc->cinfo.image_height = static_cast<JDIMENSION>(crop.height);
+    enc->cinfo.optimize_coding = params.optimize ? TRUE : FALSE;
+    if (params.progressive)
+        jpeg_simple_progression(&enc->cinfo);
+    jpeg_write_coefficients(&enc->cinfo, cropped);
+    jpeg_finish_compress(&enc->cinfo);
+    jpeg_finish_decompress(&c->src);
+    return true;
+}
+
+static void destroyCropper(JpegCropper *c)
+{
+    destroyEncoder(&c->enc);
+    if (setjmp(c->enc.jump) == 0 && c->srcCreated)
+        jpeg_destroy_decompress(&c->src);
+    c->srcCreated = false;
+}
+
+bool cropJpegLossless(const uchar *data, size_t len, const cv::Rect &crop, const JpegEncodeParams &params,
+                      std::vector<uchar> &out, std::string &err)
+{
+    JpegCropper cropper;
+    cropper.enc.out = &out;
+    // The output grows as needed; a quarter of the source is a fair start
+    cropper.enc.initialBytes = (64 << 10) + len / 4;
+    out.clear();
+
+    bool aligned = true;
+    bool ok = cropCoefficients(&cropper, data, len, crop, params, aligned);
+    destroyCropper(&cropper);
+    if (!ok && aligned)
+        err = std::string("Error: Could not crop JPEG: ") + cropper.enc.message;
+    return ok;
+}
+
+} // namespace canvasops
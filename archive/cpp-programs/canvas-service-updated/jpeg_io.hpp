@@ -0,0 +1,83 @@
+// jpeg_io.hpp
+// Band-at-a-time JPEG decoding on top of libjpeg(-turbo), for the --stream
+// modes. Only a small band of decoded rows is resident at any time. Also the
+// JPEG encoder behind the tools' --output-quality/--progressive/--optimize.
+#pragma once
+
+#include "row_stream.hpp"
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace canvasops
+{
+
+bool isJpeg(const uchar *data, size_t len);
+
+struct JpegEncodeParams
+{
+    int quality = 95;         // same default as cv::imwrite
+    bool progressive = false; // multi-scan, usually a few percent smaller
+    bool optimize = false;    // optimal Huffman tables (extra pass, smaller)
+    bool fastDct = false;     // integer fast DCT: quicker, slightly lower quality
+};
+
+// Receives encoded bytes as they are produced.
+typedef std::function<void(const uchar *data, size_t len)> ChunkSink;
+
+// Encodes an 8-bit BGR image straight into out (replacing its contents),
+// reading rows in place so ROIs need no copy. Returns false with err set.
+// With a sink, each stretch of out is also passed to it as soon as libjpeg
+// writes it: a baseline JPEG leaves in pieces while later rows are still
+// being compressed (progressive and optimized ones only once finished).
+bool encodeJpeg(const cv::Mat &bgr, const JpegEncodeParams &params, std::vector<uchar> &out,
+                std::string &err, const ChunkSink &sink = nullptr);
+
+// Lossless crop in the DCT domain, like jpegtran -crop: the coefficients of
+// the blocks under crop are copied into a new JPEG without decoding or
+// re-quantising, so there is no generation loss. crop.x and crop.y must lie
+// on iMCU boundaries (8 or 16 pixels, by chroma subsampling); when they do
+// not, returns false with err left empty. Of params only progressive and
+// optimize apply, since the source's quantisation is kept.
+bool cropJpegLossless(const uchar *data, size_t len, const cv::Rect &crop, const JpegEncodeParams &params,
+                      std::vector<uchar> &out, std::string &err);
+
+// Decodes only roi: rows above it are skipped and only the iMCU columns
+// that overlap it are decoded (libjpeg-turbo's partial decode API). With
+// factor 2, 4 or 8 the region is decoded at that reduced size through DCT
+// scaling (roi stays in full-size pixels; out covers it rounded outwards).
+// out is a view into a buffer at most one iMCU wider than roi on each side.
+// fast trades accuracy for speed (integer IDCT, no chroma smoothing), for
+// drafts.
+bool decodeJpegRegion(const uchar *data, size_t len, const cv::Rect &roi, cv::Mat &out, std::string &err,
+                      int factor = 1, bool fast = false);
+
+class JpegRowSource : public RowSource
+{
+public:
+    // An in-memory source keeps a pointer to data, which must outlive it.
+    static std::unique_ptr<JpegRowSource> openFile(const std::string &path, std::string &err);
+    static std::unique_ptr<JpegRowSource> openMemory(const uchar *data, size_t len, std::string &err);
+    ~JpegRowSource() override;
+
+    int width() const override { return width_; }
+    int height() const override { return height_; }
+
+    struct Decoder; // libjpeg state, kept out of this header
+
+protected:
+    const uchar *readRow() override;
+    bool skipRows(int n) override; // rows below the band are skipped undecoded
+
+private:
+    JpegRowSource() = default;
+    bool start();
+
+    std::unique_ptr<Decoder> dec_;
+    int width_ = 0, height_ = 0;
+    std::vector<uchar> band_; // decoded rows [bandStart_, bandStart_ + bandRows_)
+    int bandStart_ = 0, bandRows_ = 0;
+};
+
+} // namespace canvasops
@@ -0,0 +1,95 @@
+// lru_cache.hpp
+// Thread-safe LRU map from string keys to shared, immutable values, bounded
+// by the total byte size of the values rather than by entry count.
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+template <class V>
+class LruCache
+{
+public:
+    typedef std::shared_ptr<const V> Ptr;
+    typedef std::function<size_t(const V &)> SizeFn;
+
+    LruCache(size_t budgetBytes, SizeFn sizeOf) : budget_(budgetBytes), sizeOf_(std::move(sizeOf)) {}
+
+    LruCache(const LruCache &) = delete;
+    LruCache &operator=(const LruCache &) = delete;
+
+    // nullptr on a miss; a hit becomes the most recently used entry.
+    Ptr get(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it == index_.end())
+            return nullptr;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return it->second->value;
+    }
+
+    // Values larger than the whole budget are not kept.
+    void put(const std::string &key, Ptr value)
+    {
+        size_t bytes = sizeOf_(*value) + key.size();
+        std::lock_guard<std::mutex> lock(mutex_);
+        erase(key);
+        if (bytes > budget_)
+            return;
+        entries_.push_front(Entry{key, std::move(value), bytes});
+        index_[key] = entries_.begin();
+        used_ += bytes;
+        while (used_ > budget_)
+            erase(entries_.back().key);
+    }
+
+    void remove(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        erase(key);
+    }
+
+    size_t bytes() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return used_;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.size();
+    }
+
+private:
+    struct Entry
+    {
+        std::string key;
+        Ptr value;
+        size_t bytes;
+    };
+
+    void erase(const std::string &key)
+    {
+        auto it = index_.find(key);
+        if (it == index_.end())
+            return;
+        used_ -= it->second->bytes;
+        entries_.erase(it->second);
+        index_.erase(it);
+    }
+
+    size_t budget_;
+    SizeFn sizeOf_;
+    size_t used_ = 0;
+    std::list<Entry> entries_; // most recently used first
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> index_;
+    mutable std::mutex mutex_;
+};
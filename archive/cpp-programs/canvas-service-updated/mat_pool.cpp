@@ -0,0 +1,174 @@
+// mat_pool.cpp
+// Size-class buffer pool behind PoolMatAllocator (see mat_pool.hpp).
+#include "mat_pool.hpp"
+
+#include <sstream>
+
+using namespace cv;
+
+// Small Mats are cheap to malloc and would only fragment the pool.
+static const size_t kMinPooled = 256 * 1024;
+
+// Round up to one of four classes per power of two, so a reused buffer
+// wastes at most a quarter of itself and near-equal sizes (a 1919- vs a
+// 1920-wide strip) share a class.
+static size_t sizeClass(size_t bytes)
+{
+    size_t octave = 1;
+    while (octave * 2 <= bytes)
+        octave *= 2;
+    size_t quarter = octave / 4;
+    return (bytes + quarter - 1) / quarter * quarter;
+}
+
+PoolMatAllocator::~PoolMatAllocator()
+{
+    for (auto &cls : free_)
+        for (void *ptr : cls.second)
+            fastFree(ptr);
+}
+
+void *PoolMatAllocator::take(size_t bytes) const
+{
+    if (bytes < kMinPooled)
+        return fastMalloc(bytes);
+    size_t cls = sizeClass(bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = free_.find(cls);
+        if (it != free_.end() && !it->second.empty())
+        {
+            void *ptr = it->second.back();
+            it->second.pop_back();
+            cached_ -= cls;
+            ++hits_;
+            return ptr;
+        }
+        ++misses_;
+    }
+    return fastMalloc(cls);
+}
+
+void PoolMatAllocator::give(void *ptr, size_t bytes) const
+{
+    if (bytes >= kMinPooled)
+    {
+        size_t cls = sizeClass(bytes);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cached_ + cls <= cacheBytes_)
+        {
+            free_[cls].push_back(ptr);
+            cached_ += cls;
+            return;
+        }
+    }
+    fastFree(ptr);
+}
+
+// Same layout rules as OpenCV's StdMatAllocator; only where the bytes come
+// from differs.
+UMatData *PoolMatAllocator::allocate(int dims, const int *sizes, int type, void *data0, size_t *step,
+                                     AccessFlag, UMatUsageFlags) const
+{
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; --i)
+    {
+        if (step)
+        {
+            if (data0 && step[i] != CV_AUTOSTEP)
+            {
+                CV_Assert(total <= step[i]);
+                total = step[i];
+            }
+            else
+                step[i] = total;
+        }
+        total *= sizes[i];
+    }
+
+    UMatData *u = new UMatData(this);
+    u->data = u->origdata = data0 ? static_cast<uchar *>(data0) : static_cast<uchar *>(take(total));
+    u->size = total;
+    if (data0)
+        u->flags |= UMatData::USER_ALLOCATED;
+    else
+    {
+        live_ += total;
+        if (MatByteCounter *job = MatByteCounter::current())
+        {
+            job->retain();
+            job->add(total);
+            u->userdata = job;
+        }
+    }
+    return u;
+}
+
+bool PoolMatAllocator::allocate(UMatData *u, AccessFlag, UMatUsageFlags) const
+{
+    return u != nullptr;
+}
+
+void PoolMatAllocator::deallocate(UMatData *u) const
+{
+    if (!u)
+        return;
+    CV_Assert(u->urefcount == 0);
+    CV_Assert(u->refcount == 0);
+    if (!(u->flags & UMatData::USER_ALLOCATED))
+    {
+        live_ -= u->size;
+        if (MatByteCounter *job = static_cast<MatByteCounter *>(u->userdata))
+        {
+            job->sub(u->size);
+            job->release();
+            u->userdata = 0;
+        }
+        give(u->origdata, u->size);
+        u->origdata = 0;
+    }
+    delete u;
+}
+
+std::string PoolMatAllocator::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream out;
+    out << "pool_hits=" << hits_ << " pool_misses=" << misses_ << " pool_cached=" << cached_;
+    return out.str();
+}
+
+//---------------------------------------------------------------------
+static thread_local MatByteCounter *currentCounter = nullptr;
+
+MatByteCounter *MatByteCounter::current()
+{
+    return currentCounter;
+}
+
+void MatByteCounter::add(size_t bytes)
+{
+    size_t live = live_ += bytes;
+    size_t peak = peak_;
+    while (live > peak && !peak_.compare_exchange_weak(peak, live))
+        ;
+}
+
+MatByteScope::MatByteScope() : counter_(new MatByteCounter), previous_(currentCounter)
+{
+    currentCounter = counter_;
+}
+
+MatByteScope::MatByteScope(MatByteCounter *counter) : counter_(counter), previous_(currentCounter)
+{
+    if (counter_)
+        counter_->retain();
+    currentCounter = counter_;
+}
+
+MatByteScope::~MatByteScope()
+{
+    currentCounter = previous_;
+    if (counter_)
+        counter_->release();
+}
@@ -0,0 +1,97 @@
+// mat_pool.hpp
+// cv::MatAllocator that keeps freed large buffers in size classes and hands
+// them out again, so a long-running worker, or a batch, that allocates the
+// same masks, strips and canvases for every job stops going back to malloc
+// (and the kernel's page faults) once it has warmed up. With a budget of 0
+// it only counts bytes, for --metrics.
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class PoolMatAllocator : public cv::MatAllocator
+{
+public:
+    // cacheBytes bounds the memory held by idle buffers; a buffer freed past
+    // it goes back to the system.
+    explicit PoolMatAllocator(size_t cacheBytes) : cacheBytes_(cacheBytes) {}
+    ~PoolMatAllocator() override;
+
+    // Make this pool the default for every cv::Mat created afterwards,
+    // including OpenCV's own temporaries. Mats allocated before keep
+    // freeing through the allocator that made them. The pool must outlive
+    // them all, so install one that is never destroyed.
+    void install() { cv::Mat::setDefaultAllocator(this); }
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData *data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData *data) const override;
+
+    std::string stats() const;
+
+    // Bytes held by live Mats from this allocator, all jobs together
+    size_t liveBytes() const { return live_; }
+
+private:
+    void *take(size_t bytes) const;
+    void give(void *ptr, size_t bytes) const;
+
+    const size_t cacheBytes_;
+    mutable std::mutex mutex_;
+    mutable std::unordered_map<size_t, std::vector<void *>> free_; // size class -> idle buffers
+    mutable size_t cached_ = 0;
+    mutable unsigned long hits_ = 0, misses_ = 0;
+    mutable std::atomic<size_t> live_{0};
+};
+
+// Live and peak bytes of one job's Mats, for its --metrics while other
+// jobs run alongside. A Mat holds a reference to the counter it was
+// counted in, so it may be freed on any thread, after the job is over.
+class MatByteCounter
+{
+public:
+    size_t peakBytes() const { return peak_; }
+
+    // The counter of the job this thread allocates for, or null
+    static MatByteCounter *current();
+
+    void add(size_t bytes);
+    void sub(size_t bytes) { live_ -= bytes; }
+    void retain() { ++refs_; }
+    void release()
+    {
+        if (--refs_ == 0)
+            delete this;
+    }
+
+private:
+    std::atomic<size_t> live_{0}, peak_{0};
+    std::atomic<int> refs_{1};
+};
+
+// Makes a counter the calling thread's until it goes out of scope. The
+// default opens one for a new job; passing MatByteCounter::current()
+// carries the job onto a helper thread (null counts nothing). OpenCV's
+// own parallel_for threads are not counted.
+class MatByteScope
+{
+public:
+    MatByteScope();
+    explicit MatByteScope(MatByteCounter *counter);
+    ~MatByteScope();
+
+    MatByteCounter *counter() const { return counter_; }
+
+    MatByteScope(const MatByteScope &) = delete;
+    MatByteScope &operator=(const MatByteScope &) = delete;
+
+private:
+    MatByteCounter *counter_;
+    MatByteCounter *previous_;
+};
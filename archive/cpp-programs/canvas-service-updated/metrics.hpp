@@ -0,0 +1,97 @@
+// metrics.hpp
+// Per-job stage timings and facts (sizes, threshold, peak bytes) for
+// --metrics json. Tools print them as one trailer line on stdout:
+//   METRICS {"tool":"extend","stages_ms":{"decode":41.2,...},...}
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Metrics
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit Metrics(const std::string &tool) : tool_(tool), start_(Clock::now()) {}
+
+    // Repeated stages accumulate (e.g. two resizes in one job).
+    void stage(const std::string &name, double ms)
+    {
+        for (auto &s : stages_)
+        {
+            if (s.first == name)
+            {
+                s.second += ms;
+                return;
+            }
+        }
+        stages_.emplace_back(name, ms);
+    }
+
+    // value is raw JSON (a number, array or quoted string).
+    void set(const std::string &key, const std::string &value)
+    {
+        for (auto &f : fields_)
+        {
+            if (f.first == key)
+            {
+                f.second = value;
+                return;
+            }
+        }
+        fields_.emplace_back(key, value);
+    }
+    void set(const std::string &key, long value) { set(key, std::to_string(value)); }
+    void setSize(const std::string &key, int w, int h) { set(key, "[" + std::to_string(w) + "," + std::to_string(h) + "]"); }
+
+    std::string json() const
+    {
+        char num[32];
+        std::string out = "{\"tool\":\"" + tool_ + "\",\"stages_ms\":{";
+        for (size_t i = 0; i < stages_.size(); ++i)
+        {
+            snprintf(num, sizeof(num), "%.3f", stages_[i].second);
+            out += (i ? ",\"" : "\"") + stages_[i].first + "\":" + num;
+        }
+        snprintf(num, sizeof(num), "%.3f", msSince(start_));
+        out += std::string("},\"total_ms\":") + num;
+        for (const auto &f : fields_)
+            out += ",\"" + f.first + "\":" + f.second;
+        return out + "}";
+    }
+
+    static double msSince(Clock::time_point t0)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    }
+
+private:
+    std::string tool_;
+    Clock::time_point start_;
+    std::vector<std::pair<std::string, double>> stages_;
+    std::vector<std::pair<std::string, std::string>> fields_;
+};
+
+// Adds the time until it goes out of scope to a stage; no-op without metrics.
+class StageTimer
+{
+public:
+    StageTimer(Metrics *metrics, const char *name)
+        : metrics_(metrics), name_(name), start_(Metrics::Clock::now()) {}
+    ~StageTimer()
+    {
+        if (metrics_)
+            metrics_->stage(name_, Metrics::msSince(start_));
+    }
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+private:
+    Metrics *metrics_;
+    const char *name_;
+    Metrics::Clock::time_point start_;
+};
@@ -0,0 +1,394 @@
+// pipeline.cpp
+// Implementation of multi-step jobs (see pipeline.hpp).
+#include "pipeline.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+
+using namespace cv;
+
+namespace canvasops
+{
+
+static const char *stepName(PipelineStep::Op op)
+{
+    switch (op)
+    {
+    case PipelineStep::Op::Crop:
+        return "crop";
+    case PipelineStep::Op::Extend:
+        return "extend";
+    case PipelineStep::Op::Matte:
+        return "matte";
+    default:
+        return "resize";
+    }
+}
+
+// Whole-token numbers only, so "12px" is refused rather than read as 12.
+static int toInt(const std::string &value)
+{
+    size_t used = 0;
+    int n = std::stoi(value, &used);
+    if (used != value.size())
+        throw std::invalid_argument(value);
+    return n;
+}
+
+static double toDouble(const std::string &value)
+{
+    size_t used = 0;
+    double d = std::stod(value, &used);
+    if (used != value.size())
+        throw std::invalid_argument(value);
+    return d;
+}
+
+static ResizeQuality toQuality(const std::string &value)
+{
+    ResizeQuality quality;
+    if (!parseResizeQuality(value, quality))
+        throw std::invalid_argument(value);
+    return quality;
+}
+
+// Applies one key=value; false when the op has no such key, throws on a
+// malformed value.
+static bool setStepValue(PipelineStep &step, const std::string &key, const std::string &value)
+{
+    CropParams &c = step.crop;
+    ExtendParams &e = step.extend;
+    MatteParams &m = step.matte;
+    switch (step.op)
+    {
+    case PipelineStep::Op::Crop:
+        if (key == "x")
+            c.cropX = toInt(value);
+        else if (key == "y")
+            c.cropY = toInt(value);
+        else if (key == "width")
+            c.cropWidth = toInt(value);
+        else if (key == "height")
+            c.cropHeight = toInt(value);
+        else if (key == "preview-width")
+            c.previewWidth = toInt(value);
+        else if (key == "preview-height")
+            c.previewHeight = toInt(value);
+        else if (key == "output-width")
+            c.outputWidth = toInt(value);
+        else if (key == "output-height")
+            c.outputHeight = toInt(value);
+        else if (key == "scale")
+            c.scale = toDouble(value);
+        else if (key == "quality")
+            c.quality = toQuality(value);
+        else
+            return false;
+        return true;
+    case PipelineStep::Op::Extend:
+        if (key == "height")
+            e.desiredH = toInt(value);
+        else if (key == "pad")
+            e.padPct = toDouble(value);
+        else if (key == "threshold")
+            e.whiteThr = toInt(value);
+        else if (key == "requested-width")
+            e.requestedW = toInt(value);
+        else if (key == "requested-height")
+            e.requestedH = toInt(value);
+        else if (key == "sample")
+        {
+            if (!parseSampleRegion(value, e.sample))
+                throw std::invalid_argument(value);
+        }
+        else if (key == "mode")
+        {
+            if (!parseExtendMode(value, e.mode))
+                throw std::invalid_argument(value);
+        }
+        else if (key == "quality")
+            e.quality = toQuality(value);
+        else
+            return false;
+        return true;
+    case PipelineStep::Op::Matte:
+        if (key == "width")
+            m.canvasWidth = toInt(value);
+        else if (key == "height")
+            m.canvasHeight = toInt(value);
+        else if (key == "padding")
+            m.paddingPercent = static_cast<float>(toDouble(value));
+        else if (key == "color")
+            m.hexColor = value;
+        else
+            return false;
+        return true;
+    default:
+        if (key == "width")
+            step.width = toInt(value);
+        else if (key == "height")
+            step.height = toInt(value);
+        else if (key == "quality")
+            step.quality = toQuality(value);
+        else
+            return false;
+        return true;
+    }
+}
+
+// The checks the standalone tools make on the same parameters.
+static std::string stepError(PipelineStep &step)
+{
+    const CropParams &c = step.crop;
+    switch (step.op)
+    {
+    case PipelineStep::Op::Crop:
+        if (c.cropWidth < 0 || c.cropHeight < 0)
+            return "crop width and height must not be negative";
+        if ((c.previewWidth > 0) != (c.previewHeight > 0))
+            return "preview-width and preview-height go together";
+        if (c.outputWidth < 0 || c.outputHeight < 0 || (c.outputWidth > 0) != (c.outputHeight > 0))
+            return "output-width and output-height go together and must be positive";
+        step.cropCanvas = c.outputWidth > 0;
+        if (!step.cropCanvas && c.scale != 1.0)
+            return "scale needs output-width and output-height";
+        if (c.scale <= 0)
+            return "scale must be positive";
+        return "";
+    case PipelineStep::Op::Extend:
+        if (step.extend.desiredH <= 0)
+            return "extend needs a positive height";
+        if (step.extend.padPct < 0)
+            return "pad must not be negative";
+        return "";
+    case PipelineStep::Op::Matte:
+        if (step.matte.canvasWidth <= 0 || step.matte.canvasHeight <= 0)
+            return "canvas dimensions must be positive";
+        if (step.matte.paddingPercent < 0 || step.matte.paddingPercent >= 50)
+            return "padding percent must be between 0 and 50";
+        if (!isHexColor(step.matte.hexColor))
+            return "color must be six hex digits (#rrggbb)";
+        return "";
+    default:
+        if (step.width < 0 || step.height < 0 || (step.width == 0 && step.height == 0))
+            return "resize needs a positive width and/or height";
+        return "";
+    }
+}
+
+bool parsePipelineStep(const std::string &spec, PipelineStep &step, std::string &err)
+{
+    std::string tokens = spec;
+    std::replace(tokens.begin(), tokens.end(), ',', ' ');
+    std::istringstream in(tokens);
+    std::string op, token;
+    in >> op;
+
+    step = PipelineStep();
+    step.crop.outputWidth = step.crop.outputHeight = 0; // no canvas unless asked for
+    if (op == "crop")
+        step.op = PipelineStep::Op::Crop;
+    else if (op == "extend")
+        step.op = PipelineStep::Op::Extend;
+    else if (op == "matte")
+        step.op = PipelineStep::Op::Matte;
+    else if (op == "resize")
+        step.op = PipelineStep::Op::Resize;
+    else
+    {
+        err = "Error: Step '" + spec + "': op must be crop, extend, matte or resize.";
+        return false;
+    }
+
+    while (in >> token)
+    {
+        size_t eq = token.find('=');
+        if (eq == std::string::npos || eq == 0)
+        {
+            err = "Error: Step '" + spec + "': expected key=value, got '" + token + "'.";
+            return false;
+        }
+        std::string key = token.substr(0, eq);
+        bool known;
+        try
+        {
+            known = setStepValue(step, key, token.substr(eq + 1));
+        }
+        catch (const std::exception &)
+        {
+            err = "Error: Step '" + spec + "': bad value for " + key + ".";
+            return false;
+        }
+        if (!known)
+        {
+            err = "Error: Step '" + spec + "': " + op + " has no " + key + ".";
+            return false;
+        }
+    }
+
+    std::string problem = stepError(step);
+    if (!problem.empty())
+    {
+        err = "Error: Step '" + spec + "': " + problem + ".";
+        return false;
+    }
+    return true;
+}
+
+std::string pipelineStepKey(const PipelineStep &step)
+{
+    std::ostringstream key;
+    key.precision(10);
+    key << stepName(step.op);
+    switch (step.op)
+    {
+    case PipelineStep::Op::Crop:
+    {
+        const CropParams &c = step.crop;
+        key << " preview=" << c.previewWidth << "x" << c.previewHeight << " rect=" << c.cropX << ","
+            << c.cropY << "," << c.cropWidth << "," << c.cropHeight;
+        if (step.cropCanvas)
+            key << " out=" << c.outputWidth << "x" << c.outputHeight << " scale=" << c.scale
+                << " quality=" << resizeQualityName(c.quality);
+        break;
+    }
+    case PipelineStep::Op::Extend:
+    {
+        const ExtendParams &e = step.extend;
+        bool autoThr = e.whiteThr < 0 || e.whiteThr > 255;
+        bool requested = e.requestedW > 0 && e.requestedH > 0;
+        key << " h=" << e.desiredH << " pad=" << e.padPct << " thr=" << (autoThr ? -1 : e.whiteThr)
+            << " req=" << (requested ? e.requestedW : -1) << "x" << (requested ? e.requestedH : -1)
+            << " quality=" << resizeQualityName(e.quality)
+            << " sample=" << sampleRegionName(autoThr ? e.sample : SampleRegion::Center)
+            << " mode=" << extendModeName(e.mode);
+        break;
+    }
+    case PipelineStep::Op::Matte:
+    {
+        Scalar bgr = hexToScalar(step.matte.hexColor);
+        char color[8];
+        snprintf(color, sizeof(color), "%02x%02x%02x", static_cast<int>(bgr[2]),
+                 static_cast<int>(bgr[1]), static_cast<int>(bgr[0]));
+        key << " canvas=" << step.matte.canvasWidth << "x" << step.matte.canvasHeight
+            << " pad=" << step.matte.paddingPercent << " color=" << color;
+        break;
+    }
+    default:
+        key << " " << step.width << "x" << step.height << " quality=" << resizeQualityName(step.quality);
+        break;
+    }
+    return key.str();
+}
+
+// A resize whose result the next step makes redundant: a later resize
+// that sets both sides replaces it, and a later one-sided resize or a matte
+// re-fits anything with the same aspect ratio. A resize that sets both
+// sides may change the aspect, which a one-sided resize after it derives
+// its other side from, so it is only dropped before one that sets both.
+static bool resizeFusedInto(const PipelineStep &step, const PipelineStep *next)
+{
+    if (step.op != PipelineStep::Op::Resize || !next)
+        return false;
+    bool keepsAspect = step.width == 0 || step.height == 0;
+    if (next->op == PipelineStep::Op::Resize)
+        return (next->width > 0 && next->height > 0) || keepsAspect;
+    return next->op == PipelineStep::Op::Matte && keepsAspect;
+}
+
+bool runPipeline(const Mat &input, const std::vector<PipelineStep> &steps, Mat &output,
+                 std::ostream &log, std::string &err, Metrics *metrics)
+{
+    // current is a header: crops narrow it in place, and every other step
+    // replaces it with a buffer it owns
+    Mat current = input;
+    int fused = 0;
+    for (size_t i = 0; i < steps.size(); ++i)
+    {
+        const PipelineStep &step = steps[i];
+        const PipelineStep *next = i + 1 < steps.size() ? &steps[i + 1] : nullptr;
+        std::string msg;
+        bool ok = true;
+
+        if (resizeFusedInto(step, next))
+        {
+            log << "Step " << i + 1 << " (resize) fused into step " << i + 2 << " (" << stepName(next->op)
+                << ")" << std::endl;
+            ++fused;
+            continue;
+        }
+
+        switch (step.op)
+        {
+        case PipelineStep::Op::Crop:
+        {
+            CropParams params = step.crop;
+            if (step.cropCanvas)
+            {
+                Mat fitted;
+                ok = cropAndFit(current, params, fitted, msg, metrics);
+                current = fitted;
+                break;
+            }
+            // A plain crop costs nothing: the next step resamples from the view
+            Rect crop, placed;
+            params.outputWidth = current.cols;
+            params.outputHeight = current.rows;
+            ok = cropLayout(current.cols, current.rows, params, crop, placed, msg);
+            if (ok)
+                current = current(crop);
+            break;
+        }
+        case PipelineStep::Op::Extend:
+        {
+            ExtendResult result;
+            ok = extendCanvas(current, step.extend, result, log, msg, metrics);
+            current = result.image;
+            break;
+        }
+        case PipelineStep::Op::Matte:
+        {
+            Mat canvas;
+            ok = createMatte(current, step.matte, canvas, msg, metrics);
+            current = canvas;
+            break;
+        }
+        default:
+        {
+            // One side alone keeps the aspect ratio
+            int w = step.width, h = step.height;
+            if (w == 0)
+                w = std::max(1, static_cast<int>(std::lround(static_cast<double>(current.cols) * h / current.rows)));
+            if (h == 0)
+                h = std::max(1, static_cast<int>(std::lround(static_cast<double>(current.rows) * w / current.cols)));
+            if (w == current.cols && h == current.rows)
+                break;
+            StageTimer timer(metrics, "resize");
+            Mat resized(h, w, current.type());
+            resampleInto(current, resized, step.quality);
+            current = resized;
+            break;
+        }
+        }
+
+        if (!ok)
+        {
+            err = "Step " + std::to_string(i + 1) + " (" + stepName(step.op) + "): " + msg;
+            return false;
+        }
+    }
+
+    output = current;
+    if (metrics)
+    {
+        metrics->set("steps", static_cast<long>(steps.size()));
+        metrics->set("fused_steps", static_cast<long>(fused));
+    }
+    return true;
+}
+
+} // namespace canvasops
@@ -0,0 +1,59 @@
+// pipeline.hpp
+// Multi-step jobs: an ordered list of crop, extend, matte and resize steps
+// run on in-memory Mats, so a chain that used to be one tool run (decode,
+// process, encode) per step decodes once and encodes once. Used by
+// canvas_pipeline and canvas_worker's pipeline op.
+//
+// Steps are written "<op> key=value ..." (or with commas for the spaces,
+// "crop,x=0,width=800", so a step is one token of a worker request):
+//   crop   x= y= width= height= [preview-width= preview-height=]
+//          [output-width= output-height= scale= quality=]  (image_cropper's canvas)
+//   extend height= [pad= threshold= requested-width= requested-height= sample= mode= quality=]
+//   matte  width= height= [padding= color=]
+//   resize [width=] [height=] [quality=]  (one side alone keeps the aspect ratio)
+//
+// Adjacent steps are fused where it cannot change the result (or only
+// improves it): a crop without an output canvas is a view, read directly
+// by the next step's resample; of consecutive resizes only the last runs,
+// from the image before them; and a resize that keeps the aspect ratio is
+// dropped before a matte, which re-fits its input anyway.
+#pragma once
+
+#include "canvas_ops.hpp"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace canvasops
+{
+
+struct PipelineStep
+{
+    enum class Op
+    {
+        Crop,
+        Extend,
+        Matte,
+        Resize
+    };
+    Op op = Op::Crop;
+    CropParams crop;
+    bool cropCanvas = false; // crop with output-width/height: fitted onto a black canvas
+    ExtendParams extend;
+    MatteParams matte;
+    int width = 0, height = 0; // resize; 0 follows the other side's scale
+    ResizeQuality quality = ResizeQuality::Best;
+};
+
+// Parses one step; err says which token was wrong.
+bool parsePipelineStep(const std::string &spec, PipelineStep &step, std::string &err);
+
+// Canonical spelling of a parsed step, defaults filled in (for cache keys).
+std::string pipelineStepKey(const PipelineStep &step);
+
+// Runs the steps on input. output may be a view into input (e.g. a lone crop).
+bool runPipeline(const cv::Mat &input, const std::vector<PipelineStep> &steps, cv::Mat &output,
+                 std::ostream &log, std::string &err, Metrics *metrics = nullptr);
+
+} // namespace canvasops
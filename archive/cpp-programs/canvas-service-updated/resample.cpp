@@ -0,0 +1,324 @@
+// resample.cpp
+// Coefficient tables, row passes and band scheduling for resample.hpp.
+#include "resample.hpp"
+#include "mat_pool.hpp"
+#include "thread_pool.hpp"
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <future>
+#include <vector>
+
+using namespace cv;
+
+bool parseResizeQuality(const std::string &name, ResizeQuality &quality)
+{
+    if (name == "fast")
+        quality = ResizeQuality::Fast;
+    else if (name == "balanced")
+        quality = ResizeQuality::Balanced;
+    else if (name == "best")
+        quality = ResizeQuality::Best;
+    else
+        return false;
+    return true;
+}
+
+const char *resizeQualityName(ResizeQuality quality)
+{
+    return quality == ResizeQuality::Fast       ? "fast"
+           : quality == ResizeQuality::Balanced ? "balanced"
+                                                : "best";
+}
+
+void resampleInto(const Mat &src, Mat dst, ResizeQuality quality)
+{
+    if (src.empty() || dst.empty())
+        return;
+    const bool shrink = dst.cols <= src.cols && dst.rows <= src.rows;
+    const bool shrink2x = 2 * dst.cols <= src.cols && 2 * dst.rows <= src.rows;
+
+    // resize() writes into dst in place: it already has the size and type
+    if (quality == ResizeQuality::Fast)
+        resize(src, dst, dst.size(), 0, 0, shrink ? INTER_AREA : INTER_LINEAR);
+    else if (quality == ResizeQuality::Balanced && shrink2x)
+        resize(src, dst, dst.size(), 0, 0, INTER_AREA);
+    else
+        resampleFilter(src, dst, quality == ResizeQuality::Best ? ResampleFilter::Lanczos3 : ResampleFilter::Mitchell);
+}
+
+//---------------------------------------------------------------------
+static double lanczos3(double x)
+{
+    x = std::fabs(x);
+    if (x < 1e-8)
+        return 1.0;
+    if (x >= 3.0)
+        return 0.0;
+    double px = CV_PI * x;
+    return 3.0 * std::sin(px) * std::sin(px / 3.0) / (px * px);
+}
+
+// Mitchell-Netravali with B = C = 1/3
+static double mitchell(double x)
+{
+    const double B = 1.0 / 3.0, C = 1.0 / 3.0;
+    x = std::fabs(x);
+    if (x < 1.0)
+        return ((12 - 9 * B - 6 * C) * x * x * x + (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) / 6.0;
+    if (x < 2.0)
+        return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x + (-12 * B - 48 * C) * x + (8 * B + 24 * C)) / 6.0;
+    return 0.0;
+}
+
+// Output i reads source [first[i], first[i] + taps) with weights
+// weights[i * taps ...]. Every output has the same tap count; edge taps
+// that would fall outside the source are folded onto the border pixel.
+struct Coeffs
+{
+    int taps = 0;
+    std::vector<int> first;
+    std::vector<float> weights;
+};
+
+static Coeffs buildCoeffs(int srcN, int dstN, ResampleFilter filter)
+{
+    const double radius = filter == ResampleFilter::Lanczos3 ? 3.0 : 2.0;
+    const double scale = static_cast<double>(srcN) / dstN;
+    const double stretch = std::max(scale, 1.0); // widen the kernel to shrink
+    const double support = radius * stretch;
+
+    Coeffs c;
+    c.taps = std::min(srcN, static_cast<int>(std::ceil(2 * support)) + 1);
+    c.first.resize(dstN);
+    c.weights.assign(static_cast<size_t>(dstN) * c.taps, 0.0f);
+    std::vector<double> w(c.taps);
+    for (int i = 0; i < dstN; ++i)
+    {
+        double center = (i + 0.5) * scale - 0.5;
+        int lo = static_cast<int>(std::floor(center - support)) + 1;
+        int hi = static_cast<int>(std::floor(center + support));
+        int first = std::clamp(lo, 0, srcN - c.taps);
+
+        std::fill(w.begin(), w.end(), 0.0);
+        double sum = 0;
+        for (int j = lo; j <= hi; ++j)
+        {
+            double k = filter == ResampleFilter::Lanczos3 ? lanczos3((j - center) / stretch)
+                                                          : mitchell((j - center) / stretch);
+            w[std::clamp(j, 0, srcN - 1) - first] += k;
+            sum += k;
+        }
+        c.first[i] = first;
+        for (int t = 0; t < c.taps; ++t)
+            c.weights[static_cast<size_t>(i) * c.taps + t] = static_cast<float>(sum != 0 ? w[t] / sum : 0);
+    }
+    return c;
+}
+
+#if CV_SIMD
+// Vector part of one output's taps: adds into s and returns how many taps
+// it covered, for the scalar loop to finish. Three and four channels hold
+// one pixel per vector, one FMA per tap; a three-channel load also reads
+// the next pixel's first channel (widened rows carry a float of padding)
+// and that lane is dropped.
+template <int CN>
+static int horizontalTaps(const float *p, const float *w, int taps, float *s)
+{
+    v_float32x4 acc = v_setzero_f32();
+    for (int t = 0; t < taps; ++t)
+        acc = v_muladd(v_load(p + t * CN), v_setall_f32(w[t]), acc);
+    float lanes[4];
+    v_store(lanes, acc);
+    for (int ch = 0; ch < CN; ++ch)
+        s[ch] += lanes[ch];
+    return taps;
+}
+
+// One channel: a dot product along the taps
+template <>
+int horizontalTaps<1>(const float *p, const float *w, int taps, float *s)
+{
+    v_float32 acc = vx_setzero_f32();
+    int t = 0;
+    for (; t + v_float32::nlanes <= taps; t += v_float32::nlanes)
+        acc = v_muladd(vx_load(p + t), vx_load(w + t), acc);
+    s[0] += v_reduce_sum(acc);
+    return t;
+}
+
+// Two channels: two taps per vector, lanes ch0 ch1 ch0 ch1
+template <>
+int horizontalTaps<2>(const float *p, const float *w, int taps, float *s)
+{
+    v_float32x4 acc = v_setzero_f32();
+    int t = 0;
+    for (; t + 2 <= taps; t += 2)
+        acc = v_muladd(v_load(p + t * 2), v_float32x4(w[t], w[t], w[t + 1], w[t + 1]), acc);
+    float lanes[4];
+    v_store(lanes, acc);
+    s[0] += lanes[0] + lanes[2];
+    s[1] += lanes[1] + lanes[3];
+    return t;
+}
+#endif
+
+// in is a source row widened to float
+template <int CN>
+static void horizontalRow(const float *in, float *out, const Coeffs &cx, int dstW)
+{
+    const int taps = cx.taps;
+    for (int x = 0; x < dstW; ++x)
+    {
+        const float *w = &cx.weights[static_cast<size_t>(x) * taps];
+        const float *p = in + cx.first[x] * CN;
+        float s[CN] = {};
+        int t = 0;
+#if CV_SIMD
+        t = horizontalTaps<CN>(p, w, taps, s);
+#endif
+        for (; t < taps; ++t)
+            for (int ch = 0; ch < CN; ++ch)
+                s[ch] += w[t] * p[t * CN + ch];
+        for (int ch = 0; ch < CN; ++ch)
+            out[x * CN + ch] = s[ch];
+    }
+}
+
+static void horizontalRow(const float *in, float *out, const Coeffs &cx, int dstW, int cn)
+{
+    switch (cn)
+    {
+    case 1:
+        return horizontalRow<1>(in, out, cx, dstW);
+    case 2:
+        return horizontalRow<2>(in, out, cx, dstW);
+    case 3:
+        return horizontalRow<3>(in, out, cx, dstW);
+    default:
+        return horizontalRow<4>(in, out, cx, dstW);
+    }
+}
+
+// acc[0..n) += w * row[0..n)
+static void accumulateRow(float *acc, const float *row, float w, int n)
+{
+    int i = 0;
+#if CV_SIMD
+    const v_float32 vw = vx_setall_f32(w);
+    for (; i + v_float32::nlanes <= n; i += v_float32::nlanes)
+        v_store(acc + i, v_muladd(vx_load(row + i), vw, vx_load(acc + i)));
+#endif
+    for (; i < n; ++i)
+        acc[i] += w * row[i];
+}
+
+// Output rows [y0, y1). Horizontally filtered source rows live in a ring of
+// cy.taps rows, indexed by source row; first[] never decreases, so a row is
+// only overwritten once no later output needs it.
+static void resampleBand(const Mat &src, Mat &dst, const Coeffs &cx, const Coeffs &cy, int y0, int y1)
+{
+    const int cn = src.channels();
+    const int rowLen = dst.cols * cn;
+    const int ring = cy.taps;
+    std::vector<float> rows(static_cast<size_t>(ring) * rowLen);
+    std::vector<float> acc(rowLen);
+    // Each source row is widened to float once, so the taps run in vectors
+    std::vector<float> wide(static_cast<size_t>(src.cols) * cn + 1);
+    Mat wideRow(1, src.cols * cn, CV_32F, wide.data());
+
+    int next = cy.first[y0]; // first source row not yet filtered
+    for (int y = y0; y < y1; ++y)
+    {
+        const int first = cy.first[y];
+        next = std::max(next, first);
+        for (; next < first + cy.taps; ++next)
+        {
+            src.row(next).reshape(1).convertTo(wideRow, CV_32F);
+            horizontalRow(wide.data(), &rows[static_cast<size_t>(next % ring) * rowLen], cx, dst.cols, cn);
+        }
+
+        std::fill(acc.begin(), acc.end(), 0.0f);
+        const float *wy = &cy.weights[static_cast<size_t>(y) * cy.taps];
+        for (int t = 0; t < cy.taps; ++t)
+        {
+            if (wy[t] != 0.0f)
+                accumulateRow(acc.data(), &rows[static_cast<size_t>((first + t) % ring) * rowLen], wy[t], rowLen);
+        }
+        Mat outRow(1, rowLen, CV_8U, dst.ptr<uchar>(y));
+        Mat(1, rowLen, CV_32F, acc.data()).convertTo(outRow, CV_8U); // rounds and saturates
+    }
+}
+
+static std::atomic<unsigned> resampleThreads(0);
+
+static ThreadPool &resamplePool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void setResampleThreads(unsigned threads)
+{
+    resampleThreads = threads;
+}
+
+unsigned resampleThreadCount()
+{
+    return resampleThreads ? resampleThreads.load() : static_cast<unsigned>(resamplePool().size());
+}
+
+void resampleFilter(const Mat &src, Mat dst, ResampleFilter filter)
+{
+    if (src.empty() || dst.empty())
+        return;
+    CV_Assert(src.depth() == CV_8U && src.channels() <= 4 && dst.type() == src.type());
+
+    const Coeffs cx = buildCoeffs(src.cols, dst.cols, filter);
+    const Coeffs cy = buildCoeffs(src.rows, dst.rows, filter);
+
+    // Bands of at least 16 rows; each re-filters up to cy.taps source rows
+    // at its top edge, which is cheap next to the band itself.
+    ThreadPool &pool = resamplePool();
+    unsigned threads = resampleThreadCount();
+    int bands = std::max(1, std::min(static_cast<int>(threads), dst.rows / 16));
+    MatByteCounter *job = MatByteCounter::current();
+    std::vector<std::future<void>> pending;
+    for (int b = 1; b < bands; ++b)
+    {
+        int y0 = dst.rows * b / bands, y1 = dst.rows * (b + 1) / bands;
+        pending.push_back(pool.submit([&, y0, y1]()
+                                      {
+                                          MatByteScope scope(job);
+                                          resampleBand(src, dst, cx, cy, y0, y1);
+                                      }));
+    }
+    // The pool tasks reference this frame: wait for all of them before
+    // letting any failure out.
+    std::exception_ptr failure;
+    try
+    {
+        resampleBand(src, dst, cx, cy, 0, dst.rows / bands);
+    }
+    catch (...)
+    {
+        failure = std::current_exception();
+    }
+    for (std::future<void> &f : pending)
+    {
+        try
+        {
+            f.get();
+        }
+        catch (...)
+        {
+            if (!failure)
+                failure = std::current_exception();
+        }
+    }
+    if (failure)
+        std::rethrow_exception(failure);
+}
@@ -0,0 +1,42 @@
+// resample.hpp
+// Separable resampler for the output-fit resizes. Filter coefficients are
+// precomputed per output row and column, the vertical pass is vectorised
+// with OpenCV's universal intrinsics (SSE/AVX2/NEON, whatever the build
+// targets), and output rows are split across a thread pool of our own, as
+// OpenCV's resize may run on one thread depending on how it was built.
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+
+enum class ResizeQuality
+{
+    Fast,     // INTER_AREA to shrink, INTER_LINEAR to enlarge
+    Balanced, // INTER_AREA when shrinking 2x or more, else Mitchell-Netravali
+    Best,     // Lanczos3, widened when shrinking so it also antialiases
+};
+
+// "fast" | "balanced" | "best"; false for anything else.
+bool parseResizeQuality(const std::string &name, ResizeQuality &quality);
+const char *resizeQualityName(ResizeQuality quality);
+
+// Resize 8-bit src into dst's pixels at dst's size; dst may be a view
+// into a larger image. Nothing happens when either is empty.
+void resampleInto(const cv::Mat &src, cv::Mat dst, ResizeQuality quality);
+
+enum class ResampleFilter
+{
+    Lanczos3,
+    Mitchell,
+};
+
+// The separable kernel itself (1-4 channels), for resampleInto and the
+// benchmark.
+void resampleFilter(const cv::Mat &src, cv::Mat dst, ResampleFilter filter);
+
+// Threads resampleFilter spreads rows over (0 = one per hardware thread).
+// Batch mode sets 1, since it already keeps every core busy with images.
+void setResampleThreads(unsigned threads);
+// What resampleFilter uses now: the setResampleThreads value, else the
+// pool's size. Other per-image parallelism follows the same limit.
+unsigned resampleThreadCount();
@@ -0,0 +1,109 @@
+// result_cache.cpp
+// Memory and disk tiers of the worker result cache (see result_cache.hpp).
+#include "result_cache.hpp"
+#include "sha256.hpp"
+
+#include <cstdio>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+ResultCache::ResultCache(size_t memoryBytes, const std::string &diskDir)
+    : memory_(memoryBytes, [](const CachedResult &r)
+              { return r.message.size() + r.payload.size(); }),
+      diskDir_(diskDir)
+{
+}
+
+std::string ResultCache::makeKey(const std::vector<unsigned char> &input, const std::string &paramKey)
+{
+    return Sha256::hex(input.data(), input.size()) + " " + paramKey;
+}
+
+std::string ResultCache::makeSourceKey(const std::string &source, const std::string &paramKey)
+{
+    return "source:" + source + " " + paramKey;
+}
+
+std::shared_ptr<const CachedResult> ResultCache::find(const std::string &key)
+{
+    std::shared_ptr<const CachedResult> hit = memory_.get(key);
+    if (hit)
+    {
+        ++hits_;
+        return hit;
+    }
+    if (!diskDir_.empty() && (hit = readDisk(key)))
+    {
+        ++diskHits_;
+        memory_.put(key, hit);
+        return hit;
+    }
+    ++misses_;
+    return nullptr;
+}
+
+void ResultCache::store(const std::string &key, std::shared_ptr<const CachedResult> result)
+{
+    if (!diskDir_.empty())
+        writeDisk(key, *result);
+    memory_.put(key, std::move(result));
+}
+
+std::string ResultCache::stats() const
+{
+    std::ostringstream out;
+    out << "hits=" << hits_ << " disk_hits=" << diskHits_ << " misses=" << misses_
+        << " entries=" << memory_.size() << " bytes=" << memory_.bytes();
+    return out.str();
+}
+
+//---------------------------------------------------------------------
+// One file per entry, named by the hash of the key:
+//   <key>\n<msgbytes> <nbytes>\n<message><payload>
+std::string ResultCache::diskPath(const std::string &key) const
+{
+    return diskDir_ + "/" + Sha256::hex(key.data(), key.size()) + ".result";
+}
+
+std::shared_ptr<const CachedResult> ResultCache::readDisk(const std::string &key) const
+{
+    FILE *f = fopen(diskPath(key).c_str(), "rb");
+    if (!f)
+        return nullptr;
+
+    std::shared_ptr<CachedResult> result;
+    std::string storedKey(key.size(), '\0');
+    size_t msgBytes = 0, nbytes = 0;
+    if (fread(&storedKey[0], 1, storedKey.size(), f) == storedKey.size() && storedKey == key &&
+        fscanf(f, "\n%zu %zu", &msgBytes, &nbytes) == 2 && fgetc(f) == '\n')
+    {
+        result = std::make_shared<CachedResult>();
+        result->message.resize(msgBytes);
+        result->payload.resize(nbytes);
+        if ((msgBytes > 0 && fread(&result->message[0], 1, msgBytes, f) != msgBytes) ||
+            (nbytes > 0 && fread(result->payload.data(), 1, nbytes, f) != nbytes))
+            result.reset(); // truncated: treat as a miss
+    }
+    fclose(f);
+    return result;
+}
+
+void ResultCache::writeDisk(const std::string &key, const CachedResult &result) const
+{
+    // Write to a private name and rename, so readers never see half a file.
+    std::string path = diskPath(key);
+    std::string tmp = path + ".tmp" + std::to_string(getpid()) + "." +
+                      std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return;
+    bool ok = fwrite(key.data(), 1, key.size(), f) == key.size() &&
+              fprintf(f, "\n%zu %zu\n", result.message.size(), result.payload.size()) > 0 &&
+              fwrite(result.message.data(), 1, result.message.size(), f) == result.message.size() &&
+              fwrite(result.payload.data(), 1, result.payload.size(), f) == result.payload.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+        unlink(tmp.c_str());
+}
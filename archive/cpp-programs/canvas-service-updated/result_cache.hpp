@@ -0,0 +1,45 @@
+// result_cache.hpp
+// Cache of finished worker responses, keyed by the SHA-256 of the encoded
+// input plus the job's normalised parameters. An in-memory LRU sits in
+// front of an optional directory of one file per entry, which several
+// workers (or restarts) can share.
+#pragma once
+
+#include "lru_cache.hpp"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct CachedResult
+{
+    std::string message;               // the tool's stdout
+    std::vector<unsigned char> payload; // encoded output image
+};
+
+class ResultCache
+{
+public:
+    // diskDir empty → memory only. The directory is not pruned here; point
+    // it at a volume with its own cleanup (tmpfs, cron, ...).
+    ResultCache(size_t memoryBytes, const std::string &diskDir);
+
+    static std::string makeKey(const std::vector<unsigned char> &input, const std::string &paramKey);
+    // For inputs named by a source key (URL + ETag) instead of their bytes.
+    static std::string makeSourceKey(const std::string &source, const std::string &paramKey);
+
+    std::shared_ptr<const CachedResult> find(const std::string &key);
+    void store(const std::string &key, std::shared_ptr<const CachedResult> result);
+
+    std::string stats() const;
+
+private:
+    std::string diskPath(const std::string &key) const;
+    std::shared_ptr<const CachedResult> readDisk(const std::string &key) const;
+    void writeDisk(const std::string &key, const CachedResult &result) const;
+
+    LruCache<CachedResult> memory_;
+    std::string diskDir_;
+    std::atomic<unsigned long> hits_{0}, diskHits_{0}, misses_{0};
+};
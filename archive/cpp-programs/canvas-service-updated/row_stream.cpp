@@ -0,0 +1,190 @@
+// row_stream.cpp
+// Row sources and the streaming resampler (see row_stream.hpp).
+#include "row_stream.hpp"
+
+#include <cmath>
+#include <cstring>
+
+using namespace cv;
+
+namespace canvasops
+{
+
+//---------------------------------------------------------------------
+FillRowSource::FillRowSource(int width, int height, const Scalar &color)
+    : row_(1, width, CV_8UC3, color), height_(height)
+{
+}
+
+//---------------------------------------------------------------------
+// Bring the parent to the first row of the window on first use.
+bool RangeRowSource::seek()
+{
+    int ahead = roi_.y + position() - src_.position();
+    return ahead <= 0 || src_.skip(ahead);
+}
+
+const uchar *RangeRowSource::readRow()
+{
+    if (!seek())
+        return nullptr;
+    const uchar *row = src_.next();
+    return row ? row + roi_.x * 3 : nullptr;
+}
+
+bool RangeRowSource::skipRows(int n)
+{
+    return seek() && src_.skip(n);
+}
+
+//---------------------------------------------------------------------
+ResizeRowSource::Taps ResizeRowSource::buildTaps(int srcN, int dstN)
+{
+    Taps t;
+    const double f = static_cast<double>(srcN) / dstN;
+    t.offsets.reserve(dstN + 1);
+    t.offsets.push_back(0);
+    for (int j = 0; j < dstN; ++j)
+    {
+        if (f >= 1.0)
+        {
+            // Area: output j covers source [j*f, (j+1)*f)
+            double a = j * f, b = std::min((j + 1) * f, static_cast<double>(srcN));
+            for (int i = static_cast<int>(a); i < srcN && i < b; ++i)
+            {
+                double w = std::min(b, i + 1.0) - std::max(a, static_cast<double>(i));
+                if (w > 1e-9)
+                    t.taps.push_back({i, static_cast<float>(w / f)});
+            }
+        }
+        else
+        {
+            // Linear between the two nearest source centres
+            double sx = (j + 0.5) * f - 0.5;
+            int i0 = static_cast<int>(std::floor(sx));
+            float u = static_cast<float>(sx - i0);
+            int a = std::clamp(i0, 0, srcN - 1), b = std::clamp(i0 + 1, 0, srcN - 1);
+            if (a == b)
+                t.taps.push_back({a, 1.0f});
+            else
+            {
+                t.taps.push_back({a, 1.0f - u});
+                t.taps.push_back({b, u});
+            }
+        }
+        t.offsets.push_back(static_cast<int>(t.taps.size()));
+    }
+    return t;
+}
+
+ResizeRowSource::ResizeRowSource(RowSource &src, int dstW, int dstH)
+    : src_(src), dstW_(dstW), dstH_(dstH),
+      xTaps_(buildTaps(src.width(), dstW)), yTaps_(buildTaps(src.height(), dstH)),
+      out_(static_cast<size_t>(dstW) * 3)
+{
+}
+
+const uchar *ResizeRowSource::readRow()
+{
+    const int j = position();
+    const Tap *yBegin = &yTaps_.taps[yTaps_.offsets[j]];
+    const Tap *yEnd = yBegin + (yTaps_.offsets[j + 1] - yTaps_.offsets[j]);
+    const int firstRow = yBegin->index;
+    const int lastRow = (yEnd - 1)->index;
+
+    // Drop rows the remaining output no longer needs
+    while (!window_.empty() && window_.front().first < firstRow)
+    {
+        spare_.push_back(std::move(window_.front().second));
+        window_.pop_front();
+    }
+
+    // Pull and horizontally resample source rows up to lastRow
+    while (window_.empty() || window_.back().first < lastRow)
+    {
+        const uchar *in = src_.next();
+        if (!in)
+            return nullptr;
+        int index = src_.position() - 1;
+        if (index < firstRow)
+            continue;
+
+        std::vector<float> row;
+        if (!spare_.empty())
+        {
+            row = std::move(spare_.back());
+            spare_.pop_back();
+        }
+        row.assign(static_cast<size_t>(dstW_) * 3, 0.0f);
+        for (int x = 0; x < dstW_; ++x)
+        {
+            float b = 0, g = 0, r = 0;
+            for (int k = xTaps_.offsets[x]; k < xTaps_.offsets[x + 1]; ++k)
+            {
+                const Tap &tap = xTaps_.taps[k];
+                const uchar *p = in + tap.index * 3;
+                b += tap.weight * p[0];
+                g += tap.weight * p[1];
+                r += tap.weight * p[2];
+            }
+            row[x * 3] = b;
+            row[x * 3 + 1] = g;
+            row[x * 3 + 2] = r;
+        }
+        window_.emplace_back(index, std::move(row));
+    }
+
+    // Vertical pass over the buffered rows
+    const int n = dstW_ * 3;
+    std::vector<float> acc(n, 0.0f);
+    for (const Tap *tap = yBegin; tap != yEnd; ++tap)
+    {
+        const std::vector<float> &row = window_[tap->index - window_.front().first].second;
+        for (int i = 0; i < n; ++i)
+            acc[i] += tap->weight * row[i];
+    }
+    for (int i = 0; i < n; ++i)
+        out_[i] = saturate_cast<uchar>(acc[i]);
+    return out_.data();
+}
+
+//---------------------------------------------------------------------
+ConcatRowSource::ConcatRowSource(const std::vector<RowSource *> &parts)
+    : parts_(parts)
+{
+    for (const RowSource *p : parts_)
+    {
+        width_ = std::max(width_, p->width());
+        height_ += p->height();
+    }
+}
+
+const uchar *ConcatRowSource::readRow()
+{
+    while (current_ < parts_.size())
+    {
+        const uchar *row = parts_[current_]->next();
+        if (row)
+            return row;
+        if (parts_[current_]->position() < parts_[current_]->height())
+            return nullptr; // the part failed, not just ran out
+        ++current_;
+    }
+    return nullptr;
+}
+
+//---------------------------------------------------------------------
+bool drainInto(RowSource &src, Mat dst)
+{
+    const size_t rowBytes = static_cast<size_t>(dst.cols) * dst.elemSize();
+    for (int y = 0; y < dst.rows; ++y)
+    {
+        const uchar *row = src.next();
+        if (!row)
+            return false;
+        std::memcpy(dst.ptr<uchar>(y), row, rowBytes);
+    }
+    return true;
+}
+
+} // namespace canvasops
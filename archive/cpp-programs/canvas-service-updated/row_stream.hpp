@@ -0,0 +1,173 @@
+// row_stream.hpp
+// Pull-based streams of BGR rows, used by the --stream modes so that a
+// large input never has to be resident in memory at once. A RowSource hands
+// out one row at a time, top to bottom; sources can be cropped, resized and
+// concatenated while only a handful of rows are buffered.
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <deque>
+#include <vector>
+
+namespace canvasops
+{
+
+class RowSource
+{
+public:
+    virtual ~RowSource() {}
+
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+
+    // Next row as width() * 3 BGR bytes, valid until the following call.
+    // Returns nullptr past the last row or when the underlying decode fails.
+    const uchar *next()
+    {
+        const uchar *row = row_ < height() ? readRow() : nullptr;
+        if (row)
+            ++row_;
+        return row;
+    }
+
+    // Discard the next n rows.
+    bool skip(int n)
+    {
+        n = std::min(n, height() - row_);
+        if (n <= 0)
+            return true;
+        bool ok = skipRows(n);
+        row_ += n;
+        return ok;
+    }
+
+    // Index of the row the next call to next() returns.
+    int position() const { return row_; }
+
+protected:
+    virtual const uchar *readRow() = 0;
+    virtual bool skipRows(int n)
+    {
+        while (n-- > 0)
+        {
+            if (!readRow())
+                return false;
+        }
+        return true;
+    }
+
+private:
+    int row_ = 0;
+};
+
+// Rows of an in-memory image (used when the input is not a JPEG).
+class MatRowSource : public RowSource
+{
+public:
+    explicit MatRowSource(const cv::Mat &img) : img_(img) {}
+    int width() const override { return img_.cols; }
+    int height() const override { return img_.rows; }
+
+protected:
+    const uchar *readRow() override { return img_.ptr<uchar>(position()); }
+    bool skipRows(int) override { return true; }
+
+private:
+    cv::Mat img_;
+};
+
+// Rows filled with a constant colour.
+class FillRowSource : public RowSource
+{
+public:
+    FillRowSource(int width, int height, const cv::Scalar &color);
+    int width() const override { return row_.cols; }
+    int height() const override { return height_; }
+
+protected:
+    const uchar *readRow() override { return row_.ptr<uchar>(); }
+    bool skipRows(int) override { return true; }
+
+private:
+    cv::Mat row_;
+    int height_;
+};
+
+// A window [x, x+w) x [y, y+h) of another source. The parent is read
+// sequentially, so windows taken from one parent must be consumed in
+// top-to-bottom order.
+class RangeRowSource : public RowSource
+{
+public:
+    RangeRowSource(RowSource &src, const cv::Rect &roi) : src_(src), roi_(roi) {}
+    int width() const override { return roi_.width; }
+    int height() const override { return roi_.height; }
+
+protected:
+    const uchar *readRow() override;
+    bool skipRows(int n) override;
+
+private:
+    bool seek();
+
+    RowSource &src_;
+    cv::Rect roi_;
+};
+
+// Separable resample of another source to dstW x dstH. Downscales average
+// the covered source area (like INTER_AREA), upscales interpolate linearly.
+// Only the source rows under the current output row are kept, as floats.
+class ResizeRowSource : public RowSource
+{
+public:
+    ResizeRowSource(RowSource &src, int dstW, int dstH);
+    int width() const override { return dstW_; }
+    int height() const override { return dstH_; }
+
+protected:
+    const uchar *readRow() override;
+
+private:
+    struct Tap
+    {
+        int index;
+        float weight;
+    };
+    struct Taps
+    {
+        std::vector<int> offsets; // taps for output i: [offsets[i], offsets[i+1])
+        std::vector<Tap> taps;
+    };
+    static Taps buildTaps(int srcN, int dstN);
+
+    RowSource &src_;
+    int dstW_, dstH_;
+    Taps xTaps_, yTaps_;
+    std::deque<std::pair<int, std::vector<float>>> window_; // (source row, resampled row)
+    std::vector<std::vector<float>> spare_;
+    std::vector<uchar> out_;
+};
+
+// Rows of several sources one after another; all must share a width. The
+// parts are not owned.
+class ConcatRowSource : public RowSource
+{
+public:
+    explicit ConcatRowSource(const std::vector<RowSource *> &parts);
+    int width() const override { return width_; }
+    int height() const override { return height_; }
+
+protected:
+    const uchar *readRow() override;
+
+private:
+    std::vector<RowSource *> parts_;
+    size_t current_ = 0;
+    int width_ = 0, height_ = 0;
+};
+
+// Copy every row of src into dst (a view of matching size). Returns false
+// if the source ended early.
+bool drainInto(RowSource &src, cv::Mat dst);
+
+} // namespace canvasops
@@ -1,17 +1,241 @@
 // Canvas Extension Service v6.2 - Fixed aspect ratio preservation in extend_canvas.cpp
 // Updated: 2025-01-18 - Resolves vertical stretching issues with requestedWidth/Height parameters
 const express = require("express");
-const { exec } = require("child_process");
-const { promisify } = require("util");
 const fs = require("fs").promises;
+const os = require("os");
 const path = require("path");
-const { v4: uuidv4 } = require("uuid");
 const cors = require("cors");
+const { CanvasWorkerPool, cpuVariantPath } = require("./worker-pool");
+const { SourceRegistry } = require("./source-registry");
+const { CanvasOpsEngine, addonAvailable } = require("./canvas-ops");
 
-const execAsync = promisify(exec);
 const app = express();
 const PORT = process.env.PORT || 3000;
 
+// Long-lived canvas_worker processes run extend/matte/crop jobs without a
+// fork/exec per request. Each keeps a result cache of CANVAS_CACHE_MB; with
+// CANVAS_CACHE_DIR set, results are also shared between workers on disk.
+//
+// The workers split the cores between them and run one job per core at
+// most (CANVAS_JOBS per worker), each job's OpenCV threads scaled down to
+// match, within CANVAS_MEMORY_MB of estimated job memory. Past that jobs
+// queue by priority, up to CANVAS_QUEUE, and the rest get a 503.
+// Images with an x86-64-v3 build of the worker run it where the CPU can.
+// CANVAS_WORKER_PATH points at another worker binary (the tests use one).
+const workerBinaryPath = cpuVariantPath(
+  process.env.CANVAS_WORKER_PATH || path.join("/app", "canvas_worker")
+);
+const cores = os.cpus().length;
+const workerCount =
+  parseInt(process.env.CANVAS_WORKERS, 10) || Math.min(2, cores);
+const workerThreads = Math.max(1, Math.ceil(cores / workerCount));
+const workerJobs = parseInt(process.env.CANVAS_JOBS, 10) || workerThreads;
+const memoryMb =
+  parseInt(process.env.CANVAS_MEMORY_MB, 10) ||
+  Math.floor((os.totalmem() / 1048576) * 0.6);
+const queueDepth = parseInt(process.env.CANVAS_QUEUE, 10) || 64;
+const workerArgs = [
+  "--cache-mb",
+  process.env.CANVAS_CACHE_MB || "64",
+  "--threads",
+  workerThreads.toString(),
+  "--jobs",
+  workerJobs.toString(),
+  "--memory-mb",
+  Math.floor(memoryMb / workerCount).toString(),
+  "--queue",
+  queueDepth.toString(),
+];
+if (process.env.CANVAS_CACHE_DIR) {
+  workerArgs.push("--cache-dir", process.env.CANVAS_CACHE_DIR);
+}
+// Each worker is sent twice its job count, so it has queued jobs to put
+// in priority order; the rest wait in the pool.
+const workerPool = new CanvasWorkerPool(
+  workerBinaryPath,
+  workerCount,
+  workerArgs,
+  { slots: workerJobs * 2, maxQueued: queueDepth }
+);
+
+// CANVAS_ENGINE=addon runs the jobs inside this process through the
+// canvas_ops addon instead (no worker processes or pipe copies); its
+// concurrency follows UV_THREADPOOL_SIZE.
+let engine = workerPool;
+if (process.env.CANVAS_ENGINE === "addon") {
+  if (addonAvailable) {
+    engine = new CanvasOpsEngine({ maxQueued: queueDepth });
+  } else {
+    console.warn(
+      "CANVAS_ENGINE=addon but the addon is not built; using workers"
+    );
+  }
+}
+
+// Source images fetched in the last CANVAS_SOURCE_TTL_MS are not downloaded
+// or decoded again; the worker that decoded them serves follow-up jobs.
+const sources = new SourceRegistry(engine, {
+  ttlMs: parseInt(process.env.CANVAS_SOURCE_TTL_MS, 10) || 60000,
+});
+
+// Inputs at least this large (encoded bytes) are processed with --stream so
+// the worker never holds the full decoded image; callers can also force it.
+const streamThresholdBytes =
+  parseInt(process.env.CANVAS_STREAM_BYTES, 10) || 15 * 1024 * 1024;
+const useStreaming = (source, requested) =>
+  requested === true || source.bytes >= streamThresholdBytes;
+
+// Jobs ask the worker for a METRICS trailer (stage timings, sizes, peak
+// bytes), which is split off stdout and logged as one JSON line for the
+// dashboards. CANVAS_METRICS=0 turns this off.
+const collectMetrics = process.env.CANVAS_METRICS !== "0";
+const runJob = async (source, op, args, options) => {
+  if (!collectMetrics) return sources.run(source, op, args, options);
+  const result = await sources.run(
+    source,
+    op,
+    [...args, "--metrics", "json"],
+    options
+  );
+  const match = /^METRICS (.*)$\n?/m.exec(result.stdout);
+  if (match) {
+    result.stdout = result.stdout.replace(match[0], "");
+    try {
+      result.metrics = JSON.parse(match[1]);
+      console.log(
+        JSON.stringify({
+          event: "canvas_job",
+          op,
+          url: source.url,
+          ...result.metrics,
+        })
+      );
+    } catch {
+      // A malformed trailer only costs the metrics
+    }
+  }
+  return result;
+};
+
+// Output encoding from the request body: format (jpeg, png, webp or avif),
+// outputQuality (1-100), progressive, optimize and fastEncode (JPEG), and
+// encodeSpeed (AVIF, 0-9). Returns the worker arguments or an error.
+const OUTPUT_FORMATS = ["jpeg", "png", "webp", "avif"];
+const encodeArgs = (body) => {
+  const {
+    format,
+    outputQuality,
+    progressive,
+    optimize,
+    fastEncode,
+    encodeSpeed,
+  } = body;
+  const args = [];
+  if (format !== undefined) {
+    if (!OUTPUT_FORMATS.includes(format)) {
+      return { error: "Format must be one of jpeg, png, webp or avif" };
+    }
+    args.push("--format", format);
+  }
+  if (outputQuality !== undefined) {
+    if (!(outputQuality >= 1 && outputQuality <= 100)) {
+      return { error: "Output quality must be between 1 and 100" };
+    }
+    args.push("--output-quality", Math.round(outputQuality).toString());
+  }
+  if (encodeSpeed !== undefined) {
+    if (!(encodeSpeed >= 0 && encodeSpeed <= 9)) {
+      return { error: "Encode speed must be between 0 and 9" };
+    }
+    args.push("--speed", Math.round(encodeSpeed).toString());
+  }
+  if (progressive) args.push("--progressive");
+  if (optimize) args.push("--optimize");
+  if (fastEncode) args.push("--fast-encode");
+  return { args };
+};
+
+// The tools report what they encoded; only JPEG existed before that line.
+const outputType = (stdout) => {
+  const match = /^Output type: (\S+)$/m.exec(stdout || "");
+  return match ? match[1] : "image/jpeg";
+};
+
+// raw: true, or an Accept header preferring image/* to JSON, asks for the
+// encoded image itself rather than a base64 data URL inside JSON. It goes
+// out as a chunked response while the worker is still sending it, so the
+// first bytes of a JPEG leave before the encoder has finished the rest.
+const wantsBinary = (req, raw) =>
+  Boolean(raw) ||
+  req.accepts(["application/json", "image/*"]) === "image/*";
+
+const streamOutput = (res) => {
+  const stream = {
+    started: false,
+    begin: (type) => {
+      if (stream.started) return;
+      stream.started = true;
+      res.status(200).type(type);
+    },
+    onChunk: (chunk, message) => {
+      stream.begin(outputType(message));
+      res.write(chunk);
+    },
+    finish: (rest, type) => {
+      stream.begin(type);
+      res.end(rest);
+    },
+  };
+  return stream;
+};
+
+// Pipeline steps from the request body, e.g. { op: "crop", x: 0, width: 800 },
+// become the worker's comma-spelled --step values ("crop,x=0,width=800").
+// camelCase keys map to the tool's dashed ones (previewWidth → preview-width);
+// the worker checks the keys and values themselves.
+const PIPELINE_OPS = ["crop", "extend", "matte", "resize"];
+const MAX_PIPELINE_STEPS = 8;
+const pipelineStepArgs = (steps) => {
+  if (!Array.isArray(steps) || steps.length === 0) {
+    return { error: "steps must be a non-empty array" };
+  }
+  if (steps.length > MAX_PIPELINE_STEPS) {
+    return { error: `At most ${MAX_PIPELINE_STEPS} pipeline steps` };
+  }
+  const args = [];
+  for (const step of steps) {
+    const { op, ...params } = step || {};
+    if (!PIPELINE_OPS.includes(op)) {
+      return { error: "Step op must be one of crop, extend, matte or resize" };
+    }
+    const tokens = [op];
+    for (const [key, value] of Object.entries(params)) {
+      const text = String(value);
+      if (!/^[#\w.+-]+$/.test(text)) {
+        return { error: `Bad value for ${op} ${key}` };
+      }
+      const dashed = key.replace(/[A-Z]/g, (c) => "-" + c.toLowerCase());
+      tokens.push(`${dashed}=${text}`);
+    }
+    args.push("--step", tokens.join(","));
+  }
+  return { args };
+};
+
+// "priority": "batch" marks regenerations that may wait behind previews and
+// other interactive requests.
+const jobPriority = (body) =>
+  body.priority === "batch" ? "batch" : "interactive";
+
+// The worker pool and the workers refuse jobs with "busy" when their
+// queues are full; the client should retry later.
+const isBusy = (error) => /\bbusy$/.test(error.message || "");
+const sendBusy = (res) =>
+  res
+    .status(503)
+    .set("Retry-After", "1")
+    .json({ error: "Server busy, try again shortly" });
+
 // Middleware
 app.use(cors());
 app.use(express.json({ limit: "50mb" }));
@@ -30,6 +254,11 @@ app.post("/extend-canvas", async (req, res) => {
     whiteThresh = -1,
     requestedWidth,
     requestedHeight,
+    reducedDecode = false,
+    sampleRegion,
+    extendMode,
+    stream,
+    raw = false,
   } = req.body;
 
   // Validate input parameters
@@ -57,37 +286,49 @@ app.post("/extend-canvas", async (req, res) => {
     });
   }
 
-  const tempDir = "/tmp/canvas-extension";
-  const sessionId = uuidv4();
-  const inputPath = path.join(tempDir, `input_${sessionId}.jpg`);
-  const outputPath = path.join(tempDir, `output_${sessionId}.jpg`);
+  // Where the automatic threshold samples the background
+  if (
+    sampleRegion !== undefined &&
+    !["center", "corners", "all"].includes(sampleRegion)
+  ) {
+    return res.status(400).json({
+      error: "Sample region must be center, corners or all",
+    });
+  }
 
-  try {
-    // Ensure temp directory exists
-    await fs.mkdir(tempDir, { recursive: true });
+  // model: added rows from a per-column background model instead of the
+  // stretched strips; it needs the image in memory, so it never streams
+  if (extendMode !== undefined && !["stretch", "model"].includes(extendMode)) {
+    return res.status(400).json({
+      error: "Extend mode must be stretch or model",
+    });
+  }
+  if (extendMode === "model" && stream === true) {
+    return res.status(400).json({
+      error: "Extend mode model cannot be combined with stream",
+    });
+  }
 
-    // Download the image
-    console.log(`Downloading image from: ${imageUrl}`);
-    const imageResponse = await fetch(imageUrl);
-    if (!imageResponse.ok) {
-      throw new Error(`Failed to download image: ${imageResponse.statusText}`);
-    }
+  const encode = encodeArgs(req.body);
+  if (encode.error) {
+    return res.status(400).json({ error: encode.error });
+  }
 
-    const imageBuffer = await imageResponse.arrayBuffer();
-    await fs.writeFile(inputPath, Buffer.from(imageBuffer));
+  try {
+    // Download the image, unless a worker still holds it decoded
+    const source = await sources.open(imageUrl);
 
-    // Check if extend_canvas executable exists
-    const executablePath = path.join("/app", "extend_canvas");
+    // Check if canvas_worker executable exists
     try {
-      await fs.access(executablePath);
+      await fs.access(workerBinaryPath);
     } catch {
       throw new Error("Canvas extension binary not found");
     }
 
     // Build command arguments
     const args = [
-      inputPath,
-      outputPath,
+      "-",
+      "-",
       desiredHeight.toString(),
       paddingPct.toString(),
       whiteThresh.toString(),
@@ -102,14 +343,42 @@ app.post("/extend-canvas", async (req, res) => {
       );
     }
 
-    // Execute the C++ program
-    const command = `${executablePath} ${args.join(" ")}`;
-    console.log("Executing command:", command);
+    // Decode at 1/2-1/8 size when the requested output is that much smaller
+    // Large inputs stream in row bands instead (the two are exclusive)
+    if (extendMode !== "model" && useStreaming(source, stream)) {
+      args.unshift("--stream");
+    } else if (reducedDecode) {
+      args.unshift("--reduced-decode");
+    }
+    args.unshift(...encode.args);
+    if (sampleRegion) {
+      args.unshift("--sample", sampleRegion);
+    }
+    if (extendMode) {
+      args.unshift("--extend-mode", extendMode);
+    }
+
+    // Run the job on a canvas worker
+    console.log("Running worker job: extend", args.join(" "));
 
+    const chunked = wantsBinary(req, raw) ? streamOutput(res) : null;
+    let processedImageBuffer;
+    let jobMetrics;
+    let contentType;
     try {
-      const { stdout, stderr } = await execAsync(command, {
-        timeout: 30000, // 30 second timeout
-      });
+      const { stdout, stderr, output, metrics } = await runJob(
+        source,
+        "extend",
+        args,
+        {
+          timeout: 30000, // 30 second timeout
+          priority: jobPriority(req.body),
+          onChunk: chunked && chunked.onChunk,
+        }
+      );
+      processedImageBuffer = output;
+      jobMetrics = metrics;
+      contentType = outputType(stdout);
 
       if (stderr) {
         console.warn("Canvas extension stderr:", stderr);
@@ -121,25 +390,20 @@ app.post("/extend-canvas", async (req, res) => {
       throw new Error(`Canvas extension failed: ${execError.message}`);
     }
 
-    // Check if output file was created
-    try {
-      await fs.access(outputPath);
-    } catch {
+    // Check if an output image was returned
+    const empty = !processedImageBuffer || processedImageBuffer.length === 0;
+    if (empty && !(chunked && chunked.started)) {
       throw new Error("Output image was not generated");
     }
 
-    // Read the processed image
-    const processedImageBuffer = await fs.readFile(outputPath);
+    // Binary responses end with whatever the chunks did not carry
+    if (chunked) {
+      return chunked.finish(processedImageBuffer, contentType);
+    }
 
     // Convert to base64
     const base64Image = processedImageBuffer.toString("base64");
-    const dataUrl = `data:image/jpeg;base64,${base64Image}`;
-
-    // Clean up temporary files
-    await Promise.all([
-      fs.unlink(inputPath).catch(() => {}),
-      fs.unlink(outputPath).catch(() => {}),
-    ]);
+    const dataUrl = `data:${contentType};base64,${base64Image}`;
 
     console.log(`Successfully processed image: ${imageUrl}`);
 
@@ -154,17 +418,24 @@ app.post("/extend-canvas", async (req, res) => {
         whiteThresh,
         requestedWidth,
         requestedHeight,
+        reducedDecode,
+        sampleRegion,
+        extendMode,
         processedAt: new Date().toISOString(),
+        metrics: jobMetrics,
       },
     });
   } catch (error) {
     console.error("Canvas extension error:", error);
 
-    // Clean up temporary files on error
-    await Promise.all([
-      fs.unlink(inputPath).catch(() => {}),
-      fs.unlink(outputPath).catch(() => {}),
-    ]);
+    // A streamed response already has its status; cut it short instead
+    if (res.headersSent) {
+      return res.destroy(error);
+    }
+
+    if (isBusy(error)) {
+      return sendBusy(res);
+    }
 
     if (error.message.includes("timeout")) {
       return res.status(408).json({
@@ -186,6 +457,8 @@ app.post("/create-matte", async (req, res) => {
     canvasHeight,
     paddingPercent = 0,
     matteColor = "#000000",
+    stream,
+    raw = false,
   } = req.body;
 
   // Validate input parameters
@@ -221,44 +494,28 @@ app.post("/create-matte", async (req, res) => {
     });
   }
 
-  const tempDir = "/tmp/image-matte";
-  const sessionId = uuidv4();
-  const inputPath = path.join(tempDir, `input_${sessionId}.jpg`);
-  const outputPath = path.join(tempDir, `output_${sessionId}.jpg`);
+  const encode = encodeArgs(req.body);
+  if (encode.error) {
+    return res.status(400).json({ error: encode.error });
+  }
 
   try {
-    // Ensure temp directory exists
-    await fs.mkdir(tempDir, { recursive: true });
-
-    // Download the image
-    console.log(`Downloading image from: ${imageUrl}`);
-    const imageResponse = await fetch(imageUrl);
-    if (!imageResponse.ok) {
-      throw new Error(`Failed to download image: ${imageResponse.statusText}`);
-    }
+    // Download the image, unless a worker still holds it decoded
+    const source = await sources.open(imageUrl);
 
-    const imageBuffer = await imageResponse.arrayBuffer();
-    await fs.writeFile(inputPath, Buffer.from(imageBuffer));
-
-    // Check if matte_generator executable exists
-    const executablePath = path.join("/app", "matte_generator");
+    // Check if canvas_worker executable exists
     try {
-      await fs.access(executablePath);
+      await fs.access(workerBinaryPath);
     } catch {
       throw new Error("Matte generator binary not found");
     }
 
-    // Build command arguments with proper shell escaping
-    const escapeShellArg = (arg) => {
-      // Escape single quotes and wrap in single quotes
-      return `'${arg.replace(/'/g, "'\"'\"'")}'`;
-    };
-
+    // Build worker arguments (no shell involved, so no escaping needed)
     const args = [
       "--input",
-      escapeShellArg(inputPath),
+      "-",
       "--output",
-      escapeShellArg(outputPath),
+      "-",
       "--width",
       canvasWidth.toString(),
       "--height",
@@ -266,17 +523,34 @@ app.post("/create-matte", async (req, res) => {
       "--padding",
       paddingPercent.toString(),
       "--color",
-      escapeShellArg(matteColor),
+      matteColor,
     ];
+    if (useStreaming(source, stream)) {
+      args.push("--stream");
+    }
+    args.push(...encode.args);
 
-    // Execute the C++ program with proper shell escaping
-    const command = `${escapeShellArg(executablePath)} ${args.join(" ")}`;
-    console.log("Executing command:", command);
+    // Run the job on a canvas worker
+    console.log("Running worker job: matte", args.join(" "));
 
+    const chunked = wantsBinary(req, raw) ? streamOutput(res) : null;
+    let processedImageBuffer;
+    let jobMetrics;
+    let contentType;
     try {
-      const { stdout, stderr } = await execAsync(command, {
-        timeout: 30000, // 30 second timeout
-      });
+      const { stdout, stderr, output, metrics } = await runJob(
+        source,
+        "matte",
+        args,
+        {
+          timeout: 30000, // 30 second timeout
+          priority: jobPriority(req.body),
+          onChunk: chunked && chunked.onChunk,
+        }
+      );
+      processedImageBuffer = output;
+      jobMetrics = metrics;
+      contentType = outputType(stdout);
 
       if (stderr) {
         console.warn("Matte generator stderr:", stderr);
@@ -288,25 +562,20 @@ app.post("/create-matte", async (req, res) => {
       throw new Error(`Matte generation failed: ${execError.message}`);
     }
 
-    // Check if output file was created
-    try {
-      await fs.access(outputPath);
-    } catch {
+    // Check if an output image was returned
+    const empty = !processedImageBuffer || processedImageBuffer.length === 0;
+    if (empty && !(chunked && chunked.started)) {
       throw new Error("Output image was not generated");
     }
 
-    // Read the processed image
-    const processedImageBuffer = await fs.readFile(outputPath);
+    // Binary responses end with whatever the chunks did not carry
+    if (chunked) {
+      return chunked.finish(processedImageBuffer, contentType);
+    }
 
     // Convert to base64
     const base64Image = processedImageBuffer.toString("base64");
-    const dataUrl = `data:image/jpeg;base64,${base64Image}`;
-
-    // Clean up temporary files
-    await Promise.all([
-      fs.unlink(inputPath).catch(() => {}),
-      fs.unlink(outputPath).catch(() => {}),
-    ]);
+    const dataUrl = `data:${contentType};base64,${base64Image}`;
 
     console.log(`Successfully created matte for image: ${imageUrl}`);
 
@@ -321,16 +590,20 @@ app.post("/create-matte", async (req, res) => {
         paddingPercent,
         matteColor,
         processedAt: new Date().toISOString(),
+        metrics: jobMetrics,
       },
     });
   } catch (error) {
     console.error("Image matte error:", error);
 
-    // Clean up temporary files on error
-    await Promise.all([
-      fs.unlink(inputPath).catch(() => {}),
-      fs.unlink(outputPath).catch(() => {}),
-    ]);
+    // A streamed response already has its status; cut it short instead
+    if (res.headersSent) {
+      return res.destroy(error);
+    }
+
+    if (isBusy(error)) {
+      return sendBusy(res);
+    }
 
     if (error.message.includes("timeout")) {
       return res.status(408).json({
@@ -356,6 +629,11 @@ app.post("/crop-image", async (req, res) => {
     outputHeight = 1920,
     scale = 1.0,
     previewImageDimensions,
+    previewMode = false,
+    previewSize = 640,
+    refine = true,
+    stream,
+    raw = false,
   } = req.body;
 
   // Validate input parameters
@@ -389,107 +667,39 @@ app.post("/crop-image", async (req, res) => {
     });
   }
 
-  const tempDir = "/tmp/image-crop";
-  const sessionId = uuidv4();
-  const inputPath = path.join(tempDir, `input_${sessionId}.jpg`);
-  const outputPath = path.join(tempDir, `output_${sessionId}.jpg`);
-
-  try {
-    // Ensure temp directory exists
-    await fs.mkdir(tempDir, { recursive: true });
-
-    // Download the image
-    console.log(`Downloading image from: ${imageUrl}`);
-    const imageResponse = await fetch(imageUrl);
-    if (!imageResponse.ok) {
-      throw new Error(`Failed to download image: ${imageResponse.statusText}`);
-    }
-
-    const imageBuffer = await imageResponse.arrayBuffer();
-    await fs.writeFile(inputPath, Buffer.from(imageBuffer));
-
-    // Get actual image dimensions using ImageMagick identify command
-    let actualWidth, actualHeight;
-    try {
-      const { stdout } = await execAsync(
-        `identify -format "%w %h" "${inputPath}"`
-      );
-      const dimensions = stdout.trim().split(" ");
-      actualWidth = parseInt(dimensions[0]);
-      actualHeight = parseInt(dimensions[1]);
-      console.log(`Actual image dimensions: ${actualWidth}x${actualHeight}`);
-    } catch (identifyError) {
-      console.error("Failed to get image dimensions:", identifyError);
-      throw new Error("Failed to read image dimensions");
-    }
-
-    // Calculate scaling factor if we have preview dimensions
-    let scaledCropX = cropX;
-    let scaledCropY = cropY;
-    let scaledCropWidth = cropWidth;
-    let scaledCropHeight = cropHeight;
-
-    if (previewImageDimensions) {
-      const scaleFactorX = actualWidth / previewImageDimensions.width;
-      const scaleFactorY = actualHeight / previewImageDimensions.height;
-
-      console.log(`Scale factors: X=${scaleFactorX}, Y=${scaleFactorY}`);
-
-      scaledCropX = Math.round(cropX * scaleFactorX);
-      scaledCropY = Math.round(cropY * scaleFactorY);
-      scaledCropWidth = Math.round(cropWidth * scaleFactorX);
-      scaledCropHeight = Math.round(cropHeight * scaleFactorY);
-
-      console.log(
-        `Original crop: ${cropX},${cropY} ${cropWidth}x${cropHeight}`
-      );
-      console.log(
-        `Scaled crop: ${scaledCropX},${scaledCropY} ${scaledCropWidth}x${scaledCropHeight}`
-      );
-    }
+  if (previewMode && !(previewSize >= 64 && previewSize <= 2000)) {
+    return res.status(400).json({
+      error: "Preview size must be between 64 and 2000 pixels",
+    });
+  }
 
-    // Validate scaled crop area against actual image dimensions
-    if (
-      scaledCropX < 0 ||
-      scaledCropY < 0 ||
-      scaledCropX + scaledCropWidth > actualWidth ||
-      scaledCropY + scaledCropHeight > actualHeight
-    ) {
-      console.error("Scaled crop area validation failed:", {
-        actualDimensions: { actualWidth, actualHeight },
-        scaledCrop: {
-          scaledCropX,
-          scaledCropY,
-          scaledCropWidth,
-          scaledCropHeight,
-        },
-        exceedsRight: scaledCropX + scaledCropWidth > actualWidth,
-        exceedsBottom: scaledCropY + scaledCropHeight > actualHeight,
-      });
+  const encode = encodeArgs(req.body);
+  if (encode.error) {
+    return res.status(400).json({ error: encode.error });
+  }
 
-      return res.status(400).json({
-        error: `Crop area exceeds image boundaries. Image: ${actualWidth}×${actualHeight}, Crop: ${scaledCropX},${scaledCropY} ${scaledCropWidth}×${scaledCropHeight}`,
-      });
-    }
+  try {
+    // Download the image, unless a worker still holds it decoded
+    const source = await sources.open(imageUrl);
 
-    // Check if image_cropper executable exists
-    const executablePath = path.join("/app", "image_cropper");
+    // Check if canvas_worker executable exists
     try {
-      await fs.access(executablePath);
+      await fs.access(workerBinaryPath);
     } catch {
       throw new Error("Image cropper binary not found");
     }
 
-    // Build command arguments using scaled coordinates
+    // Build command arguments. Crop values picked on a preview are scaled
+    // to the full image by the cropper, which reads its size from the header.
     const args = [
       "--input",
-      inputPath,
+      "-",
       "--output",
-      outputPath,
+      "-",
       "--crop-x",
-      scaledCropX.toString(),
+      cropX.toString(),
       "--crop-y",
-      scaledCropY.toString(),
+      cropY.toString(),
       "--output-width",
       outputWidth.toString(),
       "--output-height",
@@ -498,22 +708,58 @@ app.post("/crop-image", async (req, res) => {
       scale.toString(),
     ];
 
-    // Add scaled crop dimensions if specified
-    if (scaledCropWidth && scaledCropWidth > 0) {
-      args.push("--crop-width", scaledCropWidth.toString());
+    // Add crop dimensions if specified
+    if (cropWidth && cropWidth > 0) {
+      args.push("--crop-width", cropWidth.toString());
     }
-    if (scaledCropHeight && scaledCropHeight > 0) {
-      args.push("--crop-height", scaledCropHeight.toString());
+    if (cropHeight && cropHeight > 0) {
+      args.push("--crop-height", cropHeight.toString());
     }
-
-    // Execute the C++ program
-    const command = `${executablePath} ${args.join(" ")}`;
-    console.log("Executing command:", command);
-
+    if (previewImageDimensions) {
+      args.push(
+        "--preview-width",
+        previewImageDimensions.width.toString(),
+        "--preview-height",
+        previewImageDimensions.height.toString()
+      );
+    }
+    if (useStreaming(source, stream)) {
+      args.push("--stream");
+    }
+    args.push(...encode.args);
+
+    // previewMode: a quick draft of the same crop (reduced decode, fast
+    // resampling, low-quality encode), long side at most previewSize. It
+    // never streams: the draft decode is already small.
+    const jobArgs = previewMode
+      ? [
+          ...args.filter((arg) => arg !== "--stream"),
+          "--draft",
+          Math.round(previewSize).toString(),
+        ]
+      : args;
+
+    // Run the job on a canvas worker
+    console.log("Running worker job: crop", jobArgs.join(" "));
+
+    const chunked = wantsBinary(req, raw) ? streamOutput(res) : null;
+    let processedImageBuffer;
+    let jobMetrics;
+    let cropperStdout;
     try {
-      const { stdout, stderr } = await execAsync(command, {
-        timeout: 30000, // 30 second timeout
-      });
+      const { stdout, stderr, output, metrics } = await runJob(
+        source,
+        "crop",
+        jobArgs,
+        {
+          timeout: 30000, // 30 second timeout
+          priority: jobPriority(req.body),
+          onChunk: chunked && chunked.onChunk,
+        }
+      );
+      processedImageBuffer = output;
+      jobMetrics = metrics;
+      cropperStdout = stdout;
 
       if (stderr) {
         console.warn("Image cropper stderr:", stderr);
@@ -522,28 +768,47 @@ app.post("/crop-image", async (req, res) => {
       console.log("Image cropper stdout:", stdout);
     } catch (execError) {
       console.error("Image cropper execution error:", execError);
+      if (execError.message.includes("exceeds image boundaries")) {
+        return res.status(400).json({ error: execError.message });
+      }
       throw new Error(`Image cropping failed: ${execError.message}`);
     }
 
-    // Check if output file was created
-    try {
-      await fs.access(outputPath);
-    } catch {
+    // The cropper reports the image size and the crop it actually applied
+    const sizeMatch = /Original size: (\d+)x(\d+)/.exec(cropperStdout);
+    const cropMatch = /Crop area: (\d+),(\d+) (\d+)x(\d+)/.exec(cropperStdout);
+    const actualWidth = sizeMatch ? parseInt(sizeMatch[1]) : undefined;
+    const actualHeight = sizeMatch ? parseInt(sizeMatch[2]) : undefined;
+    const [scaledCropX, scaledCropY, scaledCropWidth, scaledCropHeight] =
+      cropMatch ? cropMatch.slice(1).map((v) => parseInt(v)) : [];
+    const contentType = outputType(cropperStdout);
+
+    // Check if an output image was returned
+    const empty = !processedImageBuffer || processedImageBuffer.length === 0;
+    if (empty && !(chunked && chunked.started)) {
       throw new Error("Output image was not generated");
     }
 
-    // Read the processed image
-    const processedImageBuffer = await fs.readFile(outputPath);
+    // After a preview the full render follows at batch priority, on the
+    // worker that kept the source, so the confirming request (the same body
+    // without previewMode) is answered from its result cache.
+    if (previewMode && refine) {
+      runJob({ ...source, buffer: null }, "crop", args, {
+        timeout: 60000,
+        priority: "batch",
+      }).catch((error) =>
+        console.warn("Full-quality crop render failed:", error.message)
+      );
+    }
+
+    // Binary responses end with whatever the chunks did not carry
+    if (chunked) {
+      return chunked.finish(processedImageBuffer, contentType);
+    }
 
     // Convert to base64
     const base64Image = processedImageBuffer.toString("base64");
-    const dataUrl = `data:image/jpeg;base64,${base64Image}`;
-
-    // Clean up temporary files
-    await Promise.all([
-      fs.unlink(inputPath).catch(() => {}),
-      fs.unlink(outputPath).catch(() => {}),
-    ]);
+    const dataUrl = `data:${contentType};base64,${base64Image}`;
 
     console.log(`Successfully cropped image: ${imageUrl}`);
 
@@ -572,17 +837,149 @@ app.post("/crop-image", async (req, res) => {
         outputWidth,
         outputHeight,
         scale,
+        preview: previewMode,
         processedAt: new Date().toISOString(),
+        metrics: jobMetrics,
       },
     });
   } catch (error) {
     console.error("Image crop error:", error);
 
-    // Clean up temporary files on error
-    await Promise.all([
-      fs.unlink(inputPath).catch(() => {}),
-      fs.unlink(outputPath).catch(() => {}),
-    ]);
+    // A streamed response already has its status; cut it short instead
+    if (res.headersSent) {
+      return res.destroy(error);
+    }
+
+    if (isBusy(error)) {
+      return sendBusy(res);
+    }
+
+    if (error.message.includes("timeout")) {
+      return res.status(408).json({
+        error: "Processing timeout. The image may be too large or complex.",
+      });
+    }
+
+    res.status(500).json({
+      error: error.message || "An unexpected error occurred",
+    });
+  }
+});
+
+// Multi-step endpoint: crop, extend, matte and resize steps in order, on one
+// download and decode, encoded once
+app.post("/pipeline", async (req, res) => {
+  const { imageUrl, steps, raw = false } = req.body;
+
+  if (!imageUrl) {
+    return res.status(400).json({
+      error: "Missing required parameter: imageUrl",
+    });
+  }
+
+  const stepArgs = pipelineStepArgs(steps);
+  if (stepArgs.error) {
+    return res.status(400).json({ error: stepArgs.error });
+  }
+
+  const encode = encodeArgs(req.body);
+  if (encode.error) {
+    return res.status(400).json({ error: encode.error });
+  }
+
+  try {
+    // Download the image, unless a worker still holds it decoded
+    const source = await sources.open(imageUrl);
+
+    // Check if canvas_worker executable exists
+    try {
+      await fs.access(workerBinaryPath);
+    } catch {
+      throw new Error("Pipeline binary not found");
+    }
+
+    const args = [
+      "--input",
+      "-",
+      "--output",
+      "-",
+      ...stepArgs.args,
+      ...encode.args,
+    ];
+
+    // Run the job on a canvas worker
+    console.log("Running worker job: pipeline", args.join(" "));
+
+    const chunked = wantsBinary(req, raw) ? streamOutput(res) : null;
+    let processedImageBuffer;
+    let jobMetrics;
+    let contentType;
+    try {
+      const { stdout, stderr, output, metrics } = await runJob(
+        source,
+        "pipeline",
+        args,
+        {
+          timeout: 30000, // 30 second timeout
+          priority: jobPriority(req.body),
+          onChunk: chunked && chunked.onChunk,
+        }
+      );
+      processedImageBuffer = output;
+      jobMetrics = metrics;
+      contentType = outputType(stdout);
+
+      if (stderr) {
+        console.warn("Pipeline stderr:", stderr);
+      }
+
+      console.log("Pipeline stdout:", stdout);
+    } catch (execError) {
+      console.error("Pipeline execution error:", execError);
+      if (execError.message.includes("Step ")) {
+        return res.status(400).json({ error: execError.message });
+      }
+      throw new Error(`Pipeline failed: ${execError.message}`);
+    }
+
+    // Check if an output image was returned
+    const empty = !processedImageBuffer || processedImageBuffer.length === 0;
+    if (empty && !(chunked && chunked.started)) {
+      throw new Error("Output image was not generated");
+    }
+
+    // Binary responses end with whatever the chunks did not carry
+    if (chunked) {
+      return chunked.finish(processedImageBuffer, contentType);
+    }
+
+    const base64Image = processedImageBuffer.toString("base64");
+    const dataUrl = `data:${contentType};base64,${base64Image}`;
+
+    console.log(`Successfully ran pipeline for image: ${imageUrl}`);
+
+    res.json({
+      success: true,
+      processedImageUrl: dataUrl,
+      message: "Image pipeline completed successfully with C++ OpenCV",
+      metadata: {
+        originalUrl: imageUrl,
+        steps,
+        processedAt: new Date().toISOString(),
+        metrics: jobMetrics,
+      },
+    });
+  } catch (error) {
+    console.error("Image pipeline error:", error);
+
+    // A streamed response already has its status; cut it short instead
+    if (res.headersSent) {
+      return res.destroy(error);
+    }
+
+    if (isBusy(error)) {
+      return sendBusy(res);
+    }
 
     if (error.message.includes("timeout")) {
       return res.status(408).json({
@@ -597,12 +994,14 @@ app.post("/crop-image", async (req, res) => {
 });
 
 // Start server
+engine.start();
 app.listen(PORT, "0.0.0.0", () => {
   console.log(`Canvas Extension and Matte Service running on port ${PORT}`);
   console.log(`Health check: http://localhost:${PORT}/health`);
   console.log(`Canvas extension: POST http://localhost:${PORT}/extend-canvas`);
   console.log(`Image matte: POST http://localhost:${PORT}/create-matte`);
   console.log(`Image crop: POST http://localhost:${PORT}/crop-image`);
+  console.log(`Image pipeline: POST http://localhost:${PORT}/pipeline`);
 });
 
 // Graceful shutdown
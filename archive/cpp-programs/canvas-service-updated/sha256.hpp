@@ -0,0 +1,30 @@
+// sha256.hpp
+// Small self-contained SHA-256 for content-addressed cache keys.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class Sha256
+{
+public:
+    Sha256();
+    void update(const void *data, size_t len);
+    std::string hexDigest(); // finishes the hash; call once
+
+    static std::string hex(const void *data, size_t len)
+    {
+        Sha256 h;
+        h.update(data, len);
+        return h.hexDigest();
+    }
+
+private:
+    void block(const uint8_t *p);
+
+    uint32_t state_[8];
+    uint8_t buf_[64];
+    size_t bufLen_ = 0;
+    uint64_t totalLen_ = 0;
+};
@@ -0,0 +1,85 @@
+// Remembers recently fetched source images so follow-up jobs on the same
+// URL can skip the download and reuse the decode a canvas_worker kept for
+// it. Sources are named by a digest of URL + ETag (or of the bytes when the
+// server sends no ETag); jobs on one source are routed to the same worker.
+const crypto = require("crypto");
+
+const sha1 = (data) => crypto.createHash("sha1").update(data).digest("hex");
+
+class SourceRegistry {
+  constructor(pool, { ttlMs = 60000, maxEntries = 1000 } = {}) {
+    this.pool = pool;
+    this.ttlMs = ttlMs;
+    this.maxEntries = maxEntries;
+    this.entries = new Map(); // url -> { key, etag, bytes, checkedAt }
+  }
+
+  // Resolve imageUrl to { url, key, bytes, buffer }. buffer is null when the
+  // source was fetched or revalidated within ttlMs, or when the server
+  // answered a conditional request with 304 Not Modified.
+  async open(imageUrl) {
+    const entry = this.entries.get(imageUrl);
+    if (entry && Date.now() - entry.checkedAt < this.ttlMs) {
+      return this.describe(imageUrl, entry, null);
+    }
+
+    const headers = entry && entry.etag ? { "If-None-Match": entry.etag } : {};
+    console.log(`Downloading image from: ${imageUrl}`);
+    const response = await fetch(imageUrl, { headers });
+    if (response.status === 304 && entry) {
+      entry.checkedAt = Date.now();
+      return this.describe(imageUrl, entry, null);
+    }
+    if (!response.ok) {
+      throw new Error(`Failed to download image: ${response.statusText}`);
+    }
+
+    const buffer = Buffer.from(await response.arrayBuffer());
+    const etag = response.headers.get("etag");
+    const fresh = {
+      key: sha1(`${imageUrl}\n${etag || sha1(buffer)}`),
+      etag,
+      bytes: buffer.length,
+      checkedAt: Date.now(),
+    };
+    this.entries.delete(imageUrl);
+    this.entries.set(imageUrl, fresh);
+    if (this.entries.size > this.maxEntries) {
+      this.entries.delete(this.entries.keys().next().value);
+    }
+    return this.describe(imageUrl, fresh, buffer);
+  }
+
+  describe(url, entry, buffer) {
+    return { url, key: entry.key, bytes: entry.bytes, buffer };
+  }
+
+  // Run a worker job on an opened source. Without the bytes in hand this
+  // first asks the worker to use its kept decode; if that is gone the image
+  // is downloaded again and the job resent with it.
+  async run(source, op, args, { timeout, priority, onChunk } = {}) {
+    if (!source.buffer) {
+      try {
+        return await this.pool.run(op, ["--source", source.key, ...args], {
+          timeout,
+          priority,
+          onChunk,
+          affinity: source.key,
+        });
+      } catch (error) {
+        if (error.message !== "source-miss") throw error;
+        this.entries.delete(source.url);
+        Object.assign(source, await this.open(source.url));
+      }
+    }
+    return this.pool.run(op, ["--source", source.key, ...args], {
+      timeout,
+      priority,
+      onChunk,
+      input: source.buffer,
+      affinity: source.key,
+    });
+  }
+}
+
+module.exports = { SourceRegistry };
@@ -0,0 +1,40 @@
+#!/usr/bin/env node
+// Stand-in for canvas_worker in the server tests: speaks the framing of
+// canvas_worker.cpp and answers every image job with OUTPUT, in two
+// chunk frames and a final response when the request is --chunked.
+const OUTPUT = Buffer.from("fake encoded image bytes");
+const TYPE = "Output type: image/jpeg\n";
+
+let buffer = Buffer.alloc(0);
+
+const frame = (id, status, message, payload = Buffer.alloc(0)) => {
+  const text = Buffer.from(message);
+  process.stdout.write(`${id} ${status} ${text.length} ${payload.length}\n`);
+  process.stdout.write(Buffer.concat([text, payload]));
+};
+
+const answer = (id, op, args) => {
+  if (op === "ping" || op === "stats") return frame(id, "ok", "");
+  const stdout =
+    `${TYPE}Original size: 800x600\n` + "Crop area: 0,0 800x600\n";
+  if (!args.includes("--chunked")) return frame(id, "ok", stdout, OUTPUT);
+  frame(id, "chunk", TYPE, OUTPUT.subarray(0, 4));
+  frame(id, "chunk", "", OUTPUT.subarray(4, 10));
+  frame(id, "ok", stdout, OUTPUT.subarray(10));
+};
+
+process.stdin.on("data", (data) => {
+  buffer = Buffer.concat([buffer, data]);
+  for (;;) {
+    const newline = buffer.indexOf(0x0a);
+    if (newline === -1) return;
+    const [id, op, nbytes, ...args] = buffer
+      .subarray(0, newline)
+      .toString()
+      .split(" ");
+    const end = newline + 1 + Number(nbytes);
+    if (buffer.length < end) return;
+    buffer = buffer.subarray(end);
+    answer(id, op, args);
+  }
+});
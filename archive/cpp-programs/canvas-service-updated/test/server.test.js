@@ -0,0 +1,110 @@
+// Sends a request through each image endpoint of server.js, as JSON and as
+// a binary response, against test/fake-worker.js instead of canvas_worker
+// and a local server for the source image.
+//
+// Usage:
+//   npm test
+const assert = require("assert");
+const http = require("http");
+const net = require("net");
+const path = require("path");
+const { spawn } = require("child_process");
+const { after, before, test } = require("node:test");
+
+const OUTPUT = Buffer.from("fake encoded image bytes");
+
+let imageServer;
+let service;
+let baseUrl;
+let imageUrl;
+
+const freePort = () =>
+  new Promise((resolve) => {
+    const server = net.createServer().listen(0, "127.0.0.1", () => {
+      const { port } = server.address();
+      server.close(() => resolve(port));
+    });
+  });
+
+before(async () => {
+  imageServer = http.createServer((req, res) => {
+    res.writeHead(200, { "Content-Type": "image/jpeg", ETag: '"car-1"' });
+    res.end(Buffer.from("source image bytes"));
+  });
+  await new Promise((resolve) => imageServer.listen(0, "127.0.0.1", resolve));
+  imageUrl = `http://127.0.0.1:${imageServer.address().port}/car.jpg`;
+
+  const port = await freePort();
+  baseUrl = `http://127.0.0.1:${port}`;
+  service = spawn(process.execPath, [path.join(__dirname, "..", "server.js")], {
+    env: {
+      ...process.env,
+      PORT: String(port),
+      CANVAS_WORKER_PATH: path.join(__dirname, "fake-worker.js"),
+      CANVAS_WORKERS: "1",
+    },
+    stdio: ["ignore", "pipe", "inherit"],
+  });
+  await new Promise((resolve, reject) => {
+    service.on("exit", (code) => reject(new Error(`server exited: ${code}`)));
+    service.stdout.on("data", (data) => {
+      if (data.toString().includes("running on port")) resolve();
+    });
+  });
+});
+
+after(() => {
+  service.kill();
+  imageServer.close();
+});
+
+const post = (route, body, headers = {}) =>
+  fetch(`${baseUrl}${route}`, {
+    method: "POST",
+    headers: { "Content-Type": "application/json", ...headers },
+    body: JSON.stringify({ imageUrl, ...body }),
+  });
+
+const endpoints = [
+  ["/extend-canvas", { desiredHeight: 1200 }],
+  ["/extend-canvas", { desiredHeight: 1200, extendMode: "model" }],
+  ["/create-matte", { canvasWidth: 1920, canvasHeight: 1080 }],
+  ["/crop-image", { cropWidth: 400, cropHeight: 300 }],
+  ["/pipeline", { steps: [{ op: "resize", width: 640 }] }],
+];
+
+for (const [route, body] of endpoints) {
+  const name = `${route} ${JSON.stringify(body)}`;
+
+  test(`${name} answers JSON with a data URL`, async () => {
+    const response = await post(route, body);
+    const json = await response.json();
+    assert.strictEqual(response.status, 200, JSON.stringify(json));
+    assert.strictEqual(json.success, true);
+    const dataUrl = Object.values(json).find(
+      (value) => typeof value === "string" && value.startsWith("data:")
+    );
+    assert.ok(dataUrl, "no data URL in the response");
+    const [, base64] = dataUrl.split(",");
+    assert.deepStrictEqual(Buffer.from(base64, "base64"), OUTPUT);
+  });
+
+  test(`${name} streams the image with raw: true`, async () => {
+    const response = await post(route, { ...body, raw: true });
+    assert.strictEqual(response.status, 200);
+    assert.strictEqual(response.headers.get("content-type"), "image/jpeg");
+    assert.deepStrictEqual(
+      Buffer.from(await response.arrayBuffer()),
+      OUTPUT
+    );
+  });
+
+  test(`${name} streams the image for Accept: image/*`, async () => {
+    const response = await post(route, body, { Accept: "image/*" });
+    assert.strictEqual(response.status, 200);
+    assert.deepStrictEqual(
+      Buffer.from(await response.arrayBuffer()),
+      OUTPUT
+    );
+  });
+}
@@ -0,0 +1,300 @@
+// Pool of long-lived canvas_worker processes.
+// Each worker keeps OpenCV loaded and serves framed requests over its
+// stdin/stdout (see canvas_worker.cpp for the protocol), so a job costs a
+// pipe round-trip instead of a fork/exec per request. Images travel as
+// encoded bytes in the frames; nothing is written to /tmp.
+const { spawn } = require("child_process");
+const fs = require("fs");
+const os = require("os");
+
+// Stable small hash for routing jobs on the same source to one worker.
+const hashString = (text) => {
+  let hash = 0;
+  for (let i = 0; i < text.length; i++) {
+    hash = (hash * 31 + text.charCodeAt(i)) >>> 0;
+  }
+  return hash;
+};
+
+// CPU flags that make up x86-64-v3 (AVX2, FMA, BMI, ...), as /proc/cpuinfo
+// names them.
+const X86_64_V3_FLAGS = [
+  "avx",
+  "avx2",
+  "bmi1",
+  "bmi2",
+  "f16c",
+  "fma",
+  "abm",
+  "movbe",
+  "xsave",
+];
+
+// The build for this CPU: "<binaryPath>.x86-64-v3" (see Dockerfile.slim)
+// when it exists and the CPU runs it, else binaryPath itself.
+const cpuVariantPath = (binaryPath) => {
+  const variant = `${binaryPath}.x86-64-v3`;
+  try {
+    if (!fs.existsSync(variant)) return binaryPath;
+    const flagsLine = fs
+      .readFileSync("/proc/cpuinfo", "utf8")
+      .split("\n")
+      .find((line) => line.startsWith("flags"));
+    const flags = new Set((flagsLine || "").split(/\s+/));
+    return X86_64_V3_FLAGS.every((flag) => flags.has(flag))
+      ? variant
+      : binaryPath;
+  } catch {
+    return binaryPath;
+  }
+};
+
+class CanvasWorker {
+  constructor(binaryPath, workerArgs, onExit) {
+    this.binaryPath = binaryPath;
+    this.pending = new Map();
+    this.buffer = Buffer.alloc(0);
+    this.dead = false;
+    this.onExit = onExit;
+    this.child = spawn(binaryPath, workerArgs, { stdio: ["pipe", "pipe", "inherit"] });
+    this.child.stdout.on("data", (chunk) => this.onData(chunk));
+    this.child.stdin.on("error", (error) => this.fail(error));
+    // A spawn failure (e.g. missing binary) is not worth retrying; a worker
+    // that ran and then died is.
+    this.child.on("error", (error) => this.retire(error, false));
+    this.child.on("exit", (code, signal) =>
+      this.retire(
+        new Error(`Canvas worker exited (code=${code}, signal=${signal})`),
+        true
+      )
+    );
+  }
+
+  retire(error, respawn) {
+    this.fail(error);
+    if (this.dead) return;
+    this.dead = true;
+    this.onExit(this, respawn);
+  }
+
+  onData(chunk) {
+    this.buffer = Buffer.concat([this.buffer, chunk]);
+    for (;;) {
+      const newline = this.buffer.indexOf(0x0a);
+      if (newline === -1) return;
+
+      const [id, status, messageLength, payloadLength] = this.buffer
+        .subarray(0, newline)
+        .toString()
+        .split(" ");
+      const messageEnd = newline + 1 + parseInt(messageLength, 10);
+      const frameEnd = messageEnd + parseInt(payloadLength, 10);
+      if (this.buffer.length < frameEnd) return;
+
+      const message = this.buffer.subarray(newline + 1, messageEnd).toString();
+      // Copy the payload out so the pending read buffer can be released.
+      const output = Buffer.from(this.buffer.subarray(messageEnd, frameEnd));
+      this.buffer = this.buffer.subarray(frameEnd);
+
+      const job = this.pending.get(id);
+      if (!job) continue;
+      if (status === "chunk") {
+        // Part of the output of a --chunked job, ahead of its response
+        if (job.onChunk) job.onChunk(output, message);
+        continue;
+      }
+      this.pending.delete(id);
+      clearTimeout(job.timer);
+      if (status === "ok") {
+        job.resolve({ stdout: message, stderr: "", output });
+      } else {
+        job.reject(new Error(message || "Canvas worker job failed"));
+      }
+    }
+  }
+
+  run(id, op, args, input, timeout, onChunk) {
+    return new Promise((resolve, reject) => {
+      const timer = setTimeout(() => {
+        this.pending.delete(id);
+        reject(new Error("Processing timeout"));
+        // The job is still running inside the worker; replace the process
+        // rather than let later requests queue behind it (jobs it was also
+        // running fail with the exit and are not retried).
+        this.dead = true;
+        this.child.kill("SIGKILL");
+        this.onExit(this, true);
+      }, timeout);
+
+      this.pending.set(id, { resolve, reject, timer, onChunk });
+      const header = [id, op, input.length, ...args].join(" ");
+      this.child.stdin.write(`${header}\n`);
+      if (input.length > 0) this.child.stdin.write(input);
+    });
+  }
+
+  fail(error) {
+    for (const job of this.pending.values()) {
+      clearTimeout(job.timer);
+      job.reject(error);
+    }
+    this.pending.clear();
+  }
+}
+
+// Interactive jobs are taken from the queue before batch ones, here and in
+// the worker's own scheduler.
+const PRIORITIES = ["interactive", "batch"];
+
+class CanvasWorkerPool {
+  // workerArgs are passed to every canvas_worker (e.g. cache options).
+  // slots is how many jobs each worker is sent at once (its --jobs plus
+  // some of its --queue, so the worker can order them by priority); past
+  // that, up to maxQueued jobs wait here and the rest fail with "busy".
+  constructor(
+    binaryPath,
+    size = os.cpus().length,
+    workerArgs = [],
+    { slots = 1, maxQueued = 256 } = {}
+  ) {
+    this.binaryPath = binaryPath;
+    this.workerArgs = workerArgs;
+    this.size = Math.max(1, size);
+    this.slots = Math.max(1, slots);
+    this.maxQueued = maxQueued;
+    this.workers = [];
+    this.idle = []; // workers with a free slot
+    this.queue = [];
+    this.nextId = 1;
+  }
+
+  start() {
+    if (this.workers.length > 0) return;
+    for (let i = 0; i < this.size; i++) this.spawnWorker();
+  }
+
+  spawnWorker() {
+    const worker = new CanvasWorker(
+      this.binaryPath,
+      this.workerArgs,
+      (dead, respawn) => {
+        this.workers = this.workers.filter((w) => w !== dead);
+        this.idle = this.idle.filter((w) => w !== dead);
+        // Jobs waiting for this worker's caches can run anywhere now.
+        for (const job of this.queue) {
+          if (job.target === dead) job.target = undefined;
+        }
+        for (const worker of this.idle.splice(0)) this.release(worker);
+        // Respawn after a crash or a timeout kill, but not in a tight loop.
+        if (respawn) setTimeout(() => this.spawnWorker(), 100);
+      }
+    );
+    this.workers.push(worker);
+    this.release(worker);
+  }
+
+  hasSlot(worker) {
+    return worker.pending.size < this.slots;
+  }
+
+  // The next queued job worker may take: interactive first, then batch.
+  nextJobFor(worker) {
+    const fits = (job) => !job.target || job.target === worker;
+    const index = this.queue.findIndex(
+      (job) => fits(job) && job.priority === "interactive"
+    );
+    return index !== -1 ? index : this.queue.findIndex(fits);
+  }
+
+  release(worker) {
+    while (this.hasSlot(worker)) {
+      const index = this.nextJobFor(worker);
+      if (index === -1) break;
+      this.dispatch(worker, this.queue.splice(index, 1)[0]);
+    }
+    if (this.hasSlot(worker) && !this.idle.includes(worker)) {
+      this.idle.push(worker);
+    }
+  }
+
+  dispatch(worker, job) {
+    const args = [
+      ...(job.onChunk ? ["--chunked"] : []),
+      ...(job.priority === "batch" ? ["--priority", "batch"] : []),
+      ...job.args,
+    ];
+    worker
+      .run(job.id, job.op, args, job.input, job.timeout, job.onChunk)
+      .then(job.resolve, job.reject)
+      .finally(() => {
+        if (!worker.dead) this.release(worker);
+      });
+    if (!this.hasSlot(worker)) {
+      this.idle = this.idle.filter((w) => w !== worker);
+    }
+  }
+
+  // Run one job; resolves with { stdout, stderr, output } where output is
+  // the encoded result when an output path of "-" was given. Pass the
+  // source image bytes as `input` together with an input path of "-".
+  // Jobs with the same `affinity` string always go to the same worker (and
+  // wait for it when busy), so they can share what that worker has cached.
+  // priority is "interactive" (default) or "batch". With onChunk(buffer,
+  // message) the encoded output is passed on in pieces while the worker
+  // encodes it, and `output` is only the rest of it (often empty).
+  run(
+    op,
+    args,
+    {
+      timeout = 30000,
+      input = Buffer.alloc(0),
+      affinity,
+      priority = "interactive",
+      onChunk,
+    } = {}
+  ) {
+    for (const arg of args) {
+      if (/\s/.test(arg)) {
+        return Promise.reject(
+          new Error(`Worker arguments must not contain whitespace: ${arg}`)
+        );
+      }
+    }
+    if (!PRIORITIES.includes(priority)) {
+      return Promise.reject(new Error(`Unknown job priority: ${priority}`));
+    }
+
+    this.start();
+    return new Promise((resolve, reject) => {
+      const job = {
+        id: String(this.nextId++),
+        op,
+        args,
+        input,
+        timeout,
+        priority,
+        onChunk,
+        resolve,
+        reject,
+        target:
+          affinity && this.workers.length > 0
+            ? this.workers[hashString(affinity) % this.workers.length]
+            : undefined,
+      };
+      const index = job.target
+        ? this.idle.indexOf(job.target)
+        : this.idle.length > 0
+        ? 0
+        : -1;
+      if (index !== -1) {
+        this.dispatch(this.idle[index], job);
+      } else if (this.queue.length >= this.maxQueued) {
+        reject(new Error("busy"));
+      } else {
+        this.queue.push(job);
+      }
+    });
+  }
+}
+
+module.exports = { CanvasWorkerPool, cpuVariantPath };